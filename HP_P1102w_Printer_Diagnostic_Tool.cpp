@@ -3,40 +3,97 @@
 // - Continuous wake mode to prevent deep sleep
 // - Full diagnostic UI with all buttons
 // - Advanced Queue Manager (auto-refresh, age highlight, cancel options)
-// - Output controls (raw/cleaned, ANSI stripping, timestamped export)
+// - Output controls (raw/cleaned, ANSI colour rendering or stripping, timestamped export)
 // - Auto-recovery assessment for disabled queues
-// - Config persistence for all settings
+// - Config persistence for all settings (debounced atomic writes, live reload)
+// - Background mode: wake keeps running with the window closed (tray icon)
+// - Wake engine racing PJL/TCP/ICMP/SNMP/WoL and learning the fastest
+// - PJL ECHO link probe (application RTT + throughput) with metrics history
+// - Print benchmark: N synthetic jobs timed through the queue (percentiles)
+// - Raw port 9100 printing via sendfile to separate CUPS cost from network cost
+// - Per-job latency tracking (queue / print / total) per user and size bucket
+// - Parallel path prober (TTL-limited UDP/ICMP, IP_RECVERR) to find the failing hop
+// - Concurrent per-interface probes (SO_BINDTODEVICE / source bind) on multi-homed hosts
+// - Printer host may be a hostname, .local name or IPv6; cached resolution + happy eyeballs
+// - Incremental re-diagnosis: cached check results invalidated by dependency
+// - Spool inspector: per-job size and transfer-time estimate, outlier jobs flagged
+// - Live transfer monitor: sock_diag stats for the backend's socket to 9100, stalls flagged
+// - Queue device-URI drift detection against the live printer address, one-step re-point
+// - Support bundle: sources collected in parallel under deadlines, streamed into tar.zst
+// - Rotating binary session journal of output lines, commands and probes (--journal)
+// - Incremental output search over the whole session (and past sessions from the journal)
+// - Seqlock shared-memory status segment for other tools (--status)
+// - Session-bus D-Bus API over the cached status; headless with --service
 //
 // Requires: C++17, gtkmm-3.0, CUPS utilities (lpstat, cancel), HPLIP (hp-info),
-//           optional sudo for cupsdisable/cupsenable/systemctl/journalctl.
+//           pkexec (polkit) for cupsdisable/cupsenable/systemctl/journalctl;
+//           falls back to non-interactive sudo when pkexec is missing.
 // ============================================================
 
 #include <gtkmm.h>
 #include <giomm/file.h>
+#include <glib-unix.h>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/select.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
+#include <linux/sockios.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <poll.h>
 
 #include <array>
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
+#include <charconv>
 #include <chrono>
+#include <condition_variable>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <cstdio>
+#include <csignal>
 #include <cstring>
 #include <ctime>
+#include <deque>
 #include <fstream>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <optional>
+#include <set>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 #include <cctype>
 
@@ -65,21 +122,50 @@ static inline std::string trim_copy(std::string s) {
     return s;
 }
 
+static inline std::string_view trim_view(std::string_view s) {
+    while (!s.empty() && std::isspace((unsigned char)s.front())) s.remove_prefix(1);
+    while (!s.empty() && std::isspace((unsigned char)s.back())) s.remove_suffix(1);
+    return s;
+}
+
+static std::string format_bytes(long long bytes) {
+    if (bytes < 0) return "?";
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    if (bytes < 1024) out << bytes << " B";
+    else if (bytes < 1024 * 1024) out << bytes / 1024.0 << " KB";
+    else if (bytes < 1024LL * 1024 * 1024) out << bytes / (1024.0 * 1024) << " MB";
+    else out << bytes / (1024.0 * 1024 * 1024) << " GB";
+    return out.str();
+}
+
 // Strips ANSI escape sequences (best-effort)
 static std::string strip_ansi(const std::string& input) {
     std::string output;
-    bool in_escape = false;
+    // After ESC: CSI runs to a final byte in @..~, OSC to BEL or ESC backslash,
+    // a charset designation (ESC ( B from `tput sgr0`) takes one more byte.
+    enum { Text, Escape, Csi, Osc, Charset } state = Text;
 
     for (unsigned char c : input) {
-        if (c == 0x1B) { // ESC
-            in_escape = true;
-            continue;
-        }
-        if (in_escape) {
-            if (c >= '@' && c <= '~') in_escape = false;
-            continue;
+        switch (state) {
+        case Text:
+            if (c == 0x1B) state = Escape;
+            else output.push_back((char)c);
+            break;
+        case Escape:
+            state = c == '[' ? Csi : c == ']' ? Osc : c && std::strchr("()*+", c) ? Charset : Text;
+            break;
+        case Csi:
+            if (c >= '@' && c <= '~') state = Text;
+            break;
+        case Osc:
+            if (c == '\a') state = Text;
+            else if (c == 0x1B) state = Escape;  // ESC backslash: the backslash ends it
+            break;
+        case Charset:
+            state = Text;
+            break;
         }
-        output.push_back((char)c);
     }
     return output;
 }
@@ -93,6 +179,51 @@ static std::string now_timestamp_yyyymmdd_hhmmss() {
     return oss.str();
 }
 
+// Single-quotes s for /bin/sh.
+static std::string shell_quote(const std::string& s) {
+    std::string out = "'";
+    for (char c : s) {
+        if (c == '\'') out += "'\\''";
+        else out.push_back(c);
+    }
+    out += "'";
+    return out;
+}
+
+static void journal_command(const std::string& cmd, long long duration_ms, int exit_code);
+
+// Runs a shell command and captures stdout; exit_code gets the shell status.
+static std::string run_shell_capture(const std::string& cmd, int& exit_code) {
+    std::array<char, 256> buffer{};
+    std::string result;
+    exit_code = -1;
+
+    const auto started = std::chrono::steady_clock::now();
+    FILE* pipe = popen(cmd.c_str(), "r");
+    if (!pipe) {
+        journal_command(cmd, 0, exit_code);
+        return "";
+    }
+
+    while (fgets(buffer.data(), (int)buffer.size(), pipe) != nullptr) {
+        result += buffer.data();
+    }
+
+    int status = pclose(pipe);
+    if (status != -1 && WIFEXITED(status)) exit_code = WEXITSTATUS(status);
+    journal_command(cmd, std::chrono::duration_cast<std::chrono::milliseconds>(
+                             std::chrono::steady_clock::now() - started).count(), exit_code);
+    return result;
+}
+
+// Runs fn on the GTK main loop; safe to call from worker threads.
+static void run_on_main(std::function<void()> fn) {
+    Glib::MainContext::get_default()->invoke([fn]() -> bool {
+        fn();
+        return false;
+    });
+}
+
 static void ensure_config_dir_exists() {
     auto dir = Gio::File::create_for_path(config_dir_path());
     try {
@@ -102,229 +233,4897 @@ static void ensure_config_dir_exists() {
     }
 }
 
+// Crash-safe replace: temp file + fsync + rename + directory fsync.
+static bool write_file_atomic(const std::string& path, const std::string& data) {
+    const std::string tmp = path + ".tmp";
+
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+
+    const char* p = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+        ssize_t n = ::write(fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            ::unlink(tmp.c_str());
+            return false;
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+
+    if (::fsync(fd) != 0 || ::close(fd) != 0) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    if (::rename(tmp.c_str(), path.c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+
+    // Persist the rename itself.
+    const std::string dir = path.substr(0, path.find_last_of('/') + 1);
+    int dfd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd >= 0) {
+        ::fsync(dfd);
+        ::close(dfd);
+    }
+    return true;
+}
+
 // ============================================================
-// Data model
+// Session journal
+// - Every print_* line, shell command (duration, exit code) and probe result,
+//   appended to a binary, length-prefixed log under config_dir/journal
+// - Appends only encode into a buffer; a writer thread flushes it every second
+//   (or at 64 KB), rotates segments at 4 MB and gzips the closed ones
+// - Segments are named by their first timestamp: a seek by time picks the
+//   segment from the names, then skips records using their headers alone
+// Record: u32 size | u8 type | i64 time (us) | u16 count | count x (u32 len, bytes)
 // ============================================================
-struct PrintJob {
-    std::string job_id;
-    std::string user;
-    std::string file;
-    std::string status;
-    std::optional<std::chrono::system_clock::time_point> submitted_at;
+enum class JournalType : uint8_t { Line = 1, Command = 2, Probe = 3 };
+
+struct JournalRecord {
+    JournalType type = JournalType::Line;
+    int64_t time_us = 0;
+    std::vector<std::string> fields; // Line: level, text. Command: cmd, ms, exit. Probe: name, detail.
+};
+
+struct JournalSegment {
+    int64_t start_us = 0;
+    std::string path;
+    bool compressed = false;
+};
+
+static const size_t JOURNAL_FLUSH_BYTES   = 64 * 1024;
+static const size_t JOURNAL_SEGMENT_BYTES = 4 * 1024 * 1024;
+static const size_t JOURNAL_KEEP_SEGMENTS = 16;
+static const size_t JOURNAL_HEADER_BYTES  = 1 + 8 + 2; // after the size prefix
+
+static std::string journal_dir_path() {
+    return Glib::build_filename(config_dir_path(), "journal");
+}
+
+static int64_t journal_now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static void put_le(std::string& out, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; ++i) out.push_back((char)((v >> (8 * i)) & 0xFF));
+}
+
+static uint64_t get_le(const char* p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; ++i) v |= (uint64_t)(unsigned char)p[i] << (8 * i);
+    return v;
+}
+
+static void journal_encode(std::string& out, JournalType type, int64_t time_us,
+                           const std::vector<std::string>& fields) {
+    size_t body = JOURNAL_HEADER_BYTES;
+    for (const auto& f : fields) body += 4 + f.size();
+    put_le(out, body, 4);
+    put_le(out, (uint8_t)type, 1);
+    put_le(out, (uint64_t)time_us, 8);
+    put_le(out, fields.size(), 2);
+    for (const auto& f : fields) {
+        put_le(out, f.size(), 4);
+        out += f;
+    }
+}
+
+// Decodes records at or after since_us into out (when given). Stops at the first
+// torn record and returns the offset just past the last complete one.
+static size_t journal_decode(const std::string& data, int64_t since_us, std::vector<JournalRecord>* out) {
+    size_t pos = 0;
+    while (data.size() - pos >= 4 + JOURNAL_HEADER_BYTES) {
+        const size_t body = (size_t)get_le(&data[pos], 4);
+        if (body < JOURNAL_HEADER_BYTES || body > data.size() - pos - 4) break;
+
+        const char* p = &data[pos + 4];
+        const int64_t when = (int64_t)get_le(p + 1, 8);
+        if (out && when >= since_us) {
+            JournalRecord rec;
+            rec.type = (JournalType)(uint8_t)p[0];
+            rec.time_us = when;
+            const size_t count = (size_t)get_le(p + 9, 2);
+            size_t off = JOURNAL_HEADER_BYTES;
+            for (size_t i = 0; i < count && body - off >= 4; ++i) {
+                const size_t len = (size_t)get_le(p + off, 4);
+                off += 4;
+                if (len > body - off) break;
+                rec.fields.emplace_back(p + off, len);
+                off += len;
+            }
+            out->push_back(std::move(rec));
+        }
+        pos += 4 + body;
+    }
+    return pos;
+}
+
+// Segments oldest first ("journal-<start us>.bin", optionally ".gz").
+static std::vector<JournalSegment> journal_segments() {
+    std::vector<JournalSegment> segs;
+    DIR* dir = ::opendir(journal_dir_path().c_str());
+    if (!dir) return segs;
+    while (dirent* ent = ::readdir(dir)) {
+        long long start = 0;
+        int used = 0;
+        if (std::sscanf(ent->d_name, "journal-%lld.bin%n", &start, &used) != 1 || used <= 0) continue;
+        const std::string rest = ent->d_name + used;
+        if (!rest.empty() && rest != ".gz") continue;
+        segs.push_back({start, Glib::build_filename(journal_dir_path(), ent->d_name), rest == ".gz"});
+    }
+    ::closedir(dir);
+    std::sort(segs.begin(), segs.end(),
+              [](const JournalSegment& a, const JournalSegment& b) { return a.start_us < b.start_us; });
+    return segs;
+}
+
+static std::string journal_load(const JournalSegment& seg) {
+    std::string data;
+    try {
+        Glib::RefPtr<Gio::InputStream> in = Gio::File::create_for_path(seg.path)->read();
+        if (seg.compressed) {
+            in = Gio::ConverterInputStream::create(
+                in, Gio::ZlibDecompressor::create(Gio::ZLIB_COMPRESSOR_FORMAT_GZIP));
+        }
+        std::array<char, 64 * 1024> buf{};
+        gssize n = 0;
+        while ((n = in->read(buf.data(), buf.size())) > 0) data.append(buf.data(), (size_t)n);
+        in->close();
+    } catch (...) {
+        // Non-fatal: a damaged segment still yields the records read so far
+    }
+    return data;
+}
+
+// Replaces path with path.gz; the original stays if anything fails.
+static bool journal_compress(const std::string& path) {
+    const std::string data = journal_load({0, path, false});
+    const std::string tmp = path + ".gz.tmp";
+    try {
+        auto out = Gio::ConverterOutputStream::create(
+            Gio::File::create_for_path(tmp)->replace(),
+            Gio::ZlibCompressor::create(Gio::ZLIB_COMPRESSOR_FORMAT_GZIP, 6));
+        gsize written = 0;
+        out->write_all(data.data(), data.size(), written);
+        out->close();
+    } catch (...) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    if (::rename(tmp.c_str(), (path + ".gz").c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    ::unlink(path.c_str());
+    return true;
+}
+
+class Journal {
+public:
+    static Journal& instance() {
+        static Journal journal;
+        return journal;
+    }
+
+    ~Journal() { close(); }
+
+    // Only the GUI process journals (never the root helper); until open()
+    // appends are dropped.
+    void open() {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if (m_open) return;
+        m_open = true;
+        m_stop = false;
+        if (m_opened_us == 0) m_opened_us = journal_now_us();
+        m_thread = std::thread([this]() { writer_loop(); });
+    }
+
+    // When this process first opened the journal; older records are past sessions.
+    int64_t opened_us() const { return m_opened_us; }
+
+    // Flushes whatever is buffered, then stops the writer.
+    void close() {
+        {
+            std::lock_guard<std::mutex> lk(m_mutex);
+            if (!m_open) return;
+            m_open = false;
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        if (m_thread.joinable()) m_thread.join();
+    }
+
+    void append(JournalType type, const std::vector<std::string>& fields) {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if (!m_open) return;
+        journal_encode(m_pending, type, journal_now_us(), fields);
+        if (m_pending.size() >= JOURNAL_FLUSH_BYTES) m_cv.notify_one();
+    }
+
+    // Records at or after since_us across all segments, oldest first.
+    static std::vector<JournalRecord> read_since(int64_t since_us) {
+        std::vector<JournalRecord> out;
+        read_segments(since_us, [&out](std::vector<JournalRecord>& recs) {
+            out.insert(out.end(), std::make_move_iterator(recs.begin()), std::make_move_iterator(recs.end()));
+            return true;
+        });
+        return out;
+    }
+
+    // Same, one decoded segment at a time; fn returns false to stop early.
+    static void read_segments(int64_t since_us, const std::function<bool(std::vector<JournalRecord>&)>& fn) {
+        auto segs = journal_segments();
+        // Last segment starting at or before since_us; everything after it follows.
+        auto it = std::upper_bound(segs.begin(), segs.end(), since_us,
+                                   [](int64_t t, const JournalSegment& s) { return t < s.start_us; });
+        if (it != segs.begin()) --it;
+        for (; it != segs.end(); ++it) {
+            std::vector<JournalRecord> recs;
+            journal_decode(journal_load(*it), since_us, &recs);
+            if (!fn(recs)) return;
+        }
+    }
+
+private:
+    Journal() = default;
+
+    void writer_loop() {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        for (;;) {
+            m_cv.wait_for(lk, std::chrono::seconds(1), [this]() {
+                return m_stop || m_pending.size() >= JOURNAL_FLUSH_BYTES;
+            });
+            std::string batch;
+            batch.swap(m_pending);
+            const bool stop = m_stop;
+            lk.unlock();
+
+            if (!batch.empty()) write_batch(batch);
+            if (stop) break;
+            lk.lock();
+        }
+        if (m_fd >= 0) {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+    }
+
+    void write_batch(const std::string& batch) {
+        if (m_fd < 0 && !open_segment((int64_t)get_le(batch.data() + 5, 8))) return;
+
+        const char* p = batch.data();
+        size_t left = batch.size();
+        while (left > 0) {
+            ssize_t n = ::write(m_fd, p, left);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            p += n;
+            left -= (size_t)n;
+        }
+        m_size += batch.size();
+
+        // Batches hold whole records, so a segment never splits one.
+        if (m_size >= JOURNAL_SEGMENT_BYTES) {
+            ::close(m_fd);
+            m_fd = -1;
+            journal_compress(m_path);
+            prune();
+        }
+    }
+
+    // Continues the newest uncompressed segment (dropping a torn tail left by
+    // a crash) or starts a new one named after first_us.
+    bool open_segment(int64_t first_us) {
+        ensure_config_dir_exists();
+        ::mkdir(journal_dir_path().c_str(), 0700);
+
+        auto segs = journal_segments();
+        for (size_t i = 0; i < segs.size(); ++i) {
+            if (segs[i].compressed) continue;
+            const bool newest = i + 1 == segs.size();
+            const std::string data = journal_load(segs[i]);
+            if (!newest || data.size() >= JOURNAL_SEGMENT_BYTES) {
+                journal_compress(segs[i].path);
+                continue;
+            }
+            const size_t good = journal_decode(data, 0, nullptr);
+            m_fd = ::open(segs[i].path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+            if (m_fd < 0) break;
+            if (good < data.size() && ::ftruncate(m_fd, (off_t)good) != 0) {
+                ::close(m_fd);
+                m_fd = -1;
+                break;
+            }
+            m_path = segs[i].path;
+            m_size = good;
+            return true;
+        }
+
+        char name[64];
+        std::snprintf(name, sizeof(name), "journal-%016lld.bin", (long long)first_us);
+        m_path = Glib::build_filename(journal_dir_path(), name);
+        m_fd = ::open(m_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+        m_size = 0;
+        if (m_fd >= 0) prune();
+        return m_fd >= 0;
+    }
+
+    void prune() {
+        auto segs = journal_segments();
+        for (size_t i = 0; i + JOURNAL_KEEP_SEGMENTS < segs.size(); ++i) ::unlink(segs[i].path.c_str());
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::thread m_thread;
+    std::string m_pending;
+    bool m_open = false;
+    bool m_stop = false;
+    std::atomic<int64_t> m_opened_us{0};
+
+    // Writer thread only.
+    int m_fd = -1;
+    std::string m_path;
+    size_t m_size = 0;
 };
 
+static void journal_line(const std::string& level, const std::string& text) {
+    Journal::instance().append(JournalType::Line, {level, text});
+}
+
+// Background polls repeat the same commands every few seconds. A command that
+// ends with the same exit code as its last record within COMMAND_REPEAT_SEC is
+// only counted; the next record written for it carries the count.
+static void journal_command(const std::string& cmd, long long duration_ms, int exit_code) {
+    static constexpr int COMMAND_REPEAT_SEC = 600;
+    struct Last {
+        int exit_code;
+        std::chrono::steady_clock::time_point written;
+        long long repeats;
+    };
+    static std::mutex mutex;
+    static std::map<std::string, Last> last;
+
+    const auto now = std::chrono::steady_clock::now();
+    const auto window = std::chrono::seconds(COMMAND_REPEAT_SEC);
+    long long repeats = 0;
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+        auto it = last.find(cmd);
+        if (it != last.end() && it->second.exit_code == exit_code && now - it->second.written < window) {
+            ++it->second.repeats;
+            return;
+        }
+        if (it != last.end()) repeats = it->second.repeats;
+        if (last.size() > 256) {
+            for (auto e = last.begin(); e != last.end();)
+                e = now - e->second.written >= window ? last.erase(e) : std::next(e);
+        }
+        last[cmd] = {exit_code, now, 0};
+    }
+    std::vector<std::string> fields{cmd, std::to_string(duration_ms), std::to_string(exit_code)};
+    if (repeats > 0) fields.push_back(std::to_string(repeats));
+    Journal::instance().append(JournalType::Command, fields);
+}
+
+static void journal_probe(const std::string& name, const std::string& detail) {
+    Journal::instance().append(JournalType::Probe, {name, detail});
+}
+
+// One line: local time with milliseconds, then the record.
+static std::string journal_format(const JournalRecord& rec) {
+    std::time_t secs = (std::time_t)(rec.time_us / 1000000);
+    std::tm tm{};
+    localtime_r(&secs, &tm);
+    std::ostringstream out;
+    out << std::put_time(&tm, "%Y-%m-%d %H:%M:%S") << '.'
+        << std::setw(3) << std::setfill('0') << (rec.time_us / 1000) % 1000 << std::setfill(' ') << "  ";
+
+    auto field = [&rec](size_t i) { return i < rec.fields.size() ? rec.fields[i] : std::string(); };
+    switch (rec.type) {
+        case JournalType::Line:
+            out << std::left << std::setw(8) << field(0) << std::right << field(1);
+            break;
+        case JournalType::Command:
+            out << "command " << field(0) << "  (" << field(1) << " ms, exit " << field(2) << ")";
+            if (!field(3).empty()) out << "  [" << field(3) << " identical runs since last record]";
+            break;
+        case JournalType::Probe:
+            out << "probe   " << field(0) << ": " << field(1);
+            break;
+        default:
+            out << "record type " << (int)rec.type;
+            break;
+    }
+    return out.str();
+}
+
 // ============================================================
-// CupsClient abstraction
+// Address resolution
+// - Printer host: IPv4/IPv6 literal, DNS name or .local (mDNS) name
+// - Names are cached with a TTL; a stale entry is served while a
+//   background refresh runs; only a worker thread's first lookup of a
+//   name blocks, the UI thread never does
+// - The family that last won a connect is remembered per host
 // ============================================================
-class CupsClient {
-public:
-    explicit CupsClient(std::function<std::string(const std::string&)> exec)
-        : m_exec(std::move(exec)) {}
+static std::mutex& printer_host_mutex() {
+    static std::mutex m;
+    return m;
+}
+static std::string& printer_host_storage() {
+    static std::string host = PRINTER_IP;
+    return host;
+}
 
-    std::string printer_state_raw() {
-        return m_exec("lpstat -p \"" + PRINTER_NAME + "\" 2>&1");
+// Configured printer address ([printer] host in config.ini, default PRINTER_IP).
+static std::string printer_host() {
+    std::lock_guard<std::mutex> lk(printer_host_mutex());
+    return printer_host_storage();
+}
+static void set_printer_host(const std::string& host) {
+    std::lock_guard<std::mutex> lk(printer_host_mutex());
+    printer_host_storage() = host.empty() ? PRINTER_IP : host;
+}
+
+static std::string address_family_path() {
+    return Glib::build_filename(config_dir_path(), "address_family.ini");
+}
+
+static std::string sockaddr_to_string(const sockaddr_storage& ss) {
+    char buf[INET6_ADDRSTRLEN] = {0};
+    if (ss.ss_family == AF_INET)
+        inet_ntop(AF_INET, &((const sockaddr_in&)ss).sin_addr, buf, sizeof(buf));
+    else if (ss.ss_family == AF_INET6)
+        inet_ntop(AF_INET6, &((const sockaddr_in6&)ss).sin6_addr, buf, sizeof(buf));
+    return buf;
+}
+
+static socklen_t sockaddr_len(const sockaddr_storage& ss) {
+    return ss.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+}
+
+static void sockaddr_set_port(sockaddr_storage& ss, int port) {
+    if (ss.ss_family == AF_INET) ((sockaddr_in&)ss).sin_port = htons(port);
+    else if (ss.ss_family == AF_INET6) ((sockaddr_in6&)ss).sin6_port = htons(port);
+}
+
+class AddressCache {
+public:
+    static AddressCache& instance() {
+        static AddressCache cache;
+        return cache;
     }
 
-    std::string printer_long_raw() {
-        return m_exec("lpstat -l -p \"" + PRINTER_NAME + "\" 2>&1");
+    ~AddressCache() {
+        {
+            std::lock_guard<std::mutex> lk(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        if (m_refresher.joinable()) m_refresher.join();
     }
 
-    std::string get_printer_friendly_name() {
-        const std::string out = printer_long_raw();
-        std::istringstream iss(out);
-        std::string line;
-        while (std::getline(iss, line)) {
-            auto pos = line.find("Description:");
-            if (pos != std::string::npos) {
-                std::string desc = line.substr(pos + 12);
-                auto l = desc.find_first_not_of(" \t");
-                auto r = desc.find_last_not_of(" \t\r\n");
-                if (l != std::string::npos && r != std::string::npos) 
-                    desc = desc.substr(l, r - l + 1);
-                if (!desc.empty()) return desc;
+    // The thread that runs the GLib main loop; lookups there never block on DNS.
+    static void set_ui_thread() { ui_thread() = std::this_thread::get_id(); }
+
+    // Addresses for host (port 0), ordered for connecting: families interleaved,
+    // remembered family first (IPv6 first when nothing is known, per RFC 8305).
+    // A cold miss on the UI thread queues the name for the refresher and returns
+    // nothing; resolving() then tells "not yet" apart from "does not resolve".
+    std::vector<sockaddr_storage> lookup(const std::string& host) {
+        std::vector<sockaddr_storage> addrs;
+        if (!resolve_numeric(host, addrs)) {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            auto it = m_entries.find(host);
+            if (it != m_entries.end()) {
+                addrs = it->second.addrs;
+                if (std::chrono::steady_clock::now() >= it->second.expires) schedule_refresh(host);
+            } else if (std::this_thread::get_id() == ui_thread()) {
+                schedule_refresh(host);
+            } else {
+                lk.unlock();
+                addrs = resolve_name(host);
+                lk.lock();
+                store(host, addrs);
             }
         }
-        return PRINTER_NAME;
+        return order(host, addrs);
     }
 
-    bool has_recoverable_reason_hint(std::string* matched_reason = nullptr) {
-        std::string out = printer_long_raw();
-        std::transform(out.begin(), out.end(), out.begin(), 
-                      [](unsigned char c){ return (char)std::tolower(c); });
+    // Warms the cache without blocking the caller.
+    void prefetch(const std::string& host) {
+        std::vector<sockaddr_storage> ignored;
+        if (resolve_numeric(host, ignored)) return;
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if (!m_entries.count(host)) schedule_refresh(host);
+    }
 
-        const std::vector<std::pair<std::string, std::string>> needles = {
-            {"out of paper", "out of paper"},
-            {"media-empty", "media-empty"},
-            {"media empty", "media empty"},
-        };
+    bool resolving(const std::string& host) {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        return m_pending.count(host) && !m_entries.count(host);
+    }
 
-        for (const auto& p : needles) {
-            if (out.find(p.first) != std::string::npos) {
-                if (matched_reason) *matched_reason = p.second;
-                return true;
+    void remember_family(const std::string& host, int family) {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        load_families();
+        if (m_families[host] == family) return;
+        m_families[host] = family;
+
+        Glib::KeyFile kf;
+        for (const auto& f : m_families) kf.set_integer("family", f.first, f.second == AF_INET6 ? 6 : 4);
+        ensure_config_dir_exists();
+        write_file_atomic(address_family_path(), kf.to_data());
+    }
+
+    int preferred_family(const std::string& host) {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        load_families();
+        auto it = m_families.find(host);
+        return it == m_families.end() ? AF_UNSPEC : it->second;
+    }
+
+private:
+    static constexpr int TTL_SEC = 300;
+    static constexpr int NEGATIVE_TTL_SEC = 15;
+
+    struct Entry {
+        std::vector<sockaddr_storage> addrs;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::map<std::string, Entry> m_entries;
+    std::set<std::string> m_pending;
+    std::thread m_refresher;
+    bool m_stop = false;
+    std::map<std::string, int> m_families;
+    bool m_families_loaded = false;
+
+    static std::thread::id& ui_thread() {
+        static std::thread::id id;
+        return id;
+    }
+
+    static std::string strip_brackets(const std::string& host) {
+        if (host.size() > 2 && host.front() == '[' && host.back() == ']') return host.substr(1, host.size() - 2);
+        return host;
+    }
+
+    static std::vector<sockaddr_storage> getaddrinfo_all(const std::string& host, int flags) {
+        std::vector<sockaddr_storage> out;
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = flags;
+        addrinfo* res = nullptr;
+        if (getaddrinfo(host.c_str(), nullptr, &hints, &res) != 0) return out;
+        for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+            if (ai->ai_family != AF_INET && ai->ai_family != AF_INET6) continue;
+            sockaddr_storage ss{};
+            memcpy(&ss, ai->ai_addr, ai->ai_addrlen);
+            bool dup = false;
+            for (const auto& o : out)
+                dup = dup || (o.ss_family == ss.ss_family && sockaddr_to_string(o) == sockaddr_to_string(ss));
+            if (!dup) out.push_back(ss);
+        }
+        freeaddrinfo(res);
+        return out;
+    }
+
+    // Literals (including "[v6]" and "fe80::1%wlan0") never touch the cache.
+    static bool resolve_numeric(const std::string& host, std::vector<sockaddr_storage>& out) {
+        out = getaddrinfo_all(strip_brackets(host), AI_NUMERICHOST);
+        return !out.empty();
+    }
+
+    // Blocking; runs on the refresher or on a worker's first lookup of a name.
+    static std::vector<sockaddr_storage> resolve_name(const std::string& host) {
+        auto out = getaddrinfo_all(host, AI_ADDRCONFIG);
+        // Without nss-mdns, .local names only resolve through Avahi.
+        if (out.empty() && host.size() > 6 && host.compare(host.size() - 6, 6, ".local") == 0) {
+            int code = 0;
+            std::istringstream lines(run_shell_capture("avahi-resolve-host-name " + shell_quote(host) + " 2>/dev/null", code));
+            for (std::string line; std::getline(lines, line);) {
+                std::istringstream ls(line);
+                std::string name, addr;
+                std::vector<sockaddr_storage> one;
+                if (ls >> name >> addr && resolve_numeric(addr, one)) out.push_back(one.front());
             }
         }
-        return false;
+        return out;
     }
 
-    bool queue_disabled() {
-        return printer_state_raw().find("disabled") != std::string::npos;
+    void store(const std::string& host, const std::vector<sockaddr_storage>& addrs) {
+        Entry& e = m_entries[host];
+        // A failed refresh keeps the last good answer rather than forgetting the printer.
+        if (!addrs.empty() || e.addrs.empty()) e.addrs = addrs;
+        e.expires = std::chrono::steady_clock::now() +
+                    std::chrono::seconds(addrs.empty() ? NEGATIVE_TTL_SEC : TTL_SEC);
     }
 
-    std::vector<PrintJob> get_jobs() {
-        std::string out = m_exec("lpstat -W not-completed -o -l 2>&1");
-        if (out.find("Unknown option") != std::string::npos ||
-            out.find("invalid option") != std::string::npos) {
-            out = m_exec("lpstat -o -l 2>&1");
+    // Caller holds m_mutex.
+    void schedule_refresh(const std::string& host) {
+        m_pending.insert(host);
+        if (!m_refresher.joinable()) m_refresher = std::thread([this]() { refresh_loop(); });
+        m_cv.notify_all();
+    }
+
+    void refresh_loop() {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        while (!m_stop) {
+            if (m_pending.empty()) {
+                m_cv.wait(lk, [this]() { return m_stop || !m_pending.empty(); });
+                continue;
+            }
+            std::string host = *m_pending.begin();
+            lk.unlock();
+            auto addrs = resolve_name(host);
+            lk.lock();
+            m_pending.erase(host);
+            store(host, addrs);
         }
-        return parse_lpstat_jobs(out);
     }
 
-    void cancel_job(const std::string& job_id) {
-        m_exec("cancel '" + job_id + "' 2>&1");
+    std::vector<sockaddr_storage> order(const std::string& host, const std::vector<sockaddr_storage>& addrs) {
+        int first = preferred_family(host);
+        if (first == AF_UNSPEC) first = AF_INET6;
+        std::vector<sockaddr_storage> a, b, out;
+        for (const auto& ss : addrs) (ss.ss_family == first ? a : b).push_back(ss);
+        for (size_t i = 0; i < std::max(a.size(), b.size()); ++i) {
+            if (i < a.size()) out.push_back(a[i]);
+            if (i < b.size()) out.push_back(b[i]);
+        }
+        return out;
     }
 
-    void cancel_all() {
-        m_exec("cancel -a 2>&1");
+    // Caller holds m_mutex.
+    void load_families() {
+        if (m_families_loaded) return;
+        m_families_loaded = true;
+        Glib::KeyFile kf;
+        try {
+            if (!kf.load_from_file(address_family_path())) return;
+            for (const auto& key : kf.get_keys("family"))
+                m_families[key] = kf.get_integer("family", key) == 6 ? AF_INET6 : AF_INET;
+        } catch (...) {
+            // Non-fatal: start without a remembered family
+        }
     }
+};
 
-    void cancel_all_from_user(const std::string& user) {
-        for (const auto& j : get_jobs())
-            if (j.user == user) cancel_job(j.job_id);
+// First IPv4 address of host as a literal ("" when it has none); for IPv4-only probes.
+static std::string resolve_ipv4(const std::string& host) {
+    for (const auto& ss : AddressCache::instance().lookup(host))
+        if (ss.ss_family == AF_INET) return sockaddr_to_string(ss);
+    return "";
+}
+
+// Happy-eyeballs connect (RFC 8305): attempts start 250 ms apart across the
+// ordered candidates and the first to complete wins; the winner's family is remembered.
+// Returns a connected (blocking) socket, or -1 with err set (ETIMEDOUT on timeout).
+// prepare runs on each fresh socket before connect (e.g. to pin it to an interface).
+static int tcp_connect_socket(const std::string& host, int port, int timeout_ms, int& err,
+                              const std::function<void(int)>& prepare = nullptr) {
+    using clock = std::chrono::steady_clock;
+    static const auto ATTEMPT_DELAY = std::chrono::milliseconds(250);
+
+    AddressCache& cache = AddressCache::instance();
+    std::vector<sockaddr_storage> addrs = cache.lookup(host);
+    err = 0;
+    if (addrs.empty()) {
+        err = cache.resolving(host) ? EAGAIN : ENXIO;  // Still resolving / did not resolve
+        return -1;
     }
 
-    void pause_queue() {
-        m_exec("sudo cupsdisable \"" + PRINTER_NAME + "\" 2>&1");
+    const auto deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
+    std::vector<pollfd> pending;
+    std::vector<int> families;
+    size_t next = 0;
+    auto next_start = clock::now();
+    int last_err = ETIMEDOUT;
+    int winner = -1, winner_family = AF_UNSPEC;
+
+    while (winner < 0) {
+        auto now = clock::now();
+        if (now >= deadline) {
+            last_err = ETIMEDOUT;
+            break;
+        }
+        if (next < addrs.size() && (now >= next_start || pending.empty())) {
+            sockaddr_storage ss = addrs[next++];
+            sockaddr_set_port(ss, port);
+            int sock = socket(ss.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+            if (sock < 0) {
+                last_err = errno;
+                continue;
+            }
+            if (prepare) prepare(sock);
+            if (connect(sock, (sockaddr*)&ss, sockaddr_len(ss)) == 0) {
+                winner = sock;
+                winner_family = ss.ss_family;
+                break;
+            }
+            if (errno != EINPROGRESS) {
+                last_err = errno;   // e.g. ENETUNREACH on a v6-less host: move on at once
+                ::close(sock);
+                continue;
+            }
+            pending.push_back({sock, POLLOUT, 0});
+            families.push_back(ss.ss_family);
+            next_start = now + ATTEMPT_DELAY;
+            continue;
+        }
+        if (pending.empty()) break;  // Every candidate failed
+
+        auto wake_at = deadline;
+        if (next < addrs.size()) wake_at = std::min(wake_at, next_start);
+        int wait_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(wake_at - now).count();
+        int res = ::poll(pending.data(), pending.size(), std::max(wait_ms, 0));
+        if (res < 0 && errno != EINTR) {
+            last_err = errno;
+            break;
+        }
+        for (size_t i = 0; i < pending.size();) {
+            if (!pending[i].revents) {
+                ++i;
+                continue;
+            }
+            int so_err = 0;
+            socklen_t len = sizeof(so_err);
+            getsockopt(pending[i].fd, SOL_SOCKET, SO_ERROR, &so_err, &len);
+            if (so_err == 0 && winner < 0) {
+                winner = pending[i].fd;
+                winner_family = families[i];
+            } else {
+                if (so_err != 0) last_err = so_err;
+                ::close(pending[i].fd);
+            }
+            pending.erase(pending.begin() + (long)i);
+            families.erase(families.begin() + (long)i);
+        }
     }
 
-    void resume_queue() {
-        m_exec("sudo cupsenable \"" + PRINTER_NAME + "\" 2>&1");
+    for (const auto& p : pending) ::close(p.fd);
+    if (winner < 0) {
+        err = last_err;
+        return -1;
     }
+    if (addrs.size() > 1) cache.remember_family(host, winner_family);
+    fcntl(winner, F_SETFL, fcntl(winner, F_GETFL) & ~O_NONBLOCK);
+    return winner;
+}
 
-private:
-    std::function<std::string(const std::string&)> m_exec;
+// Returns 0 when the port accepts, otherwise an errno value (ETIMEDOUT on timeout).
+static int tcp_connect_probe(const std::string& host, int port, int timeout_ms) {
+    int err = 0;
+    int sock = tcp_connect_socket(host, port, timeout_ms, err);
+    if (sock >= 0) ::close(sock);
+    return err;
+}
 
-    static std::optional<std::chrono::system_clock::time_point> parse_datetime_from_line(const std::string& rest) {
-        static const std::vector<std::string> months = {
-            "Jan","Feb","Mar","Apr","May","Jun","Jul","Aug","Sep","Oct","Nov","Dec"
-        };
+// ============================================================
+// Config store
+// - In-memory settings; UI changes only mark the store dirty
+// - Debounced write-behind on a background thread
+// - Atomic replace (temp file + fsync + rename); a failed write stays
+//   pending and is retried with backoff
+// - inotify watch so external edits apply live
+// ============================================================
+struct AppConfig {
+    bool show_raw = false;
+    bool strip_global = false;
+    bool strip_hplip = false;
+    bool wake_enabled = false;
+    int  wake_interval_minutes = 5;
+    std::string wake_mode = "interval";  // "interval" or "on_job"
+    bool wake_hold_queue = false;        // on_job: pause the queue while waking (may prompt polkit)
+    bool run_in_background = false;
+    std::string printer_host = PRINTER_IP;   // IPv4/IPv6 literal, DNS or .local name
+    std::string raw_host;                    // Raw port print target ("" = printer host); a stand-in listener works too
+    int  raw_port = PRINTER_PORT;
+
+    bool operator==(const AppConfig& o) const {
+        return show_raw == o.show_raw &&
+               strip_global == o.strip_global &&
+               strip_hplip == o.strip_hplip &&
+               wake_enabled == o.wake_enabled &&
+               wake_interval_minutes == o.wake_interval_minutes &&
+               wake_mode == o.wake_mode &&
+               wake_hold_queue == o.wake_hold_queue &&
+               run_in_background == o.run_in_background &&
+               printer_host == o.printer_host &&
+               raw_host == o.raw_host &&
+               raw_port == o.raw_port;
+    }
+    bool operator!=(const AppConfig& o) const { return !(*this == o); }
+};
 
-        auto is_month = [&](const std::string& t) {
-            for (const auto& m : months) if (t == m) return true;
-            return false;
-        };
+class ConfigStore {
+public:
+    ConfigStore() {
+        ensure_config_dir_exists();
+        read_file(m_cfg);
+        m_writer = std::thread([this]() { writer_loop(); });
+    }
 
-        std::istringstream iss(rest);
-        std::vector<std::string> tokens;
-        for (std::string t; iss >> t;) tokens.push_back(t);
+    ~ConfigStore() {
+        if (m_inotify_conn.connected()) m_inotify_conn.disconnect();
+        if (m_inotify_fd >= 0) ::close(m_inotify_fd);
+        {
+            std::lock_guard<std::mutex> lk(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        if (m_writer.joinable()) m_writer.join();
+    }
+
+    ConfigStore(const ConfigStore&) = delete;
+    ConfigStore& operator=(const ConfigStore&) = delete;
+
+    // Main-thread view of the current settings.
+    const AppConfig& get() const { return m_cfg; }
+
+    // Records new settings; the file is written once changes settle.
+    void update(const AppConfig& cfg) {
+        if (cfg == m_cfg) return;
+        m_cfg = cfg;
+
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_snapshot = cfg;
+        m_dirty = true;
+        m_due = std::chrono::steady_clock::now() + DEBOUNCE;
+        m_cv.notify_all();
+    }
+
+    // Writes pending changes now (used on exit); returns after one attempt even if it fails.
+    void flush() {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        if (!m_dirty) return;
+        const uint64_t attempts = m_attempts;
+        m_due = std::chrono::steady_clock::now();
+        m_cv.notify_all();
+        m_cv.wait(lk, [this, attempts]() { return !m_dirty || m_attempts != attempts; });
+    }
+
+    // Watches config.ini for edits made outside this process.
+    void watch(std::function<void(const AppConfig&)> on_change) {
+        m_on_change = std::move(on_change);
+        if (m_inotify_fd >= 0) return;
+
+        m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (m_inotify_fd < 0) return;
+
+        // Watch the directory: atomic replacers (including us) rename over the file.
+        if (inotify_add_watch(m_inotify_fd, config_dir_path().c_str(),
+                              IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            ::close(m_inotify_fd);
+            m_inotify_fd = -1;
+            return;
+        }
+
+        m_inotify_conn = Glib::signal_io().connect(
+            sigc::mem_fun(*this, &ConfigStore::on_inotify), m_inotify_fd, Glib::IO_IN);
+    }
+
+private:
+    static constexpr std::chrono::milliseconds DEBOUNCE{750};
+    static constexpr int MAX_BACKOFF_SEC = 60;
+
+    AppConfig m_cfg;
+    std::function<void(const AppConfig&)> m_on_change;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    AppConfig m_snapshot;
+    bool m_dirty = false;
+    bool m_stop = false;
+    std::chrono::steady_clock::time_point m_due;
+    std::string m_last_written;
+    uint64_t m_attempts = 0;
+    int m_failures = 0;        // Consecutive failed writes; drives the retry backoff
+    std::thread m_writer;
+
+    int m_inotify_fd = -1;
+    sigc::connection m_inotify_conn;
+
+    static bool kf_bool(const Glib::KeyFile& kf, const char* group, const char* key, bool def) {
+        try { return kf.get_boolean(group, key); } catch (...) { return def; }
+    }
+    static int kf_int(const Glib::KeyFile& kf, const char* group, const char* key, int def) {
+        try { return kf.get_integer(group, key); } catch (...) { return def; }
+    }
+    static std::string kf_string(const Glib::KeyFile& kf, const char* group, const char* key, const std::string& def) {
+        try { return kf.get_string(group, key); } catch (...) { return def; }
+    }
+
+    static bool parse(const std::string& data, AppConfig& out) {
+        Glib::KeyFile kf;
+        try {
+            if (!kf.load_from_data(data)) return false;
+        } catch (...) {
+            return false;
+        }
+        // Missing keys keep their defaults so older files still load.
+        AppConfig d;
+        out.show_raw = kf_bool(kf, "output", "raw", d.show_raw);
+        out.strip_global = kf_bool(kf, "output", "strip_global", d.strip_global);
+        out.strip_hplip = kf_bool(kf, "output", "strip_hplip", d.strip_hplip);
+        out.wake_enabled = kf_bool(kf, "wake", "enabled", d.wake_enabled);
+        // Hand-edited numbers are clamped to what the spin buttons allow: 0 minutes
+        // would schedule no wake at all, and a huge value overflows minutes * 60.
+        out.wake_interval_minutes = std::clamp(kf_int(kf, "wake", "interval_minutes", d.wake_interval_minutes), 1, 60);
+        out.wake_mode = kf_string(kf, "wake", "mode", d.wake_mode);
+        out.wake_hold_queue = kf_bool(kf, "wake", "hold_queue", d.wake_hold_queue);
+        out.run_in_background = kf_bool(kf, "app", "background", d.run_in_background);
+        out.printer_host = trim_copy(kf_string(kf, "printer", "host", d.printer_host));
+        if (out.printer_host.empty()) out.printer_host = d.printer_host;
+        out.raw_host = kf_string(kf, "raw", "host", d.raw_host);
+        out.raw_port = std::clamp(kf_int(kf, "raw", "port", d.raw_port), 1, 65535);
+        return true;
+    }
+
+    static std::string serialize(const AppConfig& cfg) {
+        Glib::KeyFile kf;
+        kf.set_boolean("output", "raw", cfg.show_raw);
+        kf.set_boolean("output", "strip_global", cfg.strip_global);
+        kf.set_boolean("output", "strip_hplip", cfg.strip_hplip);
+        kf.set_boolean("wake", "enabled", cfg.wake_enabled);
+        kf.set_integer("wake", "interval_minutes", cfg.wake_interval_minutes);
+        kf.set_string("wake", "mode", cfg.wake_mode);
+        kf.set_boolean("wake", "hold_queue", cfg.wake_hold_queue);
+        kf.set_boolean("app", "background", cfg.run_in_background);
+        kf.set_string("printer", "host", cfg.printer_host);
+        kf.set_string("raw", "host", cfg.raw_host);
+        kf.set_integer("raw", "port", cfg.raw_port);
+        return kf.to_data();
+    }
+
+    static bool read_text(std::string& out) {
+        std::ifstream in(config_file_path(), std::ios::binary);
+        if (!in) return false;
+        std::ostringstream oss;
+        oss << in.rdbuf();
+        out = oss.str();
+        return true;
+    }
+
+    static bool read_file(AppConfig& out) {
+        std::string data;
+        if (!read_text(data)) return false;
+        return parse(data, out);
+    }
+
+    void writer_loop() {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        for (;;) {
+            m_cv.wait(lk, [this]() { return m_dirty || m_stop; });
+            if (!m_dirty && m_stop) return;
+
+            // Debounce: keep sliding while changes keep arriving.
+            while (!m_stop && std::chrono::steady_clock::now() < m_due) {
+                m_cv.wait_until(lk, m_due);
+            }
+
+            AppConfig snap = m_snapshot;
+            lk.unlock();
+            std::string data;
+            std::string error;
+            try {
+                data = serialize(snap);
+                if (!write_file_atomic(config_file_path(), data)) error = strerror(errno);
+            } catch (const Glib::Error& e) {
+                error = e.what();
+            } catch (...) {
+                error = "serialize failed";
+            }
+            lk.lock();
+            ++m_attempts;
+
+            if (error.empty()) {
+                if (m_failures > 0)
+                    journal_line("info", "config.ini written after " + std::to_string(m_failures) + " failed attempt(s)");
+                m_failures = 0;
+                m_last_written = data;
+                if (m_snapshot == snap) m_dirty = false;
+            } else {
+                // Stays dirty: retried after 1, 2, 4 ... 60 s, or sooner when settings change again.
+                if (m_failures == 0) {
+                    journal_line("error", "Could not write " + config_file_path() + ": " + error + " (retrying)");
+                    std::cerr << "config: could not write " << config_file_path() << ": " << error << "\n";
+                }
+                const int backoff = std::min(MAX_BACKOFF_SEC, 1 << std::min(m_failures, 6));
+                ++m_failures;
+                m_due = std::chrono::steady_clock::now() + std::chrono::seconds(backoff);
+                if (m_stop) {
+                    m_cv.notify_all();
+                    return;  // Exiting: the error is logged, the file keeps its last good contents
+                }
+            }
+            m_cv.notify_all();
+        }
+    }
+
+    bool on_inotify(Glib::IOCondition) {
+        alignas(inotify_event) char buf[4096];
+        bool touched = false;
+
+        for (;;) {
+            ssize_t n = ::read(m_inotify_fd, buf, sizeof(buf));
+            if (n <= 0) break;
+            for (char* p = buf; p < buf + n; ) {
+                auto* ev = reinterpret_cast<inotify_event*>(p);
+                if (ev->len > 0 && std::strcmp(ev->name, "config.ini") == 0) touched = true;
+                p += sizeof(inotify_event) + ev->len;
+            }
+        }
+        if (touched) reload_external();
+        return true;
+    }
+
+    void reload_external() {
+        std::string data;
+        if (!read_text(data)) return;
+
+        {
+            std::lock_guard<std::mutex> lk(m_mutex);
+            // Our own write, or a local change that is about to overwrite it.
+            if (m_dirty || data == m_last_written) return;
+        }
+
+        AppConfig cfg;
+        if (!parse(data, cfg) || cfg == m_cfg) return;
+
+        m_cfg = cfg;
+        {
+            std::lock_guard<std::mutex> lk(m_mutex);
+            m_snapshot = cfg;
+            m_last_written = data;
+        }
+        if (m_on_change) m_on_change(cfg);
+    }
+};
+
+// ============================================================
+// Metrics history
+// - Append-only CSV in the config dir: epoch,metric,key,value
+// - Capped: past METRICS_MAX_BYTES the oldest half is dropped
+// - Reads scan backwards from the end and stop once enough samples are found
+// - Thread-safe; probes may record from worker threads
+// ============================================================
+static constexpr std::streamoff METRICS_MAX_BYTES = 2 << 20;
+
+struct MetricSample {
+    std::time_t when = 0;
+    std::string metric;
+    std::string key;
+    double value = 0;
+};
+
+static std::string metrics_file_path() {
+    return Glib::build_filename(config_dir_path(), "metrics.csv");
+}
+
+static std::mutex& metrics_mutex() {
+    static std::mutex m;
+    return m;
+}
+
+static void metrics_append(const std::string& metric, const std::string& key, double value) {
+    std::lock_guard<std::mutex> lk(metrics_mutex());
+    std::ofstream out(metrics_file_path(), std::ios::app | std::ios::binary);
+    if (!out) return;
+    out << (long long)std::time(nullptr) << ',' << metric << ',' << key << ',' << value << '\n';
+    const std::streamoff size = out.tellp();
+    out.close();
+
+    // Keep the newest half, from a line boundary; the file is replaced atomically.
+    if (size > METRICS_MAX_BYTES) {
+        std::ifstream in(metrics_file_path(), std::ios::binary);
+        in.seekg(size - METRICS_MAX_BYTES / 2);
+        std::string partial;
+        std::getline(in, partial);
+        std::ostringstream rest;
+        rest << in.rdbuf();
+        write_file_atomic(metrics_file_path(), rest.str());
+    }
+
+    std::ostringstream detail;
+    detail << key << '=' << value;
+    journal_probe(metric, detail.str());
+}
+
+// Most recent samples for one metric (oldest first), at most max_count.
+// Reads 64 KB blocks from the end, so recent history costs the same at any file size.
+static std::vector<MetricSample> metrics_recent(const std::string& metric, size_t max_count) {
+    static constexpr std::streamoff BLOCK = 64 << 10;
+    std::lock_guard<std::mutex> lk(metrics_mutex());
+    std::vector<MetricSample> found;  // Newest first until the end
+    std::ifstream in(metrics_file_path(), std::ios::binary | std::ios::ate);
+    if (!in) return found;
+
+    auto parse = [&](const std::string& line) {
+        std::istringstream ls(line);
+        std::string when, m, key, value;
+        if (!std::getline(ls, when, ',') || !std::getline(ls, m, ',') ||
+            !std::getline(ls, key, ',') || !std::getline(ls, value)) return;
+        if (m != metric) return;
+        try {
+            found.push_back({(std::time_t)std::stoll(when), m, key, std::stod(value)});
+        } catch (...) {
+            // Skip a damaged line
+        }
+    };
+
+    std::streamoff pos = in.tellg();
+    std::string carry;  // Start of the line cut by the previous block boundary
+    while (pos > 0 && found.size() < max_count) {
+        const std::streamoff start = std::max<std::streamoff>(0, pos - BLOCK);
+        std::string block((size_t)(pos - start), '\0');
+        in.seekg(start);
+        in.read(&block[0], (std::streamsize)block.size());
+        block += carry;
+        pos = start;
+
+        // Only lines after the first newline are complete, unless this is the file start.
+        size_t from = 0;
+        carry.clear();
+        if (pos > 0) {
+            const size_t first = block.find('\n');
+            if (first == std::string::npos) {
+                carry = block;
+                continue;
+            }
+            carry = block.substr(0, first);
+            from = first + 1;
+        }
+        for (size_t end = block.size(); end > from && found.size() < max_count;) {
+            const size_t nl = block.rfind('\n', end - 1);
+            const size_t begin = nl == std::string::npos || nl < from ? from : nl + 1;
+            if (begin < end) parse(block.substr(begin, end - begin));
+            if (begin == from) break;
+            end = nl;
+        }
+    }
+    std::reverse(found.begin(), found.end());
+    return found;
+}
+
+// ============================================================
+// Queue device URI
+// - Where the CUPS queue sends jobs (lpstat -v), checked against the address
+//   the printer answers on now; a stale one makes every job sit out backend timeouts
+// - Network schemes only: authority URIs (socket://, ipp://, lpd://, hpwake://, ...)
+//   and HPLIP's hp:/net/<model>?ip=|hostname=|zc=
+// ============================================================
+struct DeviceUri {
+    std::string uri;
+    std::string scheme;
+    std::string host;             // "" when the backend finds the printer itself (usb, dnssd, ...)
+    size_t host_pos = 0;          // Span replaced when re-pointing: the host, or hp's "key=value"
+    size_t host_len = 0;
+    bool hp_query = false;        // hp:/net/...?<key>=<host>
+};
+
+static DeviceUri parse_device_uri(const std::string& uri) {
+    DeviceUri d;
+    d.uri = uri;
+    const size_t colon = uri.find(':');
+    if (colon == std::string::npos) return d;
+    d.scheme = uri.substr(0, colon);
+
+    if (d.scheme == "hp" || d.scheme == "hpfax") {
+        if (uri.compare(colon, 6, ":/net/") != 0) return d;
+        const size_t q = uri.find('?');
+        if (q == std::string::npos) return d;
+        for (size_t pos = q + 1; pos < uri.size();) {
+            size_t end = uri.find('&', pos);
+            if (end == std::string::npos) end = uri.size();
+            const std::string pair = uri.substr(pos, end - pos);
+            const size_t eq = pair.find('=');
+            const std::string key = pair.substr(0, eq);
+            // zc= is a Bonjour service name HPLIP resolves itself, like dnssd://.
+            if (eq != std::string::npos && (key == "ip" || key == "hostname")) {
+                d.host = pair.substr(eq + 1);
+                d.host_pos = pos;
+                d.host_len = end - pos;
+                d.hp_query = true;
+                break;
+            }
+            pos = end + 1;
+        }
+        return d;
+    }
+
+    static const std::set<std::string> authority_schemes = {"socket", "ipp", "ipps", "http", "https", "lpd", "hpwake"};
+    if (!authority_schemes.count(d.scheme) || uri.compare(colon, 3, "://") != 0) return d;
+    size_t pos = colon + 3;
+    const size_t at = uri.find('@', pos);
+    const size_t auth_end = std::min(uri.find_first_of("/?", pos), uri.size());
+    if (at != std::string::npos && at < auth_end) pos = at + 1;  // user@host
+    size_t end;
+    if (pos < uri.size() && uri[pos] == '[') {
+        end = uri.find(']', pos);
+        if (end == std::string::npos) return d;
+        d.host = uri.substr(pos + 1, end - pos - 1);
+        ++end;
+    } else {
+        end = std::min(uri.find_first_of(":/?", pos), uri.size());
+        d.host = uri.substr(pos, end - pos);
+    }
+    d.host_pos = pos;
+    d.host_len = end - pos;
+    return d;
+}
+
+// The helper only ever sees a URI that passes this: a network scheme with a host,
+// no whitespace, quotes or shell metacharacters.
+static bool valid_device_uri(const std::string& uri) {
+    if (uri.empty() || uri.size() > 255) return false;
+    for (unsigned char c : uri)
+        if (!std::isalnum(c) && !std::strchr("-._~:/?=&%[]@", c)) return false;
+    return !parse_device_uri(uri).host.empty();
+}
+
+// Same URI aimed at new_host (a name or an address literal).
+static std::string repoint_device_uri(const DeviceUri& d, const std::string& new_host) {
+    std::string host = new_host;
+    const bool literal_v6 = new_host.find(':') != std::string::npos;
+    if (d.hp_query) {
+        in_addr a4{};
+        const bool literal = literal_v6 || inet_pton(AF_INET, new_host.c_str(), &a4) == 1;
+        host = (literal ? "ip=" : "hostname=") + new_host;
+    } else if (literal_v6) {
+        host = "[" + new_host + "]";
+    }
+    return d.uri.substr(0, d.host_pos) + host + d.uri.substr(d.host_pos + d.host_len);
+}
+
+struct DeviceUriCheck {
+    // Unconfirmed: the printer seems to be elsewhere, but port 9100 is closed there too.
+    enum class State { Ok, Drift, Unconfirmed, NotNetwork, Unknown };
+    State state = State::Unknown;
+    std::string uri;
+    std::string uri_host;
+    std::string uri_addr;         // uri_host resolved ("" = does not resolve)
+    std::string live_addr;        // Where the printer answers or was last seen
+    std::string live_source;      // "configured", "neighbour table" or "mDNS"
+    bool uri_port_open = false;
+    bool live_port_open = false;
+    std::string suggested_uri;    // Drift only
+
+    std::string summary() const {
+        switch (state) {
+        case State::Ok:         return "queue targets " + uri_host + " (" + uri_addr + "), where the printer answers";
+        case State::NotNetwork: return "queue URI " + uri + " is resolved by its backend";
+        case State::Unknown:
+            if (uri.empty()) return "cannot compare: no device-uri";
+            return "queue target " + uri_host + " does not answer and the printer was not found elsewhere";
+        case State::Drift:
+        case State::Unconfirmed: break;
+        }
+        return "queue targets " + uri_host + " (" + (uri_addr.empty() ? std::string("unresolved") : uri_addr) +
+               ") but the printer is at " + live_addr + " (" + live_source + ")";
+    }
+};
+
+// MAC of a complete entry for ipv4 in the kernel neighbour table ("" = none).
+static std::string neighbour_mac(const std::string& ipv4) {
+    std::ifstream arp("/proc/net/arp");
+    std::string line;
+    std::getline(arp, line);  // Header
+    while (std::getline(arp, line)) {
+        std::istringstream ls(line);
+        std::string ip, hw_type, flags, mac;
+        if (ls >> ip >> hw_type >> flags >> mac && ip == ipv4 && flags == "0x2") return mac;
+    }
+    return "";
+}
+
+// Address of a complete neighbour entry with this MAC ("" = none).
+static std::string neighbour_ipv4(const std::string& mac) {
+    std::ifstream arp("/proc/net/arp");
+    std::string line;
+    std::getline(arp, line);  // Header
+    while (std::getline(arp, line)) {
+        std::istringstream ls(line);
+        std::string ip, hw_type, flags, hw_addr;
+        if (ls >> ip >> hw_type >> flags >> hw_addr && hw_addr == mac && flags == "0x2") return ip;
+    }
+    return "";
+}
+
+// The printer's MAC, learned whenever it answers at a known address; a DHCP
+// move keeps the MAC, so the neighbour table can show where it went.
+static std::string& printer_mac_storage() {
+    static std::string mac;
+    return mac;
+}
+static std::mutex& printer_mac_mutex() {
+    static std::mutex m;
+    return m;
+}
+
+// IPv4 of a P1102 advertising raw printing over mDNS ("" = none or no avahi-browse).
+static std::string discover_printer_ipv4() {
+    int code = 0;
+    std::istringstream lines(run_shell_capture(
+        "timeout 2 avahi-browse -rtp _pdl-datastream._tcp 2>/dev/null", code));
+    // "=;iface;IPv4;name;type;domain;hostname;address;port;txt"
+    for (std::string line; std::getline(lines, line);) {
+        std::vector<std::string> f;
+        std::istringstream ls(line);
+        for (std::string field; std::getline(ls, field, ';');) f.push_back(field);
+        if (f.size() < 9 || f[0] != "=" || f[2] != "IPv4") continue;
+        if (f[3].find("P1102") != std::string::npos) return f[7];
+    }
+    return "";
+}
+
+// `lpstat -v` for PRINTER_NAME: "device for <queue>: <uri>".
+static std::string parse_lpstat_device_uri(const std::string& out) {
+    const size_t pos = out.find(": ");
+    if (out.compare(0, 11, "device for ") != 0 || pos == std::string::npos) return "";
+    return trim_copy(out.substr(pos + 2, out.find('\n', pos) - pos - 2));
+}
+
+// What check_device_uri_drift looks at on the network; --self-test swaps in canned answers.
+struct DriftProbes {
+    std::function<std::string(const std::string& host, int family)> address;  // First address ("" = none)
+    std::function<bool(const std::string& addr)> port_open;                   // Port 9100 within 500 ms
+    std::function<std::string(const std::string& ipv4)> mac_of;
+    std::function<std::string(const std::string& mac)> ipv4_of;
+    std::function<std::string()> discover;
+
+    static DriftProbes live() {
+        DriftProbes p;
+        p.address = [](const std::string& host, int family) {
+            for (const auto& ss : AddressCache::instance().lookup(host))
+                if (ss.ss_family == family) return sockaddr_to_string(ss);
+            return std::string();
+        };
+        p.port_open = [](const std::string& addr) { return tcp_connect_probe(addr, PRINTER_PORT, 500) == 0; };
+        p.mac_of = neighbour_mac;
+        p.ipv4_of = neighbour_ipv4;
+        p.discover = discover_printer_ipv4;
+        return p;
+    }
+};
+
+// Only a live address where port 9100 answers is offered as a re-point target.
+// The queue's own target is probed first; discovery (neighbour table by the
+// printer's MAC, then mDNS) runs only when it does not answer.
+// live_host is the configured printer host; both sides go through the address cache.
+static DeviceUriCheck check_device_uri_drift(const std::string& uri, const std::string& live_host,
+                                             const DriftProbes& probe = DriftProbes::live()) {
+    DeviceUriCheck c;
+    c.uri = uri;
+    if (uri.empty()) return c;
+    const DeviceUri d = parse_device_uri(uri);
+    if (d.host.empty()) {
+        c.state = DeviceUriCheck::State::NotNetwork;
+        return c;
+    }
+    c.uri_host = d.host;
+
+    // Compare the address families the queue URI can carry.
+    const bool v6 = d.host.find(':') != std::string::npos;
+    const int family = v6 ? AF_INET6 : AF_INET;
+    const std::string configured = probe.address(live_host, family);
+    c.uri_addr = probe.address(d.host, family);
+    c.uri_port_open = !c.uri_addr.empty() && probe.port_open(c.uri_addr);
+
+    if (c.uri_port_open && (configured.empty() || configured == c.uri_addr)) {
+        if (!v6) {
+            const std::string mac = probe.mac_of(c.uri_addr);
+            std::lock_guard<std::mutex> lk(printer_mac_mutex());
+            if (!mac.empty()) printer_mac_storage() = mac;
+        }
+        c.state = DeviceUriCheck::State::Ok;
+        return c;
+    }
+
+    // A different configured address wins when it answers; otherwise look for the printer.
+    if (!configured.empty() && configured != c.uri_addr && probe.port_open(configured)) {
+        c.live_addr = configured;
+        c.live_source = "configured";
+        c.live_port_open = true;
+    } else if (!v6) {
+        std::string mac;
+        {
+            std::lock_guard<std::mutex> lk(printer_mac_mutex());
+            mac = printer_mac_storage();
+        }
+        if (!mac.empty()) {
+            c.live_addr = probe.ipv4_of(mac);
+            c.live_source = "neighbour table";
+        }
+        if (c.live_addr.empty() || c.live_addr == c.uri_addr) {
+            c.live_addr = probe.discover();
+            c.live_source = "mDNS";
+        }
+        if (!c.live_addr.empty() && c.live_addr != c.uri_addr)
+            c.live_port_open = probe.port_open(c.live_addr);
+    }
+
+    if (c.live_addr.empty() || c.live_addr == c.uri_addr) {
+        // Nowhere better to send jobs: fine if the target answers, unknown if not.
+        c.live_addr = c.uri_addr;
+        c.state = c.uri_port_open ? DeviceUriCheck::State::Ok : DeviceUriCheck::State::Unknown;
+        return c;
+    }
+    if (!c.live_port_open) {
+        c.state = DeviceUriCheck::State::Unconfirmed;
+        return c;
+    }
+
+    c.state = DeviceUriCheck::State::Drift;
+    // Keep a name-based queue name-based when the configured name is what moved; otherwise pin the live address.
+    const bool uri_by_name = c.uri_addr != d.host;
+    const bool by_configured_name = c.live_addr == configured && configured != live_host;
+    c.suggested_uri = repoint_device_uri(d, uri_by_name && by_configured_name ? live_host : c.live_addr);
+    return c;
+}
+
+// ============================================================
+// Privileged helper
+// - This binary re-executed once via pkexec (--privileged-helper)
+// - Talks over a Unix socketpair passed as the helper's stdin
+// - Fixed whitelist of operations; the only argument accepted is the device URI
+//   of SET_DEVICE_URI, re-validated on the root side
+// - Request:  "<OP>[ <argument>]\n"
+// - Response: "<exit_code> <payload_length>\n<payload>"
+// ============================================================
+static const char* const PRIV_HELPER_FLAG = "--privileged-helper";
+
+static std::string priv_command_for(const std::string& op) {
+    if (op == "PAUSE_QUEUE")  return "cupsdisable \"" + PRINTER_NAME + "\" 2>&1";
+    if (op == "RESUME_QUEUE") return "cupsenable \"" + PRINTER_NAME + "\" 2>&1";
+    if (op == "RESTART_CUPS") return "systemctl restart cups 2>&1";
+    if (op == "CUPS_LOGS")    return "journalctl -u cups -n 50 --no-pager 2>&1";
+    if (op.compare(0, 15, "SET_DEVICE_URI ") == 0) {
+        const std::string uri = op.substr(15);
+        if (!valid_device_uri(uri)) return "";
+        return "lpadmin -p \"" + PRINTER_NAME + "\" -v " + shell_quote(uri) + " 2>&1";
+    }
+    return "";
+}
+
+static bool send_all(int fd, const std::string& data) {
+    const char* p = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+        ssize_t n = ::send(fd, p, left, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+    return true;
+}
+
+// Waits until fd is readable; timeout_ms < 0 waits forever.
+static bool wait_readable(int fd, int timeout_ms) {
+    pollfd pfd{fd, POLLIN, 0};
+    for (;;) {
+        int r = ::poll(&pfd, 1, timeout_ms);
+        if (r < 0 && errno == EINTR) continue;
+        return r > 0;
+    }
+}
+
+static bool recv_line(int fd, std::string& line, int timeout_ms, size_t max_len = 256) {
+    line.clear();
+    for (;;) {
+        if (!wait_readable(fd, timeout_ms)) return false;
+        char c;
+        ssize_t n = ::recv(fd, &c, 1, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        if (c == '\n') return true;
+        if (line.size() >= max_len) return false;
+        line.push_back(c);
+    }
+}
+
+static bool recv_exact(int fd, std::string& out, size_t len, int timeout_ms) {
+    out.resize(len);
+    size_t got = 0;
+    while (got < len) {
+        if (!wait_readable(fd, timeout_ms)) return false;
+        ssize_t n = ::recv(fd, &out[got], len - got, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        got += (size_t)n;
+    }
+    return true;
+}
+
+// Entry point of the helper process (runs as root under pkexec).
+static int run_privileged_helper() {
+    const int fd = STDIN_FILENO;
+
+    int so_type = 0;
+    socklen_t len = sizeof(so_type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &so_type, &len) != 0 || so_type != SOCK_STREAM) {
+        std::cerr << "privileged helper: must be started by the diagnostic tool\n";
+        return 2;
+    }
+    if (geteuid() != 0) {
+        std::cerr << "privileged helper: not running as root\n";
+        return 2;
+    }
+
+    if (!send_all(fd, "READY\n")) return 1;
+
+    std::string op;
+    while (recv_line(fd, op, -1)) {
+        std::string cmd = priv_command_for(op);
+        std::string payload;
+        int code = -1;
+        if (cmd.empty()) payload = "operation not permitted: " + op;
+        else payload = run_shell_capture(cmd, code);
+
+        if (!send_all(fd, std::to_string(code) + " " + std::to_string(payload.size()) + "\n" + payload))
+            break;
+    }
+    return 0;
+}
+
+struct PrivResult {
+    bool ok = false;
+    std::string output;
+    int exit_code = 0;
+    std::string error;   // Set when ok is false
+};
+
+class PrivilegedHelper {
+public:
+    // Main thread: the dispatcher delivers call_async() results to the default context.
+    PrivilegedHelper() {
+        m_dispatcher.connect(sigc::mem_fun(*this, &PrivilegedHelper::deliver));
+    }
+
+    ~PrivilegedHelper() {
+        // Wake a wait on polkit or on an operation: shutdown() ends the worker's
+        // recv at once, and pkexec (still the user's process before authorisation)
+        // is asked to close its prompt.
+        {
+            std::lock_guard<std::mutex> lk(m_live_mutex);
+            m_cancelled = true;
+            if (m_live_fd >= 0) ::shutdown(m_live_fd, SHUT_RDWR);
+            if (m_live_pid > 0) ::kill(m_live_pid, SIGTERM);
+        }
+        if (m_worker.joinable()) {
+            {
+                std::lock_guard<std::mutex> lk(m_queue_mutex);
+                m_worker_stop = true;
+            }
+            m_queue_cv.notify_all();
+            m_worker.join();
+        }
+        std::lock_guard<std::mutex> lk(m_mutex);
+        stop();
+    }
+
+    PrivilegedHelper(const PrivilegedHelper&) = delete;
+    PrivilegedHelper& operator=(const PrivilegedHelper&) = delete;
+
+    // Runs a whitelisted operation and waits for it (worker threads only: a polkit
+    // prompt can take minutes). On failure, error says why.
+    bool call(const std::string& op, std::string& output, int& exit_code, std::string& error) {
+        if (priv_command_for(op).empty()) {
+            error = "Unknown privileged operation: " + op;
+            return false;
+        }
+        if (Glib::find_program_in_path("pkexec").empty()) return call_sudo(op, output, exit_code, error);
+
+        std::unique_lock<std::mutex> lk(m_mutex);
+        // Another caller is waiting on polkit: wait for its helper instead of prompting twice.
+        m_start_cv.wait(lk, [this]() { return !m_starting; });
+        if (m_fd < 0) {
+            m_starting = true;
+            lk.unlock();
+            int fd = -1;
+            pid_t pid = -1;
+            const bool started = start(fd, pid, error);  // No lock held during authorisation
+            lk.lock();
+            m_starting = false;
+            if (started) {
+                m_fd = fd;
+                m_pid = pid;
+            }
+            m_start_cv.notify_all();
+            if (!started) return false;
+        }
+
+        if (!set_live(m_fd, -1)) {
+            error = "Cancelled";
+            return false;
+        }
+        std::string header;
+        if (!send_all(m_fd, op + "\n") || !recv_line(m_fd, header, OP_TIMEOUT_MS)) {
+            stop();
+            error = "Privileged helper stopped responding (operation: " + op + ")";
+            return false;
+        }
+
+        std::istringstream hs(header);
+        size_t len = 0;
+        const bool complete = (hs >> exit_code >> len) && recv_exact(m_fd, output, len, OP_TIMEOUT_MS);
+        set_live(-1, -1);
+        if (!complete) {
+            stop();
+            error = "Privileged helper sent a malformed reply";
+            return false;
+        }
+        if (exit_code == -1) {
+            error = output;
+            return false;
+        }
+        return true;
+    }
+
+    // Main loop: queues op for the worker; done runs on the main loop with the result.
+    void call_async(const std::string& op, std::function<void(const PrivResult&)> done) {
+        {
+            std::lock_guard<std::mutex> lk(m_queue_mutex);
+            m_requests.push_back({op, std::move(done)});
+            if (!m_worker.joinable()) m_worker = std::thread([this]() { worker_loop(); });
+        }
+        m_queue_cv.notify_one();
+    }
+
+private:
+    static constexpr int AUTH_TIMEOUT_MS = 120000;
+    static constexpr int OP_TIMEOUT_MS   = 60000;
+
+    struct Request {
+        std::string op;
+        std::function<void(const PrivResult&)> done;
+    };
+
+    // Helper process; m_starting while one caller waits on polkit with m_mutex released
+    std::mutex m_mutex;
+    std::condition_variable m_start_cv;
+    bool m_starting = false;
+    int m_fd = -1;
+    pid_t m_pid = -1;
+
+    // call_async() worker and its completions (handed to the main loop by m_dispatcher)
+    std::thread m_worker;
+    std::mutex m_queue_mutex;
+    std::condition_variable m_queue_cv;
+    std::deque<Request> m_requests;
+    std::deque<std::function<void()>> m_completions;
+    bool m_worker_stop = false;
+    Glib::Dispatcher m_dispatcher;
+
+    // The socket (and, while authorising, pkexec) a worker is blocked on, so the
+    // destructor can interrupt it; cleared before the fd is closed.
+    std::mutex m_live_mutex;
+    int m_live_fd = -1;
+    pid_t m_live_pid = -1;
+    bool m_cancelled = false;
+
+    // Returns false once the destructor has started (nothing is recorded then).
+    bool set_live(int fd, pid_t pid) {
+        std::lock_guard<std::mutex> lk(m_live_mutex);
+        if (m_cancelled && fd >= 0) return false;
+        m_live_fd = fd;
+        m_live_pid = pid;
+        return true;
+    }
+
+    void worker_loop() {
+        for (;;) {
+            Request req;
+            {
+                std::unique_lock<std::mutex> lk(m_queue_mutex);
+                m_queue_cv.wait(lk, [this]() { return m_worker_stop || !m_requests.empty(); });
+                if (m_worker_stop) return;
+                req = std::move(m_requests.front());
+                m_requests.pop_front();
+            }
+            PrivResult res;
+            res.ok = call(req.op, res.output, res.exit_code, res.error);
+            {
+                std::lock_guard<std::mutex> lk(m_queue_mutex);
+                m_completions.push_back([done = std::move(req.done), res]() {
+                    if (done) done(res);
+                });
+            }
+            m_dispatcher.emit();
+        }
+    }
+
+    // Main loop (dispatcher): one emit may carry several completions.
+    void deliver() {
+        std::deque<std::function<void()>> ready;
+        {
+            std::lock_guard<std::mutex> lk(m_queue_mutex);
+            ready.swap(m_completions);
+        }
+        for (auto& fn : ready) fn();
+    }
+
+    // Forks pkexec and waits for READY (up to AUTH_TIMEOUT_MS); fd and pid are set on success.
+    bool start(int& fd, pid_t& helper_pid, std::string& error) {
+        char exe[4096];
+        ssize_t n = ::readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        if (n <= 0) {
+            error = "Cannot locate own executable for privileged helper";
+            return false;
+        }
+        exe[n] = '\0';
+
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+            error = "socketpair failed: " + std::string(strerror(errno));
+            return false;
+        }
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            ::close(sv[0]);
+            ::close(sv[1]);
+            error = "fork failed: " + std::string(strerror(errno));
+            return false;
+        }
+        if (pid == 0) {
+            // stdin is not a tty, so pkexec cannot fall back to a text prompt.
+            ::dup2(sv[1], STDIN_FILENO);
+            execlp("pkexec", "pkexec", exe, PRIV_HELPER_FLAG, (char*)nullptr);
+            _exit(127);
+        }
+
+        ::close(sv[1]);
+        fd = sv[0];
+        helper_pid = pid;
+
+        std::string ready;
+        const bool live = set_live(fd, pid);
+        if (!live) ::kill(pid, SIGTERM);
+        const bool ok = live && recv_line(fd, ready, AUTH_TIMEOUT_MS) && ready == "READY";
+        set_live(-1, -1);
+        if (ok) return true;
+
+        bool cancelled;
+        {
+            std::lock_guard<std::mutex> lk(m_live_mutex);
+            cancelled = m_cancelled;
+        }
+        int status = 0;
+        bool exited = ::waitpid(helper_pid, &status, WNOHANG) == helper_pid;
+        if (exited) helper_pid = -1;
+        close_helper(fd, helper_pid);
+
+        if (cancelled)
+            error = "Cancelled";
+        else if (exited && WIFEXITED(status) && WEXITSTATUS(status) == 126)
+            error = "Authorisation was dismissed or denied (polkit)";
+        else if (exited && WIFEXITED(status) && WEXITSTATUS(status) == 127)
+            error = "Not authorised: no polkit agent available or pkexec refused";
+        else
+            error = "Privileged helper failed to start (authorisation timed out?)";
+        return false;
+    }
+
+    static void close_helper(int& fd, pid_t& pid) {
+        if (fd >= 0) {
+            ::close(fd);  // helper exits on EOF
+            fd = -1;
+        }
+        if (pid > 0) {
+            // The helper runs as root, so it cannot be signalled; give it a moment to exit.
+            int status = 0;
+            for (int i = 0; i < 20; ++i) {
+                if (::waitpid(pid, &status, WNOHANG) != 0) break;
+                ::usleep(50 * 1000);
+            }
+            pid = -1;
+        }
+    }
+
+    // m_mutex held.
+    void stop() { close_helper(m_fd, m_pid); }
+
+    // No pkexec: sudo without a prompt, so a missing rule fails fast instead of hanging.
+    static bool call_sudo(const std::string& op, std::string& output, int& exit_code, std::string& error) {
+        output = run_shell_capture("sudo -n sh -c " + shell_quote(priv_command_for(op)) + " 2>&1 </dev/null",
+                                   exit_code);
+        if (output.find("a password is required") != std::string::npos ||
+            output.find("sudo: a terminal is required") != std::string::npos) {
+            error = "Not authorised: sudo needs a password (install polkit/pkexec or add a sudoers rule)";
+            return false;
+        }
+        return true;
+    }
+};
+
+// Background callers (wake watcher, --service): errors are logged, not shown in a window.
+static bool run_privileged_logged(PrivilegedHelper& priv, const std::string& op) {
+    std::string out, error;
+    int exit_code = 0;
+    if (priv.call(op, out, exit_code, error)) return true;
+    std::cerr << "privileged " << op << ": " << error << "\n";
+    return false;
+}
+
+// ============================================================
+// Data model
+// - A refresh yields a JobSnapshot: the raw lpstat text plus its jobs, laid
+//   out in an arena owned by the snapshot; ids and statuses are views into the text
+// - User names repeat across jobs and refreshes and are few, so they are
+//   interned once for the process lifetime
+// - Joined continuation blocks ("queued for ...", "Alerts: ...") vary with
+//   printer state, so each snapshot owns its own and frees them with itself
+// ============================================================
+class StringPool {
+public:
+    static StringPool& instance() {
+        static StringPool pool;
+        return pool;
+    }
+
+    // The returned view stays valid until exit.
+    std::string_view intern(std::string_view s) {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        auto it = m_strings.find(s);
+        if (it == m_strings.end()) it = m_strings.emplace(s).first;
+        return *it;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::set<std::string, std::less<>> m_strings;
+};
+
+struct PrintJob {
+    std::string_view job_id;      // Into the snapshot text
+    std::string_view user;        // Interned
+    std::string_view file;        // Continuation lines joined with " | " (owned by the snapshot)
+    std::string_view status;      // Into the snapshot text
+    long long size_bytes = -1;    // From lpstat; -1 when not reported
+    std::optional<std::chrono::system_clock::time_point> submitted_at;
+};
+
+// One lpstat result. Move-only; its jobs (and their views) live as long as it does.
+class JobSnapshot {
+public:
+    explicit JobSnapshot(std::string text) : m_data(std::make_unique<Data>(std::move(text))) {}
+
+    const std::string& text() const { return m_data->text; }
+    std::pmr::vector<PrintJob>::const_iterator begin() const { return m_data->jobs.begin(); }
+    std::pmr::vector<PrintJob>::const_iterator end() const { return m_data->jobs.end(); }
+    size_t size() const { return m_data->jobs.size(); }
+    bool empty() const { return m_data->jobs.empty(); }
+
+    void reserve(size_t n) { m_data->jobs.reserve(n); }
+    PrintJob& add() { return m_data->jobs.emplace_back(); }
+
+    // Stores text that is not a slice of text(); the view lives as long as the snapshot.
+    std::string_view keep(std::string s) { return m_data->extra.emplace_back(std::move(s)); }
+
+private:
+    struct Data {
+        explicit Data(std::string t)
+            : text(std::move(t)), arena(initial.data(), initial.size()), jobs(&arena) {}
+
+        std::string text;
+        std::array<std::byte, 8192> initial;        // ~90 jobs before the arena needs the heap
+        std::pmr::monotonic_buffer_resource arena;
+        std::pmr::vector<PrintJob> jobs;
+        std::deque<std::string> extra;              // Stable addresses for keep()
+    };
+    std::unique_ptr<Data> m_data;
+};
+
+// A finished job's IPP times (epoch seconds; 0 = not reported).
+struct CompletedJob {
+    int id = 0;
+    int state = 0;                // IPP job-state: 7 canceled, 8 aborted, 9 completed
+    std::string user;
+    long long size_bytes = -1;
+    std::time_t created = 0;
+    std::time_t processing = 0;
+    std::time_t completed = 0;
+};
+
+// ============================================================
+// CupsClient abstraction
+// ============================================================
+class CupsClient {
+public:
+    CupsClient(std::function<std::string(const std::string&)> exec,
+               std::function<bool(const std::string&)> privileged)
+        : m_exec(std::move(exec)), m_privileged(std::move(privileged)) {}
+
+    std::string printer_state_raw() {
+        return m_exec("lpstat -p \"" + PRINTER_NAME + "\" 2>&1");
+    }
+
+    std::string printer_long_raw() {
+        return m_exec("lpstat -l -p \"" + PRINTER_NAME + "\" 2>&1");
+    }
+
+    std::string get_printer_friendly_name() {
+        const std::string out = printer_long_raw();
+        std::istringstream iss(out);
+        std::string line;
+        while (std::getline(iss, line)) {
+            auto pos = line.find("Description:");
+            if (pos != std::string::npos) {
+                std::string desc = line.substr(pos + 12);
+                auto l = desc.find_first_not_of(" \t");
+                auto r = desc.find_last_not_of(" \t\r\n");
+                if (l != std::string::npos && r != std::string::npos) 
+                    desc = desc.substr(l, r - l + 1);
+                if (!desc.empty()) return desc;
+            }
+        }
+        return PRINTER_NAME;
+    }
+
+    bool has_recoverable_reason_hint(std::string* matched_reason = nullptr) {
+        std::string out = printer_long_raw();
+        std::transform(out.begin(), out.end(), out.begin(), 
+                      [](unsigned char c){ return (char)std::tolower(c); });
+
+        const std::vector<std::pair<std::string, std::string>> needles = {
+            {"out of paper", "out of paper"},
+            {"media-empty", "media-empty"},
+            {"media empty", "media empty"},
+        };
+
+        for (const auto& p : needles) {
+            if (out.find(p.first) != std::string::npos) {
+                if (matched_reason) *matched_reason = p.second;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool queue_disabled() {
+        return printer_state_raw().find("disabled") != std::string::npos;
+    }
+
+    JobSnapshot get_jobs() {
+        std::string out = m_exec("lpstat -W not-completed -o -l 2>&1");
+        if (out.find("Unknown option") != std::string::npos ||
+            out.find("invalid option") != std::string::npos) {
+            out = m_exec("lpstat -o -l 2>&1");
+        }
+        return parse_lpstat_jobs(std::move(out));
+    }
+
+    // Newest finished jobs on this queue with their IPP timestamps (Get-Jobs
+    // which-jobs=completed through ipptool); nullopt when ipptool is unavailable.
+    std::optional<std::vector<CompletedJob>> completed_jobs(int limit) {
+        const std::string out = m_exec(
+            "ipptool -c " + shell_quote("ipp://localhost/printers/" + PRINTER_NAME) + " /dev/stdin 2>/dev/null <<'EOF'\n"
+            "{\n"
+            "  OPERATION Get-Jobs\n"
+            "  GROUP operation-attributes-tag\n"
+            "  ATTR charset attributes-charset utf-8\n"
+            "  ATTR naturalLanguage attributes-natural-language en\n"
+            "  ATTR uri printer-uri $uri\n"
+            "  ATTR name requesting-user-name $user\n"
+            "  ATTR keyword which-jobs completed\n"
+            "  ATTR integer limit " + std::to_string(limit) + "\n"
+            "  ATTR keyword requested-attributes job-id,job-state,job-originating-user-name,job-k-octets,"
+            "time-at-creation,time-at-processing,time-at-completed\n"
+            "  STATUS successful-ok\n"
+            "  DISPLAY job-id\n"
+            "  DISPLAY job-state\n"
+            "  DISPLAY job-originating-user-name\n"
+            "  DISPLAY job-k-octets\n"
+            "  DISPLAY time-at-creation\n"
+            "  DISPLAY time-at-processing\n"
+            "  DISPLAY time-at-completed\n"
+            "}\n"
+            "EOF\n");
+        return parse_ipptool_completed(out);
+    }
+
+    // ipptool -c: a header row of attribute names, then one CSV row per job.
+    static std::optional<std::vector<CompletedJob>> parse_ipptool_completed(const std::string& out) {
+        std::istringstream lines(out);
+        std::string line;
+        if (!std::getline(lines, line) || line.compare(0, 6, "job-id") != 0) return std::nullopt;
+
+        std::vector<CompletedJob> jobs;
+        while (std::getline(lines, line)) {
+            std::vector<std::string> f;
+            std::istringstream ls(line);
+            for (std::string field; std::getline(ls, field, ',');) f.push_back(field);
+            if (f.size() < 7) continue;
+            auto num = [](const std::string& v) -> long long {
+                long long n = 0;
+                std::from_chars(v.data(), v.data() + v.size(), n);
+                return n;
+            };
+            CompletedJob j;
+            j.id = (int)num(f[0]);
+            j.state = (int)num(f[1]);
+            j.user = f[2];
+            if (!f[3].empty()) j.size_bytes = num(f[3]) * 1024;
+            j.created = (std::time_t)num(f[4]);
+            j.processing = (std::time_t)num(f[5]);
+            j.completed = (std::time_t)num(f[6]);
+            if (j.id > 0) jobs.push_back(j);
+        }
+        return jobs;
+    }
+
+    void cancel_job(const std::string& job_id) {
+        m_exec("cancel '" + job_id + "' 2>&1");
+    }
+
+    void cancel_all() {
+        m_exec("cancel -a 2>&1");
+    }
+
+    void cancel_all_from_user(const std::string& user) {
+        for (const auto& j : get_jobs())
+            if (j.user == user) cancel_job(std::string(j.job_id));
+    }
+
+    bool pause_queue() {
+        return m_privileged("PAUSE_QUEUE");
+    }
+
+    bool resume_queue() {
+        return m_privileged("RESUME_QUEUE");
+    }
+
+    std::string device_uri() {
+        return parse_lpstat_device_uri(m_exec("lpstat -v \"" + PRINTER_NAME + "\" 2>&1"));
+    }
+
+private:
+    std::function<std::string(const std::string&)> m_exec;
+    std::function<bool(const std::string&)> m_privileged;
+
+    // Splits off the next whitespace-separated token of s.
+    static std::string_view next_token(std::string_view& s) {
+        s = trim_view(s);
+        size_t end = 0;
+        while (end < s.size() && !std::isspace((unsigned char)s[end])) ++end;
+        std::string_view tok = s.substr(0, end);
+        s.remove_prefix(end);
+        return tok;
+    }
+
+    template <class T>
+    static bool parse_number(std::string_view s, T& out) {
+        auto res = std::from_chars(s.data(), s.data() + s.size(), out);
+        return res.ec == std::errc() && res.ptr == s.data() + s.size();
+    }
+
+    // Finds "<day> <Mon> <year> <HH:MM[:SS]> [AM|PM]" anywhere in rest.
+    static std::optional<std::chrono::system_clock::time_point> parse_datetime_from_line(std::string_view rest) {
+        static const std::array<std::string_view, 12> months = {
+            "Jan","Feb","Mar","Apr","May","Jun","Jul","Aug","Sep","Oct","Nov","Dec"
+        };
+
+        std::array<std::string_view, 24> tokens;
+        size_t count = 0;
+        for (std::string_view t; count < tokens.size() && !(t = next_token(rest)).empty();) tokens[count++] = t;
+
+        for (size_t i = 1; i + 2 < count; ++i) {
+            auto mon = std::find(months.begin(), months.end(), tokens[i]);
+            if (mon == months.end()) continue;
+
+            std::tm tm{};
+            std::string_view time = tokens[i + 2];
+            const size_t c1 = time.find(':');
+            if (c1 == std::string_view::npos) continue;
+            const size_t c2 = time.find(':', c1 + 1);
+            if (!parse_number(tokens[i - 1], tm.tm_mday) || !parse_number(tokens[i + 1], tm.tm_year) ||
+                !parse_number(time.substr(0, c1), tm.tm_hour) ||
+                !parse_number(time.substr(c1 + 1, c2 == std::string_view::npos ? std::string_view::npos : c2 - c1 - 1), tm.tm_min) ||
+                (c2 != std::string_view::npos && !parse_number(time.substr(c2 + 1), tm.tm_sec)))
+                continue;
+            if (tm.tm_mday < 1 || tm.tm_mday > 31 || tm.tm_hour > 23 || tm.tm_min > 59 || tm.tm_sec > 60) continue;
+            tm.tm_mon = (int)(mon - months.begin());
+            tm.tm_year -= 1900;
+
+            if (i + 3 < count) {
+                if (tokens[i + 3] == "AM" && tm.tm_hour == 12) tm.tm_hour = 0;
+                if (tokens[i + 3] == "PM" && tm.tm_hour != 12) tm.tm_hour += 12;
+            }
+
+            tm.tm_isdst = -1;
+            std::time_t tt = std::mktime(&tm);
+            if (tt == (std::time_t)-1) continue;
+
+            return std::chrono::system_clock::from_time_t(tt);
+        }
+
+        return std::nullopt;
+    }
+
+    // Allocates the snapshot, one arena block for the jobs and, for unseen users
+    // or continuation blocks, their interned copies.
+    static JobSnapshot parse_lpstat_jobs(std::string text) {
+        JobSnapshot jobs(std::move(text));
+        const std::string_view all = jobs.text();
+
+        auto for_each_line = [&all](auto&& fn) {
+            for (size_t pos = 0; pos < all.size();) {
+                size_t nl = all.find('\n', pos);
+                if (nl == std::string_view::npos) nl = all.size();
+                fn(all.substr(pos, nl - pos));
+                pos = nl + 1;
+            }
+        };
+
+        // Job lines start in column 0; reserving them up front keeps the arena to one block.
+        size_t heads = 0;
+        for_each_line([&heads](std::string_view line) {
+            if (!line.empty() && !std::isspace((unsigned char)line[0])) ++heads;
+        });
+        jobs.reserve(heads);
+
+        PrintJob* current = nullptr;
+        std::string details;  // Continuation lines of the current job, joined
+
+        auto flush = [&]() {
+            if (current && !details.empty()) current->file = jobs.keep(std::move(details));
+            details.clear();
+            current = nullptr;
+        };
+
+        for_each_line([&](std::string_view line) {
+            if (trim_view(line).empty()) { flush(); return; }
+
+            bool continuation = std::isspace((unsigned char)line[0]);
+
+            if (!continuation) {
+                flush();
+                current = &jobs.add();
+                current->job_id = next_token(line);
+                current->user = StringPool::instance().intern(next_token(line));
+
+                const std::string_view rest = trim_view(line);
+                current->status = rest;
+                current->submitted_at = parse_datetime_from_line(rest);
+
+                long long size = 0;
+                std::string_view size_tok = rest.substr(0, std::min(rest.find_first_of(" \t"), rest.size()));
+                if (!size_tok.empty() && size_tok.size() < 19 && parse_number(size_tok, size) && size >= 0)
+                    current->size_bytes = size;
+            } else if (current) {
+                std::string_view cont = trim_view(line);
+                if (!details.empty()) details += " | ";
+                details += cont;
+            }
+        });
+
+        flush();
+        return jobs;
+    }
+};
+
+// ============================================================
+// Wake engine
+// - Races several wake strategies against port 9100 accepting
+// - The learned favourite leads; the rest join after a short hedge
+// - Per-printer stats persist in wake_stats.ini (config dir)
+// ============================================================
+struct WakeResult {
+    bool already_awake = false;
+    bool awake = false;
+    std::string winner;                // Strategy credited with the wake ("" if ambiguous)
+    std::string lead;                  // Strategy fired first
+    long ms = 0;                       // Time until 9100 accepted
+    std::vector<std::string> failures; // "strategy: reason"
+};
+
+static std::string wake_stats_path() {
+    return Glib::build_filename(config_dir_path(), "wake_stats.ini");
+}
+
+class WakeEngine {
+public:
+    explicit WakeEngine(std::string host) : m_host(std::move(host)) { load(); }
+
+    const std::string& host() const { return m_host; }
+
+    // Blocks until port 9100 accepts, timeout_ms passes or cancelled() is true.
+    WakeResult race(int timeout_ms, const std::function<bool()>& cancelled = nullptr) {
+        WakeResult res;
+        if (tcp_connect_probe(m_host, PRINTER_PORT, 300) == 0) {
+            res.already_awake = res.awake = true;
+            return res;
+        }
+
+        const std::vector<std::string> order = launch_order();
+        res.lead = order.front();
+
+        struct Shot {
+            std::thread thread;
+            std::string error;   // empty on success
+        };
+        std::vector<Shot> shots(order.size());
+        auto fire = [&](size_t i) {
+            shots[i].thread = std::thread([this, &shots, &order, i]() {
+                shots[i].error = run_strategy(order[i]);
+            });
+        };
+
+        const auto start = std::chrono::steady_clock::now();
+        auto elapsed_ms = [&]() {
+            return (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        };
+
+        fire(0);
+        bool hedged = false;
+        long opened_at = -1;
+        while (elapsed_ms() < timeout_ms && !(cancelled && cancelled())) {
+            if (!hedged && elapsed_ms() >= HEDGE_MS) {
+                for (size_t i = 1; i < order.size(); ++i) fire(i);
+                hedged = true;
+            }
+            if (tcp_connect_probe(m_host, PRINTER_PORT, 250) == 0) {
+                opened_at = elapsed_ms();
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+
+        for (auto& shot : shots)
+            if (shot.thread.joinable()) shot.thread.join();
+
+        res.awake = opened_at >= 0;
+        res.ms = res.awake ? opened_at : elapsed_ms();
+        // Only a wake before the hedge can be attributed to a single strategy.
+        if (res.awake && !hedged) res.winner = res.lead;
+        for (size_t i = 0; i < order.size(); ++i)
+            if (!shots[i].error.empty()) res.failures.push_back(order[i] + ": " + shots[i].error);
+
+        record(res);
+        return res;
+    }
+
+    std::string preferred() const {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        return ranked().front();
+    }
+
+    // PJL status request that resets the printer's sleep timer when it is awake.
+    std::string keepalive() const { return wake_pjl(); }
+
+    // Human-readable table of what has worked for this printer.
+    std::vector<std::string> stats_lines() const {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        std::vector<std::string> lines;
+        for (const auto& id : ranked()) {
+            const Stats& st = m_stats.at(id);
+            std::ostringstream oss;
+            oss << std::left << std::setw(10) << id
+                << " led " << st.leads << "x, woke " << st.wins << "x";
+            if (st.wins > 0) oss << " (avg " << (long)st.avg_ms << " ms)";
+            oss << ", send failures " << st.failures;
+            lines.push_back(oss.str());
+        }
+        return lines;
+    }
+
+private:
+    static constexpr long HEDGE_MS = 400;
+    static constexpr int EXPLORE_EVERY = 5;
+
+    struct Stats {
+        int leads = 0;
+        int wins = 0;
+        int failures = 0;
+        double avg_ms = 0;  // EWMA of lead-to-open time for wins
+    };
+
+    const std::string m_host;
+    mutable std::mutex m_mutex;
+    std::map<std::string, Stats> m_stats;
+    int m_races = 0;
+
+    static const std::vector<std::string>& strategy_ids() {
+        static const std::vector<std::string> ids = {"pjl", "tcp_syn", "icmp", "snmp", "wol"};
+        return ids;
+    }
+
+    // Best first: win rate, then speed; untried strategies rank after proven ones.
+    std::vector<std::string> ranked() const {
+        std::vector<std::string> ids = strategy_ids();
+        std::stable_sort(ids.begin(), ids.end(), [this](const std::string& a, const std::string& b) {
+            const Stats& sa = m_stats.at(a);
+            const Stats& sb = m_stats.at(b);
+            double ra = sa.leads ? (double)sa.wins / sa.leads : -1;
+            double rb = sb.leads ? (double)sb.wins / sb.leads : -1;
+            if (ra != rb) return ra > rb;
+            if (sa.wins && sb.wins) return sa.avg_ms < sb.avg_ms;
+            return false;
+        });
+        return ids;
+    }
+
+    std::vector<std::string> launch_order() {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        std::vector<std::string> order = ranked();
+
+        // Occasionally let the least-tried strategy lead so the ranking can change.
+        if (++m_races % EXPLORE_EVERY == 0) {
+            auto least = std::min_element(order.begin(), order.end(), [this](const auto& a, const auto& b) {
+                return m_stats.at(a).leads < m_stats.at(b).leads;
+            });
+            std::rotate(order.begin(), least, least + 1);
+        }
+        return order;
+    }
+
+    // Returns "" when the wake was sent (or answered), otherwise why it failed.
+    std::string run_strategy(const std::string& id) const {
+        if (id == "pjl")     return wake_pjl();
+        if (id == "tcp_syn") return wake_tcp_syn();
+        if (id == "icmp")    return wake_icmp();
+        if (id == "snmp")    return wake_snmp();
+        if (id == "wol")     return wake_wol();
+        return "unknown strategy";
+    }
+
+    std::string wake_pjl() const {
+        static const char pjl[] = "\x1B%-12345X@PJL\r\n@PJL INFO STATUS\r\n\x1B%-12345X\r\n";
+
+        int cerr = 0;
+        int sock = tcp_connect_socket(m_host, PRINTER_PORT, 1000, cerr);
+        if (sock < 0) return strerror(cerr);
+        timeval tv{1, 0};
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        std::string err;
+        if (!send_all(sock, std::string(pjl, sizeof(pjl) - 1))) err = strerror(errno);
+        ::close(sock);
+        return err;
+    }
+
+    // Any answer (SYN-ACK or RST) on the web/IPP ports means the stack is up.
+    std::string wake_tcp_syn() const {
+        int e80 = tcp_connect_probe(m_host, 80, 500);
+        int e631 = tcp_connect_probe(m_host, 631, 500);
+        auto answered = [](int e) { return e == 0 || e == ECONNREFUSED; };
+        if (answered(e80) || answered(e631)) return "";
+        return std::string("80/631 ") + strerror(e80);
+    }
+
+    std::string wake_icmp() const {
+        // Unprivileged ping socket (net.ipv4.ping_group_range); fall back to ping(8).
+        auto addrs = AddressCache::instance().lookup(m_host);
+        if (addrs.empty()) return "cannot resolve " + m_host;
+        const sockaddr_storage& addr = addrs.front();
+        const bool v6 = addr.ss_family == AF_INET6;
+
+        int sock = socket(addr.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, v6 ? (int)IPPROTO_ICMPV6 : (int)IPPROTO_ICMP);
+        if (sock < 0) {
+            int code = 0;
+            run_shell_capture("ping -c 1 -W 1 " + shell_quote(m_host) + " >/dev/null 2>&1", code);
+            return code == 0 ? "" : "no echo reply";
+        }
+
+        // ICMP and ICMPv6 echo requests share the header layout; kernel fills id and checksum.
+        icmphdr req{};
+        req.type = v6 ? 128 : ICMP_ECHO;
+        req.un.echo.sequence = htons(1);
+
+        std::string err = "no echo reply";
+        if (sendto(sock, &req, sizeof(req), 0, (const sockaddr*)&addr, sockaddr_len(addr)) < 0) {
+            err = strerror(errno);
+        } else if (wait_readable(sock, 700)) {
+            char buf[256];
+            if (recv(sock, buf, sizeof(buf), 0) > 0) err.clear();
+        }
+        ::close(sock);
+        return err;
+    }
+
+    // SNMPv1 GET sysUpTime.0 with community "public".
+    std::string wake_snmp() const {
+        static const unsigned char get_sysuptime[] = {
+            0x30, 0x29, 0x02, 0x01, 0x00,
+            0x04, 0x06, 'p', 'u', 'b', 'l', 'i', 'c',
+            0xa0, 0x1c,
+            0x02, 0x04, 0x48, 0x50, 0x31, 0x31,   // request-id
+            0x02, 0x01, 0x00, 0x02, 0x01, 0x00,   // error-status, error-index
+            0x30, 0x0e, 0x30, 0x0c,
+            0x06, 0x08, 0x2b, 0x06, 0x01, 0x02, 0x01, 0x01, 0x03, 0x00,
+            0x05, 0x00,
+        };
+
+        auto addrs = AddressCache::instance().lookup(m_host);
+        if (addrs.empty()) return "cannot resolve " + m_host;
+        sockaddr_storage addr = addrs.front();
+        sockaddr_set_port(addr, 161);
+
+        int sock = socket(addr.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (sock < 0) return strerror(errno);
+
+        std::string err = "no SNMP reply";
+        if (sendto(sock, get_sysuptime, sizeof(get_sysuptime), 0, (const sockaddr*)&addr, sockaddr_len(addr)) < 0) {
+            err = strerror(errno);
+        } else if (wait_readable(sock, 700)) {
+            char buf[512];
+            if (recv(sock, buf, sizeof(buf), 0) > 0) err.clear();
+        }
+        ::close(sock);
+        return err;
+    }
+
+    // Wake-on-LAN magic packet to the MAC from the kernel neighbour table.
+    std::string wake_wol() const {
+        const std::string ipv4 = resolve_ipv4(m_host);
+        if (ipv4.empty()) return "no IPv4 address for " + m_host;
+
+        std::ifstream arp("/proc/net/arp");
+        std::string line, mac;
+        std::getline(arp, line);  // Header
+        while (std::getline(arp, line)) {
+            std::istringstream ls(line);
+            std::string ip, hw_type, flags, hw_addr;
+            ls >> ip >> hw_type >> flags >> hw_addr;
+            if (ip == ipv4 && hw_addr != "00:00:00:00:00:00") mac = hw_addr;
+        }
+        if (mac.empty()) return "no MAC in neighbour table";
+
+        unsigned char hw[6];
+        if (std::sscanf(mac.c_str(), "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+                        &hw[0], &hw[1], &hw[2], &hw[3], &hw[4], &hw[5]) != 6)
+            return "bad MAC " + mac;
+
+        std::string packet(6, '\xff');
+        for (int i = 0; i < 16; ++i) packet.append((const char*)hw, 6);
+
+        int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (sock < 0) return strerror(errno);
+        int one = 1;
+        setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(9);
+        addr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+
+        std::string err;
+        if (sendto(sock, packet.data(), packet.size(), 0, (sockaddr*)&addr, sizeof(addr)) < 0)
+            err = strerror(errno);
+        ::close(sock);
+        return err;
+    }
+
+    void record(const WakeResult& res) {
+        std::lock_guard<std::mutex> lk(m_mutex);
+
+        Stats& lead = m_stats[res.lead];
+        lead.leads++;
+        if (!res.winner.empty()) {
+            lead.wins++;
+            lead.avg_ms = (lead.wins == 1) ? res.ms : lead.avg_ms * 0.7 + res.ms * 0.3;
+        }
+        for (const auto& f : res.failures) {
+            std::string id = f.substr(0, f.find(':'));
+            m_stats[id].failures++;
+        }
+        save();
+    }
+
+    void load() {
+        for (const auto& id : strategy_ids()) m_stats[id] = Stats{};
+
+        Glib::KeyFile kf;
+        try {
+            if (!kf.load_from_file(wake_stats_path())) return;
+        } catch (...) {
+            return;
+        }
+        for (const auto& id : strategy_ids()) {
+            Stats& st = m_stats[id];
+            try {
+                st.leads = kf.get_integer(m_host, id + "_leads");
+                st.wins = kf.get_integer(m_host, id + "_wins");
+                st.failures = kf.get_integer(m_host, id + "_failures");
+                st.avg_ms = kf.get_double(m_host, id + "_avg_ms");
+            } catch (...) {
+                // Keep what was read
+            }
+        }
+        try { m_races = kf.get_integer(m_host, "races"); } catch (...) {}
+    }
+
+    // Called with m_mutex held. Other printers' groups are preserved.
+    void save() const {
+        Glib::KeyFile kf;
+        try {
+            kf.load_from_file(wake_stats_path());
+        } catch (...) {
+            // First save
+        }
+        try {
+            kf.set_integer(m_host, "races", m_races);
+            for (const auto& kv : m_stats) {
+                kf.set_integer(m_host, kv.first + "_leads", kv.second.leads);
+                kf.set_integer(m_host, kv.first + "_wins", kv.second.wins);
+                kf.set_integer(m_host, kv.first + "_failures", kv.second.failures);
+                kf.set_double(m_host, kv.first + "_avg_ms", kv.second.avg_ms);
+            }
+            write_file_atomic(wake_stats_path(), kf.to_data());
+        } catch (...) {
+            // Non-fatal
+        }
+    }
+};
+
+static std::string describe_wake(const WakeResult& r) {
+    if (r.already_awake) return "printer already awake";
+    if (!r.awake) return "printer did not wake within " + std::to_string(r.ms / 1000) + " s";
+    std::string text = "woke printer in " + std::to_string(r.ms) + " ms";
+    text += r.winner.empty() ? " (race, led by " + r.lead + ")" : " via " + r.winner;
+    return text;
+}
+
+// ============================================================
+// Link probe (PJL ECHO)
+// - One connection, a burst of @PJL ECHO with growing payloads
+// - Separates "port open" from "formatter answers quickly"
+// ============================================================
+struct EchoSample {
+    size_t bytes = 0;     // Command + echoed reply
+    double rtt_ms = 0;
+};
+
+struct EchoProbeResult {
+    std::string error;                // Empty when the formatter answered
+    double connect_ms = 0;
+    std::vector<EchoSample> samples;
+    double min_rtt_ms = 0;
+    double median_rtt_ms = 0;
+    double bytes_per_sec = 0;         // Marginal rate from the size/RTT slope
+};
+
+static EchoProbeResult pjl_echo_probe(const std::string& ip, int port) {
+    static const size_t payload_sizes[] = {8, 32, 64, 128, 200};  // PJL lines stay under 255 chars
+    static const int repeats = 3;
+    static const int reply_timeout_ms = 3000;
+    using clock = std::chrono::steady_clock;
+    auto ms_between = [](clock::time_point a, clock::time_point b) {
+        return std::chrono::duration<double, std::milli>(b - a).count();
+    };
+
+    EchoProbeResult res;
+    const auto t0 = clock::now();
+    int err = 0;
+    int sock = tcp_connect_socket(ip, port, 3000, err);
+    if (sock < 0) {
+        res.error = "connect: " + std::string(strerror(err));
+        return res;
+    }
+    res.connect_ms = ms_between(t0, clock::now());
+
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (!send_all(sock, "\x1B%-12345X@PJL\r\n")) {
+        res.error = "send: " + std::string(strerror(errno));
+        ::close(sock);
+        return res;
+    }
+
+    std::string inbox;
+    int seq = 0;
+    for (size_t size : payload_sizes) {
+        for (int r = 0; r < repeats; ++r) {
+            // Unique tag so a late reply is never mistaken for the current one.
+            const std::string tag = "HPDIAG" + std::to_string(seq++) + ":";
+            std::string payload = tag;
+            while (payload.size() < size) payload.push_back((char)('A' + payload.size() % 26));
+            const std::string cmd = "@PJL ECHO " + payload + "\r\n";
+
+            const auto start = clock::now();
+            if (!send_all(sock, cmd)) {
+                res.error = "send: " + std::string(strerror(errno));
+                break;
+            }
+
+            bool got = false;
+            while (!got) {
+                double left = reply_timeout_ms - ms_between(start, clock::now());
+                if (left <= 0 || !wait_readable(sock, (int)left)) break;
+                char buf[1024];
+                ssize_t n = ::recv(sock, buf, sizeof(buf), 0);
+                if (n <= 0) break;
+                inbox.append(buf, (size_t)n);
+
+                auto pos = inbox.find(tag);
+                if (pos != std::string::npos && inbox.find('\n', pos) != std::string::npos) {
+                    got = true;
+                    inbox.erase(0, inbox.find('\n', pos) + 1);
+                }
+            }
+            if (!got) {
+                res.error = res.samples.empty() ? "formatter did not answer PJL ECHO"
+                                                : "reply timed out at " + std::to_string(size) + " byte payload";
+                break;
+            }
+            res.samples.push_back({cmd.size() * 2, ms_between(start, clock::now())});
+        }
+        if (!res.error.empty()) break;
+    }
+
+    send_all(sock, "\x1B%-12345X");
+    ::close(sock);
+
+    if (res.samples.empty()) return res;
+
+    std::vector<double> rtts;
+    for (const auto& s : res.samples) rtts.push_back(s.rtt_ms);
+    std::sort(rtts.begin(), rtts.end());
+    res.min_rtt_ms = rtts.front();
+    res.median_rtt_ms = rtts[rtts.size() / 2];
+
+    // Least-squares slope of RTT over bytes; the intercept is the per-command cost.
+    double n = (double)res.samples.size(), sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (const auto& s : res.samples) {
+        sx += (double)s.bytes;
+        sy += s.rtt_ms;
+        sxx += (double)s.bytes * (double)s.bytes;
+        sxy += (double)s.bytes * s.rtt_ms;
+    }
+    double denom = n * sxx - sx * sx;
+    double slope_ms_per_byte = denom > 0 ? (n * sxy - sx * sy) / denom : 0;
+    if (slope_ms_per_byte > 0) {
+        res.bytes_per_sec = 1000.0 / slope_ms_per_byte;
+    } else {
+        // RTT did not grow with size: fall back to the largest sample's average rate.
+        const auto& last = res.samples.back();
+        res.bytes_per_sec = last.rtt_ms > 0 ? last.bytes * 1000.0 / last.rtt_ms : 0;
+    }
+    return res;
+}
+
+// ============================================================
+// Path prober
+// - Every TTL probed at once over UDP and ICMP (ping socket)
+// - ICMP time-exceeded / unreachable arrive on the IP_RECVERR error queue
+// - One budget of ~1 s instead of a sequential traceroute
+// ============================================================
+struct HopStat {
+    int ttl = 0;
+    std::string addr;          // First responder seen ("" when the hop stayed silent)
+    int sent = 0;
+    int received = 0;
+    double min_rtt_ms = 0;
+    double sum_rtt_ms = 0;
+    bool is_target = false;
+    bool unreachable = false;  // Hop answered "destination unreachable"
+};
+
+struct PathProbeResult {
+    std::string error;
+    std::vector<HopStat> hops;  // hops[i].ttl == i + 1
+    int target_ttl = 0;         // 0 when the printer never answered
+    bool icmp_used = false;
+};
+
+static PathProbeResult probe_path(const std::string& ip, int max_hops = 12, int rounds = 3, int budget_ms = 1200) {
+    using clock = std::chrono::steady_clock;
+    PathProbeResult res;
+
+    in_addr target{};
+    if (inet_pton(AF_INET, ip.c_str(), &target) != 1) {
+        res.error = "not an IPv4 address: " + ip;
+        return res;
+    }
+
+    int one = 1;
+    int udp = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (udp < 0) {
+        res.error = "socket: " + std::string(strerror(errno));
+        return res;
+    }
+    setsockopt(udp, SOL_IP, IP_RECVERR, &one, sizeof(one));
+
+    // Ping sockets depend on net.ipv4.ping_group_range; UDP alone still works without them.
+    int icmp = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, IPPROTO_ICMP);
+    if (icmp >= 0) setsockopt(icmp, SOL_IP, IP_RECVERR, &one, sizeof(one));
+    res.icmp_used = icmp >= 0;
+
+    res.hops.resize(max_hops);
+    for (int t = 1; t <= max_hops; ++t) res.hops[t - 1].ttl = t;
+
+    // Probe identity travels in the payload, which the kernel hands back with each error.
+    struct Probe { clock::time_point sent; bool answered = false; };
+    std::map<std::array<int, 3>, Probe> probes;   // {proto, ttl, round}
+    auto make_tag = [](int proto, int ttl, int round) {
+        return std::string("HPDT") + (char)('0' + proto) + (char)ttl + (char)round;
+    };
+    auto parse_tag = [](const char* data, size_t len, std::array<int, 3>& key) {
+        const std::string buf(data, len);
+        auto pos = buf.find("HPDT");
+        if (pos == std::string::npos || pos + 7 > buf.size()) return false;
+        key = {buf[pos + 4] - '0', (unsigned char)buf[pos + 5], (unsigned char)buf[pos + 6]};
+        return true;
+    };
+
+    auto credit = [&](const std::array<int, 3>& key, const sockaddr_in* from, bool from_target, bool unreachable) {
+        auto it = probes.find(key);
+        if (it == probes.end() || it->second.answered) return;
+        it->second.answered = true;
+        HopStat& hop = res.hops[key[1] - 1];
+        double rtt = std::chrono::duration<double, std::milli>(clock::now() - it->second.sent).count();
+        if (hop.received == 0 || rtt < hop.min_rtt_ms) hop.min_rtt_ms = rtt;
+        hop.sum_rtt_ms += rtt;
+        hop.received++;
+        if (hop.addr.empty() && from) {
+            char buf[INET_ADDRSTRLEN] = {0};
+            inet_ntop(AF_INET, &from->sin_addr, buf, sizeof(buf));
+            hop.addr = buf;
+        }
+        if (from_target) hop.is_target = true;
+        else if (unreachable) hop.unreachable = true;
+    };
+
+    auto drain = [&](int fd) {
+        for (;;) {
+            char data[512], control[512];
+            iovec iov{data, sizeof(data)};
+            sockaddr_in from{};
+            msghdr msg{};
+            msg.msg_name = &from;
+            msg.msg_namelen = sizeof(from);
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            ssize_t n = recvmsg(fd, &msg, MSG_ERRQUEUE);
+            if (n < 0) break;
+            std::array<int, 3> key{};
+            if (!parse_tag(data, (size_t)n, key)) continue;
+            for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+                if (c->cmsg_level != SOL_IP || c->cmsg_type != IP_RECVERR) continue;
+                auto* ee = (sock_extended_err*)CMSG_DATA(c);
+                if (ee->ee_origin != SO_EE_ORIGIN_ICMP) continue;
+                auto* off = (sockaddr_in*)SO_EE_OFFENDER(ee);
+                bool from_target = off->sin_addr.s_addr == target.s_addr;
+                credit(key, off, from_target, ee->ee_type == ICMP_DEST_UNREACH);
+            }
+        }
+        // Echo replies from the printer itself arrive as ordinary data.
+        if (fd == icmp) {
+            char data[512];
+            sockaddr_in from{};
+            socklen_t len = sizeof(from);
+            ssize_t n;
+            while ((n = recvfrom(fd, data, sizeof(data), 0, (sockaddr*)&from, &len)) > 0) {
+                std::array<int, 3> key{};
+                if (parse_tag(data, (size_t)n, key)) credit(key, &from, true, false);
+                len = sizeof(from);
+            }
+        }
+    };
+
+    auto pump = [&](int wait_ms) {
+        pollfd pfds[2] = {{udp, POLLIN, 0}, {icmp, POLLIN, 0}};
+        int nfds = icmp >= 0 ? 2 : 1;
+        if (::poll(pfds, nfds, wait_ms) <= 0) return;
+        for (int i = 0; i < nfds; ++i)
+            if (pfds[i].revents) drain(pfds[i].fd);
+    };
+
+    sockaddr_in dst{};
+    dst.sin_family = AF_INET;
+    dst.sin_addr = target;
+
+    const auto start = clock::now();
+    const int round_gap_ms = 100;  // Spread rounds so routers' ICMP rate limits don't eat them
+    for (int r = 0; r < rounds; ++r) {
+        for (int ttl = 1; ttl <= max_hops; ++ttl) {
+            const std::string tag_udp = make_tag(0, ttl, r);
+            setsockopt(udp, SOL_IP, IP_TTL, &ttl, sizeof(ttl));
+            dst.sin_port = htons(33434 + ttl);
+            probes[{0, ttl, r}].sent = clock::now();
+            if (sendto(udp, tag_udp.data(), tag_udp.size(), 0, (sockaddr*)&dst, sizeof(dst)) >= 0)
+                res.hops[ttl - 1].sent++;
+            else
+                probes.erase({0, ttl, r});
+
+            if (icmp >= 0) {
+                char pkt[sizeof(icmphdr) + 8] = {0};
+                auto* req = (icmphdr*)pkt;
+                req->type = ICMP_ECHO;
+                req->un.echo.sequence = htons((uint16_t)(ttl * 16 + r));  // Kernel fills id and checksum
+                const std::string tag_icmp = make_tag(1, ttl, r);
+                memcpy(pkt + sizeof(icmphdr), tag_icmp.data(), tag_icmp.size());
+                setsockopt(icmp, SOL_IP, IP_TTL, &ttl, sizeof(ttl));
+                dst.sin_port = 0;
+                probes[{1, ttl, r}].sent = clock::now();
+                if (sendto(icmp, pkt, sizeof(icmphdr) + tag_icmp.size(), 0, (sockaddr*)&dst, sizeof(dst)) >= 0)
+                    res.hops[ttl - 1].sent++;
+                else
+                    probes.erase({1, ttl, r});
+            }
+        }
+        const auto next_round = start + std::chrono::milliseconds(round_gap_ms * (r + 1));
+        while (clock::now() < next_round)
+            pump((int)std::chrono::duration_cast<std::chrono::milliseconds>(next_round - clock::now()).count() + 1);
+    }
+
+    const auto deadline = start + std::chrono::milliseconds(budget_ms);
+    while (clock::now() < deadline)
+        pump((int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count() + 1);
+
+    ::close(udp);
+    if (icmp >= 0) ::close(icmp);
+
+    // The path ends at the first TTL the printer answered from; later TTLs only echo it.
+    // A hop answering "unreachable" is where the path ends for us.
+    int last_seen = 0;
+    bool dead_end = false;
+    for (const auto& hop : res.hops) {
+        if (hop.is_target) {
+            res.target_ttl = hop.ttl;
+            break;
+        }
+        if (hop.received > 0) last_seen = hop.ttl;
+        if (hop.unreachable) {
+            dead_end = true;
+            break;
+        }
+    }
+    int keep = res.target_ttl ? res.target_ttl : dead_end ? last_seen : std::min(max_hops, last_seen + 1);
+    res.hops.resize((size_t)std::max(keep, 1));
+    return res;
+}
+
+// ============================================================
+// Multi-interface probing
+// - One TCP connect + ICMP echo per up interface, all concurrent
+// - SO_BINDTODEVICE where permitted, else a source-address bind
+// ============================================================
+struct NetInterface {
+    std::string name;
+    std::string addr;
+};
+
+struct InterfaceProbe {
+    NetInterface iface;
+    std::string pin;          // "device", "source" or "" when the socket could not be pinned
+    int tcp_err = -1;         // 0 = port accepted; -1 = not tried (unpinned results are discarded)
+    double tcp_ms = 0;
+    std::string icmp_err;     // Empty = echo reply received
+    double icmp_ms = 0;
+};
+
+static std::vector<NetInterface> up_ipv4_interfaces() {
+    std::vector<NetInterface> out;
+    ifaddrs* list = nullptr;
+    if (getifaddrs(&list) != 0) return out;
+    for (ifaddrs* it = list; it; it = it->ifa_next) {
+        if (!it->ifa_addr || it->ifa_addr->sa_family != AF_INET) continue;
+        if (!(it->ifa_flags & IFF_UP) || !(it->ifa_flags & IFF_RUNNING) || (it->ifa_flags & IFF_LOOPBACK)) continue;
+        char buf[INET_ADDRSTRLEN] = {0};
+        inet_ntop(AF_INET, &((sockaddr_in*)it->ifa_addr)->sin_addr, buf, sizeof(buf));
+        out.push_back({it->ifa_name, buf});
+    }
+    freeifaddrs(list);
+    return out;
+}
+
+// SO_BINDTODEVICE needs CAP_NET_RAW before Linux 5.7. The source bind only fixes the
+// source address; without policy routing the kernel may still pick another egress.
+static std::string pin_socket(int sock, const NetInterface& iface) {
+    if (setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, iface.name.c_str(), (socklen_t)iface.name.size()) == 0)
+        return "device";
+    sockaddr_in src{};
+    src.sin_family = AF_INET;
+    inet_pton(AF_INET, iface.addr.c_str(), &src.sin_addr);
+    if (bind(sock, (sockaddr*)&src, sizeof(src)) == 0) return "source";
+    return "";
+}
+
+// Device the kernel would send ip through for source address src ("" = unknown).
+static std::string route_egress(const std::string& ip, const std::string& src) {
+    int code = 0;
+    std::istringstream out(run_shell_capture("ip -o route get " + shell_quote(ip) + " from " + shell_quote(src) +
+                                             " 2>/dev/null", code));
+    std::string word;
+    while (out >> word)
+        if (word == "dev" && out >> word) return code == 0 ? word : "";
+    return "";
+}
+
+static std::vector<InterfaceProbe> probe_interfaces(const std::string& ip, int port, int timeout_ms) {
+    using clock = std::chrono::steady_clock;
+    auto ms_since = [](clock::time_point t) {
+        return std::chrono::duration<double, std::milli>(clock::now() - t).count();
+    };
+
+    std::vector<InterfaceProbe> results;
+    for (const auto& iface : up_ipv4_interfaces()) {
+        InterfaceProbe p;
+        p.iface = iface;
+        results.push_back(p);
+    }
+
+    std::vector<std::thread> workers;
+    for (auto& r : results) {
+        workers.emplace_back([&r, &ip, port, timeout_ms, ms_since]() {
+            // An unpinned socket follows the routing table, so its result says nothing
+            // about this interface: such an interface is left unverified, not credited.
+            int err = 0;
+            std::string pin;
+            auto t0 = clock::now();
+            int sock = tcp_connect_socket(ip, port, timeout_ms, err,
+                                          [&](int s) { pin = pin_socket(s, r.iface); });
+            r.pin = pin;
+            if (!pin.empty()) {
+                r.tcp_ms = ms_since(t0);
+                r.tcp_err = err;
+            }
+            if (sock >= 0) ::close(sock);
+            if (pin.empty()) {
+                r.icmp_err = "could not pin";
+                return;
+            }
+
+            int icmp = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_ICMP);
+            if (icmp < 0) {
+                r.icmp_err = "ping sockets disabled";
+                return;
+            }
+            if (pin_socket(icmp, r.iface).empty()) {
+                r.icmp_err = "could not pin";
+                ::close(icmp);
+                return;
+            }
+            sockaddr_in dst{};
+            dst.sin_family = AF_INET;
+            if (inet_pton(AF_INET, ip.c_str(), &dst.sin_addr) != 1) {
+                r.icmp_err = "not an IPv4 address";
+                ::close(icmp);
+                return;
+            }
+            icmphdr req{};
+            req.type = ICMP_ECHO;
+            req.un.echo.sequence = htons(1);
+            r.icmp_err = "no echo reply";
+            t0 = clock::now();
+            if (sendto(icmp, &req, sizeof(req), 0, (sockaddr*)&dst, sizeof(dst)) < 0) {
+                r.icmp_err = strerror(errno);
+            } else if (wait_readable(icmp, timeout_ms)) {
+                char buf[256];
+                if (recv(icmp, buf, sizeof(buf), 0) > 0) {
+                    r.icmp_err.clear();
+                    r.icmp_ms = ms_since(t0);
+                }
+            }
+            ::close(icmp);
+        });
+    }
+    for (auto& w : workers) w.join();
+    return results;
+}
+
+// ============================================================
+// Print benchmark
+// - Submits N synthetic jobs to PRINTER_NAME and follows each one
+//   through pending -> processing -> completed via lpstat polling
+// - Runs on a worker thread; progress is reported through a callback
+// ============================================================
+// CUPS's text filter fits 60 lines on a Letter/A4 sheet at its default 6 lpi.
+static const int BENCH_MAX_LINES_PER_PAGE = 60;
+
+struct BenchSettings {
+    int jobs = 3;
+    int pages = 2;           // Physical sheets per job
+    int lines_per_page = BENCH_MAX_LINES_PER_PAGE;  // Text per sheet; exercises the filter chain
+};
+
+struct BenchJob {
+    std::string id;
+    std::chrono::steady_clock::time_point submitted;
+    std::optional<std::chrono::steady_clock::time_point> processing;
+    std::optional<std::chrono::steady_clock::time_point> completed;
+};
+
+struct BenchReport {
+    BenchSettings settings;
+    std::vector<BenchJob> jobs;
+    std::string error;       // Set when the run stopped early
+    double wall_ms = 0;      // First submit to last completion
+};
+
+// Nearest-rank percentile; v need not be sorted. Returns 0 for an empty set.
+static double percentile(std::vector<double> v, double p) {
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    size_t rank = (size_t)std::ceil(p / 100.0 * (double)v.size());
+    return v[std::min(v.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+// One form feed per page, and never more lines than a sheet holds, so pages == sheets.
+static std::string bench_document(int index, int pages, int lines_per_page) {
+    std::ostringstream doc;
+    const std::string filler = "The quick brown fox jumps over the lazy dog 0123456789. ";
+    const int lines = std::clamp(lines_per_page, 2, BENCH_MAX_LINES_PER_PAGE);
+    for (int p = 1; p <= pages; ++p) {
+        if (p > 1) doc << '\f';
+        doc << "HP diagnostic benchmark - job " << index << " page " << p << "/" << pages << "\n\n";
+        for (int l = 2; l < lines; ++l) doc << filler << '\n';
+    }
+    return doc.str();
+}
+
+// Returns the CUPS job id ("Queue-123"), or "" with err set.
+static std::string bench_submit(int index, const BenchSettings& s, std::string& err) {
+    char path[] = "/tmp/hpdiag-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        err = "mkstemp: " + std::string(strerror(errno));
+        return "";
+    }
+    const std::string doc = bench_document(index, s.pages, s.lines_per_page);
+    bool written = ::write(fd, doc.data(), doc.size()) == (ssize_t)doc.size();
+    ::close(fd);
+    if (!written) {
+        ::unlink(path);
+        err = "could not write benchmark document";
+        return "";
+    }
+
+    int code = 0;
+    std::string out = run_shell_capture(
+        "lp -d " + shell_quote(PRINTER_NAME) + " -t " + shell_quote("hpdiag-bench-" + std::to_string(index)) +
+        " -- " + shell_quote(path) + " 2>&1", code);
+    ::unlink(path);  // lp has copied the file into the spool by now
+
+    // "request id is Queue-123 (1 file(s))"
+    auto pos = out.find("request id is ");
+    if (code != 0 || pos == std::string::npos) {
+        err = "lp failed: " + trim_copy(out);
+        return "";
+    }
+    std::istringstream iss(out.substr(pos + 14));
+    std::string id;
+    iss >> id;
+    return id;
+}
+
+static BenchReport run_print_benchmark(const BenchSettings& s,
+                                       const std::function<void(const std::string&)>& progress,
+                                       const std::function<bool()>& cancelled) {
+    using clock = std::chrono::steady_clock;
+    BenchReport rep;
+    rep.settings = s;
+    auto sh = [](const std::string& cmd) { int code = 0; return run_shell_capture(cmd, code); };
+
+    const auto t0 = clock::now();
+    for (int i = 1; i <= s.jobs && !cancelled(); ++i) {
+        std::string err;
+        BenchJob job;
+        job.submitted = clock::now();
+        job.id = bench_submit(i, s, err);
+        if (job.id.empty()) {
+            rep.error = err;
+            break;
+        }
+        progress("Submitted " + job.id);
+        rep.jobs.push_back(job);
+    }
+
+    // Generous ceiling: a minute per page plus two minutes for warm-up.
+    const auto deadline = t0 + std::chrono::seconds(60 * s.jobs * s.pages + 120);
+    size_t done = 0;
+    while (done < rep.jobs.size()) {
+        if (cancelled()) {
+            rep.error = "cancelled";
+            break;
+        }
+        if (clock::now() > deadline) {
+            rep.error = "timed out waiting for jobs to complete";
+            break;
+        }
+
+        std::set<std::string> pending;
+        std::istringstream jobs(sh("lpstat -W not-completed -o " + shell_quote(PRINTER_NAME) + " 2>&1"));
+        for (std::string line; std::getline(jobs, line);) {
+            std::istringstream ls(line);
+            std::string id;
+            if (ls >> id) pending.insert(id);
+        }
+        const std::string state = sh("lpstat -p " + shell_quote(PRINTER_NAME) + " 2>&1");
+        if (state.find("disabled") != std::string::npos) {
+            rep.error = "queue became disabled during the run";
+            break;
+        }
+
+        const auto now = clock::now();
+        for (auto& job : rep.jobs) {
+            if (job.completed) continue;
+            if (!job.processing && state.find("now printing " + job.id + ".") != std::string::npos) {
+                job.processing = now;
+                progress(job.id + " processing");
+            }
+            if (!pending.count(job.id)) {
+                if (!job.processing) job.processing = now;  // Finished between polls
+                job.completed = now;
+                ++done;
+                progress(job.id + " completed");
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    }
+
+    // Leave nothing of ours behind in the queue.
+    for (const auto& job : rep.jobs)
+        if (!job.completed) sh("cancel " + shell_quote(job.id) + " 2>&1");
+
+    for (const auto& job : rep.jobs)
+        if (job.completed)
+            rep.wall_ms = std::max(rep.wall_ms, std::chrono::duration<double, std::milli>(*job.completed - t0).count());
+    return rep;
+}
+
+// ============================================================
+// Raw port printing
+// - Streams a prebuilt PJL/PCL document straight to 9100 with sendfile
+// - Bypasses CUPS so filter cost and network cost can be told apart
+// ============================================================
+struct RawSendResult {
+    std::string error;       // Empty on success
+    size_t bytes = 0;        // Bytes handed to the socket
+    double connect_ms = 0;
+    double send_ms = 0;      // Until the last byte was queued
+    double total_ms = 0;     // Until the peer acknowledged everything
+    double bytes_per_sec = 0;
+};
+
+// pages sheets of at most 60 lines (PCL's default text length) each ended by a form
+// feed; padding_kb of @PJL COMMENT lines adds transfer volume without printing.
+static std::string build_raw_test_document(int pages, int padding_kb) {
+    const std::string uel = "\x1B%-12345X";
+    std::ostringstream doc;
+    doc << uel << "@PJL\r\n"
+        << "@PJL JOB NAME=\"HP Diagnostic Raw Test\"\r\n";
+    const std::string comment = "@PJL COMMENT HP diagnostic raw transfer padding 0123456789 ABCDEFGHIJKLMNOPQRSTUVWXYZ\r\n";
+    for (size_t used = 0; used + comment.size() <= (size_t)padding_kb * 1024; used += comment.size()) doc << comment;
+    doc << "@PJL ENTER LANGUAGE=PCL\r\n"
+        << "\x1B" "E";
+
+    static const int lines_per_page = 60;
+    const std::string filler = "Raw port 9100 transfer test 0123456789 ABCDEFGHIJKLMNOPQRSTUVWXYZ\r\n";
+    for (int p = 1; p <= pages; ++p) {
+        doc << "HP diagnostic raw test - page " << p << "/" << pages << "\r\n\r\n";
+        for (int l = 2; l < lines_per_page; ++l) doc << filler;
+        doc << '\f';
+    }
+    doc << "\x1B" "E" << uel << "@PJL EOJ NAME=\"HP Diagnostic Raw Test\"\r\n" << uel;
+    return doc.str();
+}
+
+static RawSendResult raw_send_document(const std::string& doc, const std::string& host, int port,
+                                       const std::function<bool()>& cancelled) {
+    using clock = std::chrono::steady_clock;
+    auto ms_since = [](clock::time_point t) {
+        return std::chrono::duration<double, std::milli>(clock::now() - t).count();
+    };
+    RawSendResult res;
+
+    // Page-cache backed file so sendfile moves data without a user-space copy.
+    int file = memfd_create("hpdiag-raw", MFD_CLOEXEC);
+    if (file < 0 || ::write(file, doc.data(), doc.size()) != (ssize_t)doc.size()) {
+        res.error = "memfd: " + std::string(strerror(errno));
+        if (file >= 0) ::close(file);
+        return res;
+    }
+
+    const auto t0 = clock::now();
+    int err = 0;
+    int sock = tcp_connect_socket(host, port, 5000, err);
+    if (sock < 0) {
+        res.error = "connect " + host + ":" + std::to_string(port) + ": " + strerror(err);
+        ::close(file);
+        return res;
+    }
+    res.connect_ms = ms_since(t0);
+
+    // Large send buffer keeps the pipe full over Wi-Fi; short send timeout so cancel is noticed.
+    int sndbuf = 1 << 20;
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    timeval tv{0, 500 * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    const auto t_send = clock::now();
+    off_t offset = 0;
+    const off_t size = (off_t)doc.size();
+    while (offset < size) {
+        if (cancelled()) {
+            res.error = "cancelled";
+            break;
+        }
+        ssize_t n = ::sendfile(sock, file, &offset, (size_t)std::min<off_t>(size - offset, 256 * 1024));
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            res.error = "sendfile: " + std::string(strerror(errno));
+            break;
+        }
+        if (n == 0) break;
+    }
+    res.bytes = (size_t)offset;
+    res.send_ms = ms_since(t_send);
+
+    // Done when the peer has acknowledged every byte (SIOCOUTQ reaches zero).
+    if (res.error.empty()) {
+        const auto drain_deadline = clock::now() + std::chrono::seconds(60);
+        int unacked = 0;
+        while (ioctl(sock, SIOCOUTQ, &unacked) == 0 && unacked > 0) {
+            if (cancelled() || clock::now() > drain_deadline) {
+                res.error = cancelled() ? "cancelled" : std::to_string(unacked) + " bytes still unacknowledged after 60 s";
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+    res.total_ms = ms_since(t_send);
+    if (res.total_ms > 0) res.bytes_per_sec = res.bytes * 1000.0 / res.total_ms;
+
+    ::shutdown(sock, SHUT_WR);
+    ::close(sock);
+    ::close(file);
+    return res;
+}
+
+// ============================================================
+// Transfer monitor (sock_diag)
+// - One NETLINK_SOCK_DIAG dump lists the host's TCP sockets to printer:9100
+//   with tcp_info attached: no packet capture, no privileges
+// - Per flow and per interval: bytes acknowledged, send queue, RTT,
+//   retransmits and zero-window entries
+// - Data queued with nothing acknowledged for STALL_SEC is a stall
+// ============================================================
+struct TcpFlowSample {
+    uint64_t cookie = 0;          // Kernel socket cookie; stable for the socket's life
+    std::string local, remote;    // "addr:port"
+    int state = 0;                // TCP_ESTABLISHED, TCP_FIN_WAIT1, ...
+    uint32_t send_queue = 0;      // Written by the backend, not yet acknowledged
+    bool has_bytes_acked = false; // Linux 4.1+
+    uint64_t bytes_acked = 0;
+    uint32_t rtt_us = 0;
+    uint32_t rttvar_us = 0;
+    uint32_t total_retrans = 0;
+    bool zero_window = false;     // Peer advertises a zero window (or is being probed for one)
+};
+
+// glibc's tcp_info stops at tcpi_total_retrans; the kernel appends these (same layout).
+struct TcpInfoExt {
+    tcp_info base;
+    uint64_t pacing_rate, max_pacing_rate, bytes_acked, bytes_received;
+    uint32_t segs_out, segs_in, notsent_bytes, min_rtt, data_segs_in, data_segs_out;
+    uint64_t delivery_rate, busy_time, rwnd_limited, sndbuf_limited;
+    uint32_t delivered, delivered_ce;
+    uint64_t bytes_sent, bytes_retrans;
+    uint32_t dsack_dups, reord_seen, rcv_ooopack, snd_wnd;
+};
+
+static const char* tcp_state_name(int state) {
+    static const char* names[] = {"?", "ESTAB", "SYN-SENT", "SYN-RECV", "FIN-WAIT-1", "FIN-WAIT-2",
+                                  "TIME-WAIT", "CLOSE", "CLOSE-WAIT", "LAST-ACK", "LISTEN", "CLOSING"};
+    return state > 0 && state < (int)(sizeof(names) / sizeof(names[0])) ? names[state] : "?";
+}
+
+static std::string diag_endpoint(int family, const uint32_t* addr, uint16_t port_be) {
+    char buf[INET6_ADDRSTRLEN] = {0};
+    inet_ntop(family, addr, buf, sizeof(buf));
+    const std::string host = family == AF_INET6 ? "[" + std::string(buf) + "]" : std::string(buf);
+    return host + ":" + std::to_string(ntohs(port_be));
+}
+
+// An IPv4 peer also matches a dual-stack socket's v4-mapped address.
+static bool diag_peer_matches(const inet_diag_msg& m, const std::vector<sockaddr_storage>& peers) {
+    const uint32_t* dst = m.id.idiag_dst;
+    for (const auto& p : peers) {
+        if (p.ss_family == AF_INET) {
+            const uint32_t v4 = ((const sockaddr_in&)p).sin_addr.s_addr;
+            if (m.idiag_family == AF_INET && dst[0] == v4) return true;
+            if (m.idiag_family == AF_INET6 && dst[0] == 0 && dst[1] == 0 && dst[2] == htonl(0xffff) && dst[3] == v4)
+                return true;
+        } else if (p.ss_family == AF_INET6 && m.idiag_family == AF_INET6) {
+            if (memcmp(dst, &((const sockaddr_in6&)p).sin6_addr, 16) == 0) return true;
+        }
+    }
+    return false;
+}
+
+// Every TCP socket on this host (any owner) connected to one of peers on port.
+static bool sock_diag_flows(const std::vector<sockaddr_storage>& peers, int port,
+                            std::vector<TcpFlowSample>& out, std::string& err) {
+    out.clear();
+    int fd = ::socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    if (fd < 0) {
+        err = "sock_diag: " + std::string(strerror(errno));
+        return false;
+    }
+    timeval tv{1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    // Listeners and TIME-WAIT never carry job data; FIN-WAIT-1 is a job's unacknowledged tail.
+    const uint32_t states = 0xFFF & ~((1u << TCP_LISTEN) | (1u << TCP_TIME_WAIT) | (1u << TCP_CLOSE));
+    for (int family : {AF_INET, AF_INET6}) {
+        struct {
+            nlmsghdr nlh;
+            inet_diag_req_v2 req;
+        } msg{};
+        msg.nlh.nlmsg_len = sizeof(msg);
+        msg.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+        msg.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+        msg.nlh.nlmsg_seq = (uint32_t)family;
+        msg.req.sdiag_family = (uint8_t)family;
+        msg.req.sdiag_protocol = IPPROTO_TCP;
+        msg.req.idiag_ext = 1 << (INET_DIAG_INFO - 1);
+        msg.req.idiag_states = states;
+
+        sockaddr_nl kernel{};
+        kernel.nl_family = AF_NETLINK;
+        if (::sendto(fd, &msg, sizeof(msg), 0, (const sockaddr*)&kernel, sizeof(kernel)) < 0) {
+            err = "sock_diag send: " + std::string(strerror(errno));
+            ::close(fd);
+            return false;
+        }
+
+        alignas(nlmsghdr) char buf[32768];
+        bool done = false;
+        while (!done) {
+            ssize_t got = ::recv(fd, buf, sizeof(buf), 0);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) {
+                err = "sock_diag recv: " + std::string(got < 0 ? strerror(errno) : "connection closed");
+                ::close(fd);
+                return false;
+            }
+            int len = (int)got;
+            for (auto* h = (nlmsghdr*)buf; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+                if (h->nlmsg_type == NLMSG_DONE) {
+                    done = true;
+                    break;
+                }
+                if (h->nlmsg_type == NLMSG_ERROR) {
+                    // No IPv6 in this kernel: nothing to list for that family.
+                    const int code = -((const nlmsgerr*)NLMSG_DATA(h))->error;
+                    if (family == AF_INET6) {
+                        done = true;
+                        break;
+                    }
+                    err = "sock_diag: " + std::string(strerror(code));
+                    ::close(fd);
+                    return false;
+                }
+                if (h->nlmsg_type != SOCK_DIAG_BY_FAMILY) continue;
+
+                const auto* m = (const inet_diag_msg*)NLMSG_DATA(h);
+                if (ntohs(m->id.idiag_dport) != port || !diag_peer_matches(*m, peers)) continue;
+
+                TcpFlowSample s;
+                s.cookie = (uint64_t)m->id.idiag_cookie[0] | ((uint64_t)m->id.idiag_cookie[1] << 32);
+                s.local = diag_endpoint(m->idiag_family, m->id.idiag_src, m->id.idiag_sport);
+                s.remote = diag_endpoint(m->idiag_family, m->id.idiag_dst, m->id.idiag_dport);
+                s.state = m->idiag_state;
+                s.send_queue = m->idiag_wqueue;
+
+                int attr_len = (int)(h->nlmsg_len - NLMSG_LENGTH(sizeof(*m)));
+                for (auto* a = (rtattr*)(m + 1); RTA_OK(a, attr_len); a = RTA_NEXT(a, attr_len)) {
+                    if (a->rta_type != INET_DIAG_INFO) continue;
+                    // Older kernels send a shorter struct: the missing fields stay zero.
+                    TcpInfoExt info{};
+                    const size_t n = std::min((size_t)RTA_PAYLOAD(a), sizeof(info));
+                    memcpy(&info, RTA_DATA(a), n);
+                    s.has_bytes_acked = n >= offsetof(TcpInfoExt, bytes_received);
+                    s.bytes_acked = info.bytes_acked;
+                    s.rtt_us = info.base.tcpi_rtt;
+                    s.rttvar_us = info.base.tcpi_rttvar;
+                    s.total_retrans = info.base.tcpi_total_retrans;
+                    const bool snd_wnd_known = n >= offsetof(TcpInfoExt, snd_wnd) + sizeof(info.snd_wnd);
+                    s.zero_window = (s.send_queue > 0 && info.base.tcpi_probes > 0) ||
+                                    (snd_wnd_known && (s.state == TCP_ESTABLISHED || s.state == TCP_FIN_WAIT1) && info.snd_wnd == 0);
+                }
+                out.push_back(std::move(s));
+            }
+        }
+    }
+    ::close(fd);
+    return true;
+}
+
+struct TransferFlow {
+    TcpFlowSample sample;
+    double acked_per_sec = 0;       // -1 when the kernel does not report bytes_acked
+    double retrans_per_sec = 0;
+    double zero_window_per_sec = 0; // Entries into zero window over the last interval
+    unsigned zero_windows = 0;      // Since the flow was first seen
+    double idle_sec = 0;            // Data queued with nothing acknowledged for this long
+    bool stalled = false;
+};
+
+// Rates need two dumps; flows are matched across dumps by socket cookie.
+class TransferMonitor {
+public:
+    static constexpr double STALL_SEC = 3;
+
+    bool poll(const std::vector<sockaddr_storage>& peers, int port, std::vector<TransferFlow>& out) {
+        std::vector<TcpFlowSample> samples;
+        out.clear();
+        if (!sock_diag_flows(peers, port, samples, m_error)) return false;
+
+        const auto now = clock::now();
+        std::unordered_map<uint64_t, Track> next;
+        for (auto& s : samples) {
+            TransferFlow f;
+            Track t{s, now, now, s.zero_window ? 1u : 0u};
+            auto it = m_tracks.find(s.cookie);
+            if (it != m_tracks.end()) {
+                const Track& prev = it->second;
+                const double dt = std::chrono::duration<double>(now - prev.at).count();
+                const bool moved = s.has_bytes_acked ? s.bytes_acked > prev.last.bytes_acked
+                                                     : s.send_queue < prev.last.send_queue;
+                t.progress = (moved || s.send_queue == 0) ? now : prev.progress;
+                const bool entered_zero = s.zero_window && !prev.last.zero_window;
+                t.zero_windows = prev.zero_windows + (entered_zero ? 1 : 0);
+                if (dt > 0) {
+                    f.acked_per_sec = s.has_bytes_acked ? (double)(s.bytes_acked - prev.last.bytes_acked) / dt : -1;
+                    f.retrans_per_sec = s.total_retrans >= prev.last.total_retrans
+                                            ? (s.total_retrans - prev.last.total_retrans) / dt : 0;
+                    f.zero_window_per_sec = entered_zero ? 1 / dt : 0;
+                }
+            } else if (!s.has_bytes_acked) {
+                f.acked_per_sec = -1;
+            }
+            f.zero_windows = t.zero_windows;
+            f.idle_sec = std::chrono::duration<double>(now - t.progress).count();
+            f.stalled = s.send_queue > 0 && f.idle_sec >= STALL_SEC;
+            f.sample = s;
+            next.emplace(s.cookie, std::move(t));
+            out.push_back(std::move(f));
+        }
+        m_tracks.swap(next);
+        return true;
+    }
+
+    const std::string& error() const { return m_error; }
+
+private:
+    using clock = std::chrono::steady_clock;
+    struct Track {
+        TcpFlowSample last;
+        clock::time_point at;
+        clock::time_point progress;   // Last time something was acknowledged (or nothing was queued)
+        unsigned zero_windows = 0;
+    };
+    std::unordered_map<uint64_t, Track> m_tracks;
+    std::string m_error;
+};
+
+static std::string transfer_stall_reason(const TransferFlow& f) {
+    if (f.sample.zero_window) return "printer is not reading (zero window)";
+    if (f.retrans_per_sec > 0) return "packets lost (retransmitting)";
+    return "no acknowledgements";
+}
+
+static std::string format_transfer_flow(const TransferFlow& f) {
+    const auto& s = f.sample;
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1) << s.local << " -> " << s.remote << " " << tcp_state_name(s.state)
+        << "  acked " << (f.acked_per_sec < 0 ? "?" : format_bytes((long long)f.acked_per_sec)) << "/s"
+        << "  sendq " << format_bytes(s.send_queue)
+        << "  rtt " << s.rtt_us / 1000.0 << "±" << s.rttvar_us / 1000.0 << " ms"
+        << "  retrans " << f.retrans_per_sec << "/s (" << s.total_retrans << ")"
+        << "  zero-win " << f.zero_window_per_sec << "/s (" << f.zero_windows << ")";
+    if (f.stalled) out << "  STALLED " << (int)f.idle_sec << " s: " << transfer_stall_reason(f);
+    return out.str();
+}
+
+// ============================================================
+// Shared status segment
+// - The running instance publishes its latest probe and queue state to POSIX
+//   shared memory (/hp_p1102w_status-<uid>); other tools read it (--status or
+//   read_shared_status()) instead of running their own lpstat/ping
+// - Seqlock: the writer makes seq odd, writes, then makes it even; readers copy
+//   and retry when seq was odd or moved. Readers never block the writer
+// - Only what the instance observes anyway is published, each with its own
+//   timestamp; nothing here probes the printer
+// ============================================================
+static const uint32_t STATUS_MAGIC   = 0x53445048;  // "HPDS"
+static const uint32_t STATUS_VERSION = 1;
+
+// Fixed layout shared with other processes; bump STATUS_VERSION on any change.
+struct SharedStatus {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;               // Seqlock counter, odd while a write is in progress
+    int32_t  writer_pid;        // 0 once the instance has exited
+    int64_t  updated_us;        // Times are microseconds since the epoch; 0 = never
+    int64_t  port_checked_us;
+    int64_t  ping_checked_us;
+    int64_t  queue_checked_us;
+    int64_t  event_us;
+    int32_t  port_open;         // 1 / 0, -1 unknown
+    int32_t  port_ms;           // Connect (or wake) time when open
+    int32_t  ping_ok;           // 1 / 0, -1 unknown
+    int32_t  queue_enabled;     // 1 / 0, -1 unknown
+    int32_t  jobs;              // Not-completed jobs, -1 unknown
+    int32_t  reserved;
+    char     host[64];          // NUL-terminated UTF-8
+    char     printer_state[160];
+    char     last_event[160];
+};
+static_assert(sizeof(SharedStatus) == 464, "SharedStatus layout is shared with other processes");
+static_assert(std::is_trivially_copyable<SharedStatus>::value, "SharedStatus is copied with memcpy");
+
+static std::string status_segment_name() {
+    return "/hp_p1102w_status-" + std::to_string(::getuid());
+}
+
+template <size_t N>
+static void copy_field(char (&dst)[N], const std::string& src) {
+    std::snprintf(dst, N, "%s", src.c_str());
+}
+
+// One not-completed job as last seen by the poll (owned copy for other threads).
+struct QueueEntry {
+    std::string job_id;
+    std::string user;
+    std::string status;
+    long long size_bytes = -1;
+};
+
+// Keeps the latest state in process (snapshot(), jobs()) and mirrors every change
+// into the segment once open() mapped it.
+class StatusPublisher {
+public:
+    // Called after each change, on the publishing thread.
+    using Listener = std::function<void(const SharedStatus& status, bool queue_changed)>;
+
+    static StatusPublisher& instance() {
+        static StatusPublisher publisher;
+        return publisher;
+    }
+
+    ~StatusPublisher() { close(); }
+
+    // GUI/service process only; the root helper never maps the segment.
+    // Returns false (state stays in process) while another live instance publishes.
+    bool open() {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if (m_seg) return true;
+
+        const std::string name = status_segment_name();
+        int fd = ::shm_open(name.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        if (::ftruncate(fd, sizeof(SharedStatus)) != 0) {
+            ::close(fd);
+            return false;
+        }
+        void* p = ::mmap(nullptr, sizeof(SharedStatus), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+
+        // The seqlock allows one writer: never take over a live instance's segment.
+        auto* seg = static_cast<SharedStatus*>(p);
+        const pid_t owner = __atomic_load_n(&seg->writer_pid, __ATOMIC_ACQUIRE);
+        if (seg->magic == STATUS_MAGIC && owner > 0 && owner != ::getpid() &&
+            (::kill(owner, 0) == 0 || errno == EPERM)) {
+            ::munmap(seg, sizeof(SharedStatus));
+            return false;
+        }
+
+        // A segment left by a crashed instance is reused; its seq keeps counting.
+        m_seg = seg;
+        m_local.writer_pid = (int32_t)::getpid();
+        mirror_locked();
+        return true;
+    }
+
+    // Marks the instance gone for readers that keep the mapping, then removes the
+    // name - only while the segment is still ours.
+    void close() {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if (!m_seg) return;
+        const bool ours = __atomic_load_n(&m_seg->writer_pid, __ATOMIC_ACQUIRE) == (int32_t)::getpid();
+        if (ours) {
+            m_local.writer_pid = 0;
+            mirror_locked();
+        }
+        ::munmap(m_seg, sizeof(SharedStatus));
+        m_seg = nullptr;
+        if (ours) ::shm_unlink(status_segment_name().c_str());
+    }
+
+    void set_listener(Listener listener) {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_listener = std::move(listener);
+    }
+
+    SharedStatus snapshot() const {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        return m_local;
+    }
+
+    std::vector<QueueEntry> jobs() const {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        return m_jobs;
+    }
+
+    void publish_host(const std::string& host) {
+        write([&](SharedStatus& s) { copy_field(s.host, host); });
+    }
+
+    void publish_port(bool open, long ms) {
+        write([&](SharedStatus& s) {
+            s.port_open = open ? 1 : 0;
+            s.port_ms = open ? (int32_t)ms : -1;
+            s.port_checked_us = journal_now_us();
+        });
+    }
+
+    void publish_ping(bool ok) {
+        write([&](SharedStatus& s) {
+            s.ping_ok = ok ? 1 : 0;
+            s.ping_checked_us = journal_now_us();
+        });
+    }
+
+    // printer_state is `lpstat -p` output ("" when unavailable).
+    void publish_queue(const JobSnapshot& jobs, const std::string& printer_state) {
+        const std::string first_line = trim_copy(printer_state.substr(0, printer_state.find('\n')));
+        std::vector<QueueEntry> entries;
+        entries.reserve(jobs.size());
+        for (const auto& j : jobs)
+            entries.push_back({std::string(j.job_id), std::string(j.user), std::string(j.status), j.size_bytes});
+
+        bool changed = false;
+        write([&](SharedStatus& s) {
+            s.jobs = (int32_t)entries.size();
+            if (!first_line.empty()) {
+                s.queue_enabled = printer_state.find("disabled") == std::string::npos ? 1 : 0;
+                copy_field(s.printer_state, first_line);
+            }
+            s.queue_checked_us = journal_now_us();
+
+            changed = entries.size() != m_jobs.size() ||
+                      !std::equal(entries.begin(), entries.end(), m_jobs.begin(),
+                                  [](const QueueEntry& a, const QueueEntry& b) {
+                                      return a.job_id == b.job_id && a.status == b.status;
+                                  });
+            if (changed) m_jobs = std::move(entries);
+            return changed;
+        });
+    }
+
+    void publish_event(const std::string& text) {
+        write([&](SharedStatus& s) {
+            copy_field(s.last_event, text);
+            s.event_us = journal_now_us();
+        });
+    }
+
+private:
+    StatusPublisher() {
+        m_local.magic = STATUS_MAGIC;
+        m_local.version = STATUS_VERSION;
+        m_local.port_open = m_local.ping_ok = m_local.queue_enabled = m_local.jobs = -1;
+    }
+
+    // fn may return true to flag a queue change for the listener.
+    template <class Fn>
+    void write(Fn&& fn) {
+        Listener listener;
+        SharedStatus copy;
+        bool queue_changed = false;
+        {
+            std::lock_guard<std::mutex> lk(m_mutex);
+            if constexpr (std::is_same<decltype(fn(m_local)), bool>::value) queue_changed = fn(m_local);
+            else fn(m_local);
+            m_local.updated_us = journal_now_us();
+            mirror_locked();
+            listener = m_listener;
+            copy = m_local;
+        }
+        if (listener) listener(copy, queue_changed);
+    }
+
+    // Seqlock write of m_local into the segment. Plain fields plus __atomic builtins
+    // on seq: std::atomic members would make the struct non-copyable and its
+    // layout implementation-defined.
+    void mirror_locked() {
+        if (!m_seg) return;
+        const uint32_t seq = __atomic_load_n(&m_seg->seq, __ATOMIC_RELAXED) | 1u;
+        __atomic_store_n(&m_seg->seq, seq, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        SharedStatus out = m_local;
+        out.seq = seq;
+        std::memcpy((void*)m_seg, &out, sizeof(out));
+        __atomic_store_n(&m_seg->seq, seq + 1, __ATOMIC_RELEASE);
+    }
+
+    mutable std::mutex m_mutex;
+    SharedStatus m_local{};
+    std::vector<QueueEntry> m_jobs;
+    Listener m_listener;
+    SharedStatus* m_seg = nullptr;
+};
+
+// Consistent copy of the running instance's status; false when none publishes.
+// Once mapped, a read is plain memory loads (no syscalls).
+static bool read_shared_status(SharedStatus& out) {
+    static const SharedStatus* seg = nullptr;
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (!seg) {
+            int fd = ::shm_open(status_segment_name().c_str(), O_RDONLY | O_CLOEXEC, 0);
+            if (fd < 0) return false;
+            struct stat st{};
+            void* p = MAP_FAILED;
+            if (::fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(SharedStatus))
+                p = ::mmap(nullptr, sizeof(SharedStatus), PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (p == MAP_FAILED) return false;
+            seg = static_cast<const SharedStatus*>(p);
+        }
+
+        bool copied = false;
+        for (int spin = 0; spin < 100000 && !copied; ++spin) {
+            const uint32_t before = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+            if (before & 1u) continue;
+            std::memcpy(&out, (const void*)seg, sizeof(out));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            copied = __atomic_load_n(&seg->seq, __ATOMIC_RELAXED) == before;
+        }
+        if (!copied || out.magic != STATUS_MAGIC || out.version != STATUS_VERSION) return false;
+        if (out.writer_pid != 0) return true;
+
+        // That instance exited; a newer one may have published under the same name.
+        ::munmap((void*)seg, sizeof(SharedStatus));
+        seg = nullptr;
+    }
+    return false;
+}
+
+// key=value lines with ages in seconds (--status, support bundle).
+static std::string format_shared_status(const SharedStatus& st) {
+    const int64_t now_us = journal_now_us();
+    auto age = [now_us](int64_t at_us) {
+        if (at_us == 0) return std::string("never");
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(1) << (double)(now_us - at_us) / 1e6;
+        return out.str();
+    };
+    auto field = [](const char* text, size_t cap) { return std::string(text, strnlen(text, cap)); };
+
+    std::ostringstream out;
+    out << "pid=" << st.writer_pid << "\n"
+        << "host=" << field(st.host, sizeof(st.host)) << "\n"
+        << "updated_age_s=" << age(st.updated_us) << "\n"
+        << "port_open=" << st.port_open << "\n"
+        << "port_ms=" << st.port_ms << "\n"
+        << "port_age_s=" << age(st.port_checked_us) << "\n"
+        << "ping_ok=" << st.ping_ok << "\n"
+        << "ping_age_s=" << age(st.ping_checked_us) << "\n"
+        << "queue_enabled=" << st.queue_enabled << "\n"
+        << "jobs=" << st.jobs << "\n"
+        << "queue_age_s=" << age(st.queue_checked_us) << "\n"
+        << "printer_state=" << field(st.printer_state, sizeof(st.printer_state)) << "\n"
+        << "last_event=" << field(st.last_event, sizeof(st.last_event)) << "\n"
+        << "last_event_age_s=" << age(st.event_us) << "\n";
+    return out.str();
+}
+
+// ============================================================
+// Job latency tracker
+// - Follows every real job on PRINTER_NAME through its state changes
+// - Completed jobs land in metrics.csv keyed "<user>/<size bucket>", timed
+//   from CUPS's time-at-creation/processing/completed (ipptool Get-Jobs)
+// - Own 2 s poll; the queue manager adds sightings via observe()
+// - A second worker checks the queue's device URI every 30 s and publishes
+//   drift as an event; its probes (seconds when the printer sleeps) never
+//   delay the job poll
+// - While jobs are queued each poll samples the sockets to printer:9100
+//   (sock_diag) and publishes a stalled transfer as an event
+// ============================================================
+static std::string size_bucket(long long bytes) {
+    if (bytes < 0) return "unknown";
+    if (bytes < 100 * 1024) return "<100KB";
+    if (bytes < 1024 * 1024) return "100KB-1MB";
+    if (bytes < 10 * 1024 * 1024) return "1-10MB";
+    return ">10MB";
+}
+
+class JobLatencyTracker {
+public:
+    JobLatencyTracker() = default;
+    ~JobLatencyTracker() { stop(); }
+
+    void start() {
+        if (m_thread.joinable()) return;
+        m_stop = false;
+        m_completed_mark = std::time(nullptr);  // Jobs finished before start are history, not samples
+        m_thread = std::thread([this]() { poll_loop(); });
+        m_uri_thread = std::thread([this]() { uri_loop(); });
+    }
+
+    void stop() {
+        if (!m_thread.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lk(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        m_thread.join();
+        m_uri_thread.join();
+    }
+
+    // Bumped whenever the job list or printer state changes; cheap queue fingerprint.
+    uint64_t generation() const { return m_generation.load(); }
+
+    // jobs must be the full not-completed list; printer_state is `lpstat -p` output or "".
+    void observe(const JobSnapshot& jobs, const std::string& printer_state) {
+        const auto now = std::chrono::system_clock::now();
+        const std::string prefix = PRINTER_NAME + "-";
+        std::lock_guard<std::mutex> lk(m_mutex);
+
+        std::string signature;
+        for (const auto& j : jobs) signature.append(j.job_id).append(" ").append(j.status) += '\n';
+        if (!printer_state.empty()) m_last_state = printer_state;
+        signature += m_last_state;
+        if (signature != m_last_signature) {
+            m_last_signature = signature;
+            ++m_generation;
+        }
+
+        std::set<std::string> present;
+        for (const auto& j : jobs) {
+            if (j.job_id.substr(0, prefix.size()) != prefix) continue;
+            const std::string id(j.job_id);
+            present.insert(id);
+            auto it = m_live.find(id);
+            if (it == m_live.end()) {
+                Tracked t;
+                t.user = j.user;
+                t.size_bytes = j.size_bytes;
+                t.submitted = j.submitted_at.value_or(now);
+                it = m_live.emplace(id, t).first;
+            }
+            if (!it->second.processing && printer_state.find("now printing " + id + ".") != std::string::npos)
+                it->second.processing = now;
+        }
+
+        for (auto it = m_live.begin(); it != m_live.end();) {
+            if (present.count(it->first)) {
+                ++it;
+                continue;
+            }
+            // CUPS's own timestamps record it (see record_completed); without ipptool,
+            // fall back to the sightings, which only time jobs seen printing.
+            ++m_vanished;
+            if (!m_ipp_times && it->second.processing) {
+                const Tracked& t = it->second;
+                record(t.user, t.size_bytes, t.submitted, t.processing, now);
+            }
+            it = m_live.erase(it);
+        }
+    }
+
+private:
+    struct Tracked {
+        std::string user;
+        long long size_bytes = -1;
+        std::chrono::system_clock::time_point submitted;
+        std::optional<std::chrono::system_clock::time_point> processing;
+    };
+
+    std::map<std::string, Tracked> m_live;
+    uint64_t m_vanished = 0;                 // Jobs that left the not-completed list
+    std::atomic<bool> m_ipp_times{true};     // Cleared when ipptool cannot report job times
+    std::time_t m_completed_mark = 0;        // Poll thread only: newest time-at-completed recorded
+    std::set<int> m_recorded_at_mark;        // Poll thread only: ids recorded with that time
+    std::string m_last_state;
+    std::string m_last_signature;
+    std::atomic<uint64_t> m_generation{0};
+    std::string m_uri_event;   // URI thread only
+    TransferMonitor m_transfer;  // Poll thread only
+    bool m_stalled = false;      // Poll thread only
+    std::thread m_thread;
+    std::thread m_uri_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stop = false;
+
+    using TimePoint = std::chrono::system_clock::time_point;
+
+    // The queue/print split needs the processing time; the total is always recorded.
+    static void record(const std::string& user, long long size_bytes, TimePoint submitted,
+                       std::optional<TimePoint> processing, TimePoint done) {
+        auto ms = [](std::chrono::system_clock::duration d) {
+            return std::max(0.0, std::chrono::duration<double, std::milli>(d).count());
+        };
+        const std::string key = user + "/" + size_bucket(size_bytes);
+        if (processing) {
+            metrics_append("job_queue_ms", key, ms(*processing - submitted));
+            metrics_append("job_print_ms", key, ms(done - *processing));
+        }
+        metrics_append("job_total_ms", key, ms(done - submitted));
+    }
+
+    // Records every job CUPS completed since the last call from its own
+    // time-at-creation/processing/completed, including jobs that finished
+    // between two polls or were never seen printing. Cancelled and aborted jobs are skipped.
+    void record_completed(CupsClient& cups) {
+        const auto jobs = cups.completed_jobs(50);
+        if (!jobs) {
+            m_ipp_times = false;
+            return;
+        }
+        std::time_t newest = m_completed_mark;
+        std::set<int> at_newest = m_recorded_at_mark;
+        for (const auto& j : *jobs) {
+            if (j.state != 9 || j.completed < m_completed_mark || j.created <= 0) continue;
+            if (j.completed == m_completed_mark && m_recorded_at_mark.count(j.id)) continue;
+
+            auto at = [](std::time_t t) { return std::chrono::system_clock::from_time_t(t); };
+            std::optional<TimePoint> processing;
+            if (j.processing > 0) processing = at(j.processing);
+            record(j.user, j.size_bytes, at(j.created), processing, at(j.completed));
+
+            if (j.completed > newest) {
+                newest = j.completed;
+                at_newest.clear();
+            }
+            if (j.completed == newest) at_newest.insert(j.id);
+        }
+        m_completed_mark = newest;
+        m_recorded_at_mark = std::move(at_newest);
+    }
+
+    // Logs and publishes only changes, so a move is reported once.
+    void watch_device_uri(CupsClient& cups) {
+        const DeviceUriCheck c = check_device_uri_drift(cups.device_uri(), printer_host());
+        const bool drift = c.state == DeviceUriCheck::State::Drift;
+        const bool unconfirmed = c.state == DeviceUriCheck::State::Unconfirmed;
+        const std::string event = drift         ? "Device URI drift: " + c.summary()
+                                  : unconfirmed ? "Device URI mismatch (port 9100 closed at both): " + c.summary()
+                                                : "";
+        if (event == m_uri_event) return;
+
+        if (drift) {
+            journal_probe("device_uri", c.summary() + "; re-point to " + c.suggested_uri);
+            StatusPublisher::instance().publish_event(event);
+        } else if (unconfirmed) {
+            journal_probe("device_uri", c.summary() + "; port 9100 closed at both, not suggesting a re-point");
+            StatusPublisher::instance().publish_event(event);
+        } else {
+            journal_probe("device_uri", "drift cleared: " + c.summary());
+            StatusPublisher::instance().publish_event("Device URI OK: " + c.summary());
+        }
+        m_uri_event = event;
+    }
+
+    // Journals and publishes when a stall starts and when it ends.
+    void watch_transfer() {
+        std::vector<TransferFlow> flows;
+        if (!m_transfer.poll(AddressCache::instance().lookup(printer_host()), PRINTER_PORT, flows)) return;
+        const TransferFlow* stalled = nullptr;
+        for (const auto& f : flows)
+            if (f.stalled) stalled = &f;
+        if ((stalled != nullptr) == m_stalled) return;
+
+        m_stalled = stalled != nullptr;
+        if (stalled) {
+            journal_probe("transfer", format_transfer_flow(*stalled));
+            StatusPublisher::instance().publish_event("Transfer stalled: " + transfer_stall_reason(*stalled));
+        } else {
+            journal_probe("transfer", "stall cleared");
+            StatusPublisher::instance().publish_event(flows.empty() ? "Transfer ended" : "Transfer resumed");
+        }
+    }
+
+    void poll_loop() {
+        CupsClient cups(
+            [](const std::string& cmd) { int code = 0; return run_shell_capture(cmd, code); },
+            [](const std::string&) { return false; });
+
+        static constexpr unsigned COMPLETED_CHECK_POLLS = 15;
+        unsigned polls = 0;
+        uint64_t vanished_seen = 0;
+        std::unique_lock<std::mutex> lk(m_mutex);
+        while (!m_stop) {
+            lk.unlock();
+            try {
+                std::string state = cups.printer_state_raw();
+                const auto jobs = cups.get_jobs();
+                observe(jobs, state);
+                // After a job leaves the queue (also via the queue manager's sightings),
+                // and every 30 s for jobs that came and went between two polls.
+                lk.lock();
+                const uint64_t vanished = m_vanished;
+                lk.unlock();
+                const bool periodic = polls++ % COMPLETED_CHECK_POLLS == 0;
+                if (m_ipp_times && (vanished != vanished_seen || periodic)) record_completed(cups);
+                vanished_seen = vanished;
+                StatusPublisher::instance().publish_queue(jobs, state);
+                if (!jobs.empty() || m_stalled) watch_transfer();
+            } catch (...) {
+                // Non-fatal: try again next tick
+            }
+            lk.lock();
+            m_cv.wait_for(lk, std::chrono::seconds(2), [this]() { return m_stop; });
+        }
+    }
+
+    void uri_loop() {
+        static constexpr auto URI_CHECK_PERIOD = std::chrono::seconds(30);
+        CupsClient cups(
+            [](const std::string& cmd) { int code = 0; return run_shell_capture(cmd, code); },
+            [](const std::string&) { return false; });
+
+        std::unique_lock<std::mutex> lk(m_mutex);
+        while (!m_stop) {
+            lk.unlock();
+            try {
+                watch_device_uri(cups);
+            } catch (...) {
+                // Non-fatal: try again next period
+            }
+            lk.lock();
+            m_cv.wait_for(lk, URI_CHECK_PERIOD, [this]() { return m_stop; });
+        }
+    }
+};
+
+// Rolling p50/p90 per user and per size bucket over the most recent samples.
+static std::vector<std::string> job_latency_report(size_t window) {
+    struct Group { std::vector<double> queue, print, total; };
+    std::map<std::string, Group> by_user, by_size;
+
+    auto add = [&](const std::string& metric, std::vector<double> Group::*field) {
+        for (const auto& s : metrics_recent(metric, window)) {
+            auto slash = s.key.rfind('/');
+            std::string user = s.key.substr(0, slash);
+            std::string bucket = slash == std::string::npos ? "unknown" : s.key.substr(slash + 1);
+            (by_user[user].*field).push_back(s.value);
+            (by_size[bucket].*field).push_back(s.value);
+        }
+    };
+    add("job_queue_ms", &Group::queue);
+    add("job_print_ms", &Group::print);
+    add("job_total_ms", &Group::total);
+
+    std::vector<std::string> lines;
+    auto table = [&](const std::string& title, const std::map<std::string, Group>& groups) {
+        lines.push_back(title);
+        for (const auto& g : groups) {
+            std::ostringstream oss;
+            oss << std::fixed << std::setprecision(1) << "  " << std::left << std::setw(14) << g.first
+                << std::right << std::setw(4) << g.second.total.size() << " jobs"
+                << "  queue p50/p90 " << percentile(g.second.queue, 50) / 1000 << "/" << percentile(g.second.queue, 90) / 1000 << " s"
+                << "  print " << percentile(g.second.print, 50) / 1000 << "/" << percentile(g.second.print, 90) / 1000 << " s"
+                << "  total " << percentile(g.second.total, 50) / 1000 << "/" << percentile(g.second.total, 90) / 1000 << " s";
+            lines.push_back(oss.str());
+        }
+    };
+    if (by_user.empty()) return lines;
+    table("By user:", by_user);
+    table("By size:", by_size);
+
+    // Trend: newer half against older half of the window.
+    auto totals = metrics_recent("job_total_ms", window);
+    if (totals.size() >= 10) {
+        std::vector<double> older, newer;
+        for (size_t i = 0; i < totals.size(); ++i)
+            (i < totals.size() / 2 ? older : newer).push_back(totals[i].value);
+        double a = percentile(older, 50), b = percentile(newer, 50);
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(1) << "Trend: median total " << a / 1000 << " s -> " << b / 1000 << " s";
+        if (a > 0 && b > a * 1.5) oss << "  (SLOWER - printer or network degrading)";
+        lines.push_back(oss.str());
+    }
+    return lines;
+}
+
+// ============================================================
+// Continuous wake scheduler
+// - Independent of the main window so wake keeps running in background mode
+// ============================================================
+enum class WakeMode { Interval, OnJobArrival };
+
+static WakeMode wake_mode_from_string(const std::string& s) {
+    return s == "on_job" ? WakeMode::OnJobArrival : WakeMode::Interval;
+}
+
+class WakeScheduler {
+public:
+    explicit WakeScheduler(std::function<bool(const std::string&)> privileged)
+        : m_privileged(std::move(privileged)) {}
+
+    ~WakeScheduler() {
+        stop();
+        if (m_wake_thread.joinable()) m_wake_thread.join();
+    }
+
+    // Starts, restarts or stops the timer / job watcher to match the settings.
+    void configure(bool enabled, int interval_minutes, WakeMode mode) {
+        if (enabled == m_enabled && interval_minutes == m_interval_minutes &&
+            mode == m_mode && active() == enabled) return;
+        m_enabled = enabled;
+        m_interval_minutes = interval_minutes;
+        m_mode = mode;
+
+        stop();
+        if (m_enabled && m_mode == WakeMode::Interval && m_interval_minutes > 0) {
+            m_timer_conn = Glib::signal_timeout().connect_seconds([this]() -> bool {
+                wake_now();
+                return true;  // Keep running
+            }, m_interval_minutes * 60);
+        } else if (m_enabled && m_mode == WakeMode::OnJobArrival) {
+            m_watch_stop = false;
+            m_watch_thread = std::thread([this]() { watch_loop(); });
+        }
+        notify();
+    }
+
+    void stop() {
+        if (m_timer_conn.connected()) m_timer_conn.disconnect();
+        if (m_watch_thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lk(m_watch_mutex);
+                m_watch_stop = true;
+            }
+            m_watch_cv.notify_all();
+            m_watch_thread.join();
+        }
+    }
+
+    // Timer tick: races the wake strategies on a worker, keeping the UI responsive.
+    void wake_now() { start_wake("Timer", nullptr); }
+
+    // Wake button and D-Bus Wake(): same worker race; done gets the result on
+    // the main loop. Returns false while another race is still running.
+    bool wake_async(const std::string& label, std::function<void(const WakeResult&)> done) {
+        return start_wake(label, std::move(done));
+    }
+
+    const WakeEngine& engine() const { return *m_engine; }
+
+    // On-job mode: pause the queue while the printer wakes. Opt-in, because the
+    // pause goes through pkexec from a background thread, so a polkit prompt can
+    // appear without any user action (once per session at most).
+    void set_hold_queue(bool hold) { m_hold_queue = hold; }
+
+    // Printer address changed: rebuild the engine (its stats are kept per host).
+    void set_host(const std::string& host) {
+        if (host == m_engine->host()) return;
+        stop();
+        if (m_wake_thread.joinable()) m_wake_thread.join();
+        m_engine = std::make_unique<WakeEngine>(host);
+        configure(m_enabled, m_interval_minutes, m_mode);
+    }
+
+    bool active() const {
+        if (!m_enabled) return false;
+        return m_mode == WakeMode::Interval ? m_timer_conn.connected() : m_watch_thread.joinable();
+    }
+    WakeMode mode() const { return m_mode; }
+    int interval_minutes() const { return m_interval_minutes; }
+    std::optional<std::time_t> last_wake() const { return m_last_wake; }
+    const std::string& last_event() const { return m_last_event; }
+
+    // One listener at a time (the window or the tray icon).
+    void set_on_status(std::function<void()> cb) { m_on_status = std::move(cb); }
+
+private:
+    static constexpr int WATCH_PERIOD_SEC = 3;
+    static constexpr int HOLD_MAX_MS      = 15000;
+    static constexpr int WAKE_TIMEOUT_MS  = 10000;
+
+    std::function<bool(const std::string&)> m_privileged;
+    std::unique_ptr<WakeEngine> m_engine = std::make_unique<WakeEngine>(printer_host());
+    std::atomic<bool> m_hold_queue{false};
+
+    // Timer-driven wake races
+    std::thread m_wake_thread;
+    std::atomic<bool> m_wake_busy{false};
+
+    bool m_enabled = false;
+    int m_interval_minutes = 0;
+    WakeMode m_mode = WakeMode::Interval;
+    sigc::connection m_timer_conn;
+    std::optional<std::time_t> m_last_wake;
+    std::string m_last_event;
+    std::function<void()> m_on_status;
+
+    // On-demand watcher (worker thread; results are posted to the main loop)
+    std::thread m_watch_thread;
+    std::mutex m_watch_mutex;
+    std::condition_variable m_watch_cv;
+    bool m_watch_stop = false;
+
+    void notify() {
+        if (m_on_status) m_on_status();
+    }
+
+    bool start_wake(const std::string& label, std::function<void(const WakeResult&)> done) {
+        if (m_wake_busy) return false;
+        if (m_wake_thread.joinable()) m_wake_thread.join();
+
+        m_wake_busy = true;
+        m_wake_thread = std::thread([this, label, done]() {
+            WakeResult res = m_engine->race(WAKE_TIMEOUT_MS);
+            StatusPublisher::instance().publish_port(res.awake, res.ms);
+            if (res.already_awake) m_engine->keepalive();
+            post_event(label + ": " + describe_wake(res), true);
+            m_wake_busy = false;
+            if (done) run_on_main([done, res]() { done(res); });
+        });
+        return true;
+    }
+
+    // Sleeps on the stop flag; returns false when asked to stop.
+    bool watch_sleep(std::chrono::milliseconds d) {
+        std::unique_lock<std::mutex> lk(m_watch_mutex);
+        return !m_watch_cv.wait_for(lk, d, [this]() { return m_watch_stop; });
+    }
+
+    void post_event(const std::string& text, bool woke) {
+        journal_probe("wake", text);
+        StatusPublisher::instance().publish_event(text);
+        std::time_t now = std::time(nullptr);
+        run_on_main([this, text, woke, now]() {
+            if (woke) m_last_wake = now;
+            m_last_event = text;
+            notify();
+        });
+    }
+
+    void watch_loop() {
+        CupsClient cups(
+            [](const std::string& cmd) { int code = 0; return run_shell_capture(cmd, code); },
+            m_privileged);
+
+        // Only this printer's queue; jobs already queued when watching starts are
+        // not arrivals (the first poll just seeds the set).
+        const std::string prefix = PRINTER_NAME + "-";
+        std::set<std::string> seen;
+        bool seeded = false;
+        do {
+            std::vector<std::string> arrived;
+            std::set<std::string> current;
+            for (const auto& j : cups.get_jobs()) {
+                if (j.job_id.substr(0, prefix.size()) != prefix) continue;
+                const std::string id(j.job_id);
+                if (seeded && !seen.count(id)) arrived.push_back(id);
+                current.insert(id);
+            }
+            seen.swap(current);
+            seeded = true;
+
+            if (!arrived.empty()) handle_arrival(cups, arrived.front());
+        } while (watch_sleep(std::chrono::seconds(WATCH_PERIOD_SEC)));
+    }
+
+    // A job showed up: make sure port 9100 accepts before CUPS's backend gives up.
+    void handle_arrival(CupsClient& cups, const std::string& job_id) {
+        const auto started = std::chrono::steady_clock::now();
+        if (tcp_connect_probe(m_engine->host(), PRINTER_PORT, 1000) == 0) {
+            StatusPublisher::instance().publish_port(
+                true, (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::steady_clock::now() - started).count());
+            post_event("Job " + job_id + ": printer already awake", false);
+            return;
+        }
+
+        // Hold the queue so the backend is not stuck in CUPS's slow retry loop (opt-in,
+        // see set_hold_queue). Never touch a queue somebody else paused.
+        bool held = false;
+        if (m_hold_queue && !cups.queue_disabled()) held = cups.pause_queue();
+
+        WakeResult res = m_engine->race(HOLD_MAX_MS, [this]() {
+            std::lock_guard<std::mutex> lk(m_watch_mutex);
+            return m_watch_stop;
+        });
+
+        if (held) cups.resume_queue();
+        StatusPublisher::instance().publish_port(res.awake, res.ms);
+
+        std::string text = "Job " + job_id + ": " + describe_wake(res);
+        if (held) text += " (queue held and released)";
+        post_event(text, true);
+    }
+};
+
+// Process-level settings shared by the GUI and --service (the window applies its own).
+static void apply_service_config(WakeScheduler& wake, const AppConfig& cfg) {
+    set_printer_host(cfg.printer_host);
+    StatusPublisher::instance().publish_host(printer_host());
+    AddressCache::instance().prefetch(printer_host());
+    wake.set_host(printer_host());
+    wake.set_hold_queue(cfg.wake_hold_queue);
+    wake.configure(cfg.wake_enabled, cfg.wake_interval_minutes, wake_mode_from_string(cfg.wake_mode));
+}
+
+// ============================================================
+// D-Bus service
+// - Owns org.hp.P1102w.Diagnostic on the session bus, from the GUI or --service
+// - Reads come from the StatusPublisher snapshot; probes and cancel run on one
+//   worker thread, Wake() on the scheduler's own race
+// - PrinterStateChanged / QueueChanged follow the published status
+// ============================================================
+static const char* DBUS_NAME      = "org.hp.P1102w.Diagnostic";
+static const char* DBUS_PATH      = "/org/hp/P1102w/Diagnostic";
+static const char* DBUS_INTERFACE = "org.hp.P1102w.Diagnostic1";
+
+// Tri-state fields (port_open, ping_ok, queue_enabled) are -1 while unknown.
+static const char* DBUS_INTROSPECTION = R"XML(
+<node>
+  <interface name="org.hp.P1102w.Diagnostic1">
+    <method name="GetStatus">
+      <arg type="a{ss}" name="status" direction="out"/>
+    </method>
+    <method name="QuickTest">
+      <arg type="u" name="max_age_s" direction="in"/>
+      <arg type="i" name="port_open" direction="out"/>
+      <arg type="i" name="connect_ms" direction="out"/>
+      <arg type="b" name="cached" direction="out"/>
+    </method>
+    <method name="FullDiagnostic">
+      <arg type="u" name="max_age_s" direction="in"/>
+      <arg type="a{ss}" name="results" direction="out"/>
+    </method>
+    <method name="GetQueue">
+      <arg type="aa{ss}" name="jobs" direction="out"/>
+    </method>
+    <method name="CancelJob">
+      <arg type="s" name="job_id" direction="in"/>
+    </method>
+    <method name="Wake">
+      <arg type="b" name="awake" direction="out"/>
+      <arg type="i" name="ms" direction="out"/>
+      <arg type="s" name="summary" direction="out"/>
+    </method>
+    <signal name="PrinterStateChanged">
+      <arg type="i" name="port_open"/>
+      <arg type="i" name="queue_enabled"/>
+      <arg type="s" name="printer_state"/>
+    </signal>
+    <signal name="QueueChanged">
+      <arg type="i" name="jobs"/>
+    </signal>
+  </interface>
+</node>
+)XML";
+
+// CUPS job ids are "<queue>-<number>"; anything else never reaches the shell.
+static bool valid_job_id(const std::string& id) {
+    const size_t dash = id.rfind('-');
+    if (dash == std::string::npos || dash == 0 || dash + 1 == id.size() || id.size() > 128) return false;
+    for (size_t i = 0; i < dash; ++i) {
+        const char c = id[i];
+        if (!std::isalnum((unsigned char)c) && c != '_' && c != '.' && c != '-') return false;
+    }
+    for (size_t i = dash + 1; i < id.size(); ++i)
+        if (!std::isdigit((unsigned char)id[i])) return false;
+    return true;
+}
+
+class DBusService {
+public:
+    using Dict = std::map<Glib::ustring, Glib::ustring>;
+
+    explicit DBusService(WakeScheduler& wake) : m_wake(wake) {}
+    ~DBusService() { stop(); }
+
+    // on_name_acquired runs once this process owns the name; on_name_lost when the
+    // bus is unreachable or another instance owns it.
+    void start(std::function<void()> on_name_lost = nullptr, std::function<void()> on_name_acquired = nullptr) {
+        if (m_owner_id) return;
+        m_on_name_lost = std::move(on_name_lost);
+        m_on_name_acquired = std::move(on_name_acquired);
+        m_alive = std::make_shared<bool>(true);
+        m_worker_stop = false;
+        m_worker = std::thread([this]() { worker_loop(); });
+
+        try {
+            m_node = Gio::DBus::NodeInfo::create_for_xml(DBUS_INTROSPECTION);
+        } catch (const Glib::Error& e) {
+            std::cerr << "D-Bus introspection: " << e.what_s() << "\n";
+            return;
+        }
+
+        std::weak_ptr<bool> alive = m_alive;
+        StatusPublisher::instance().set_listener([this, alive](const SharedStatus& s, bool queue_changed) {
+            run_on_main([this, alive, s, queue_changed]() {
+                if (alive.lock()) on_status(s, queue_changed);
+            });
+        });
+
+        m_owner_id = Gio::DBus::own_name(
+            Gio::DBus::BUS_TYPE_SESSION, DBUS_NAME,
+            [this](const Glib::RefPtr<Gio::DBus::Connection>& conn, Glib::ustring) { on_bus_acquired(conn); },
+            [this](const Glib::RefPtr<Gio::DBus::Connection>&, Glib::ustring) {
+                if (m_on_name_acquired) m_on_name_acquired();
+                m_on_name_acquired = nullptr;
+            },
+            [this](const Glib::RefPtr<Gio::DBus::Connection>&, Glib::ustring name) {
+                std::cerr << "D-Bus: could not own " << name << " (bus unavailable or name taken)\n";
+                m_connection.reset();
+                if (m_on_name_lost) m_on_name_lost();
+            });
+    }
+
+    void stop() {
+        if (m_owner_id) {
+            StatusPublisher::instance().set_listener(nullptr);
+            if (m_connection && m_registration_id) m_connection->unregister_object(m_registration_id);
+            Gio::DBus::unown_name(m_owner_id);
+            m_owner_id = 0;
+            m_registration_id = 0;
+            m_connection.reset();
+        }
+        m_alive.reset();  // Drops wake replies still queued on the main loop
+        if (m_worker.joinable()) {
+            {
+                std::lock_guard<std::mutex> lk(m_task_mutex);
+                m_worker_stop = true;
+            }
+            m_task_cv.notify_all();
+            m_worker.join();
+        }
+    }
+
+private:
+    // Calls queued behind slow probes beyond this limit fail fast.
+    static constexpr size_t MAX_PENDING_TASKS = 16;
+    static constexpr int PROBE_TIMEOUT_MS     = 3000;
+
+    WakeScheduler& m_wake;
+    std::function<void()> m_on_name_lost;
+    std::function<void()> m_on_name_acquired;
+    guint m_owner_id = 0;
+    guint m_registration_id = 0;
+    Glib::RefPtr<Gio::DBus::Connection> m_connection;
+    Glib::RefPtr<Gio::DBus::NodeInfo> m_node;
+    // Registered by pointer, so it lives as long as the service.
+    Gio::DBus::InterfaceVTable m_vtable{sigc::mem_fun(*this, &DBusService::on_method_call)};
+    std::shared_ptr<bool> m_alive;
+
+    // Last state announced through PrinterStateChanged / QueueChanged
+    int m_sent_port = -2, m_sent_enabled = -2, m_sent_jobs = -2;
+    std::string m_sent_state;
+
+    // Worker (GDBus allows replying from any thread)
+    std::thread m_worker;
+    std::mutex m_task_mutex;
+    std::condition_variable m_task_cv;
+    std::deque<std::function<void()>> m_tasks;
+    bool m_worker_stop = false;
+
+    void on_bus_acquired(const Glib::RefPtr<Gio::DBus::Connection>& conn) {
+        try {
+            m_registration_id = conn->register_object(DBUS_PATH, m_node->lookup_interface(DBUS_INTERFACE), m_vtable);
+            m_connection = conn;
+            journal_probe("dbus", std::string("registered ") + DBUS_NAME);
+        } catch (const Glib::Error& e) {
+            std::cerr << "D-Bus register_object: " << e.what_s() << "\n";
+        }
+    }
+
+    void on_method_call(const Glib::RefPtr<Gio::DBus::Connection>&, const Glib::ustring& sender,
+                        const Glib::ustring&, const Glib::ustring&, const Glib::ustring& method,
+                        const Glib::VariantContainerBase& params,
+                        const Glib::RefPtr<Gio::DBus::MethodInvocation>& invocation) {
+        if (method == "GetStatus") {
+            invocation->return_value(tuple(Glib::Variant<Dict>::create(status_dict(StatusPublisher::instance().snapshot()))));
+        } else if (method == "GetQueue") {
+            std::vector<Dict> jobs;
+            for (const auto& j : StatusPublisher::instance().jobs())
+                jobs.push_back({{"id", j.job_id}, {"user", j.user}, {"status", j.status},
+                                {"size_bytes", std::to_string(j.size_bytes)}});
+            invocation->return_value(tuple(Glib::Variant<std::vector<Dict>>::create(jobs)));
+        } else if (method == "QuickTest" || method == "FullDiagnostic") {
+            const bool full = method == "FullDiagnostic";
+            const long long max_age_us = (long long)uint_param(params) * 1000000LL;
+            if (!fresh(StatusPublisher::instance().snapshot(), max_age_us, full)) {
+                post_task(invocation, [this, invocation, full]() {
+                    probe(full);
+                    reply_test(invocation, StatusPublisher::instance().snapshot(), full, false);
+                });
+            } else {
+                reply_test(invocation, StatusPublisher::instance().snapshot(), full, true);
+            }
+        } else if (method == "CancelJob") {
+            Glib::Variant<Glib::ustring> id_v;
+            params.get_child(id_v, 0);
+            const std::string id = id_v.get();
+            if (!valid_job_id(id)) {
+                invocation->return_error(Gio::DBus::Error(Gio::DBus::Error::INVALID_ARGS, "Not a CUPS job id: " + id));
+                return;
+            }
+            journal_probe("dbus", std::string(sender) + " cancels job " + id);
+            post_task(invocation, [invocation, id]() {
+                int code = 0;
+                const std::string out = trim_copy(run_shell_capture("cancel " + shell_quote(id) + " 2>&1", code));
+                if (code == 0) invocation->return_value(tuple(std::vector<Glib::VariantBase>()));
+                else invocation->return_error(Gio::DBus::Error(Gio::DBus::Error::FAILED,
+                                                               out.empty() ? "cancel failed" : out));
+            });
+        } else if (method == "Wake") {
+            std::weak_ptr<bool> alive = m_alive;
+            const bool started = m_wake.wake_async("D-Bus", [alive, invocation](const WakeResult& res) {
+                if (!alive.lock()) return;
+                invocation->return_value(tuple({Glib::Variant<bool>::create(res.awake),
+                                                Glib::Variant<int>::create((int)res.ms),
+                                                Glib::Variant<Glib::ustring>::create(describe_wake(res))}));
+            });
+            if (!started)
+                invocation->return_error(Gio::DBus::Error(Gio::DBus::Error::FAILED, "A wake is already in progress"));
+        } else {
+            invocation->return_error(Gio::DBus::Error(Gio::DBus::Error::UNKNOWN_METHOD, "No method " + method));
+        }
+    }
+
+    static Glib::VariantContainerBase tuple(std::vector<Glib::VariantBase> children) {
+        return Glib::VariantContainerBase::create_tuple(children);
+    }
+    static Glib::VariantContainerBase tuple(const Glib::VariantBase& child) {
+        return Glib::VariantContainerBase::create_tuple(child);
+    }
+
+    static guint32 uint_param(const Glib::VariantContainerBase& params) {
+        Glib::Variant<guint32> v;
+        params.get_child(v, 0);
+        return v.get();
+    }
+
+    // Port (and ping for FullDiagnostic) checked within max_age_us.
+    static bool fresh(const SharedStatus& s, long long max_age_us, bool full) {
+        const long long now = journal_now_us();
+        if (s.port_open < 0 || now - s.port_checked_us > max_age_us) return false;
+        return !full || (s.ping_ok >= 0 && now - s.ping_checked_us <= max_age_us);
+    }
+
+    // Worker thread: publishing updates the snapshot every reader sees. FullDiagnostic is
+    // the cheap subset of the window's full scan: port, ping and queue state. The
+    // plugin, device-URI and path checks stay in the window (they print reports).
+    void probe(bool full) {
+        const std::string host = printer_host();
+        const auto started = std::chrono::steady_clock::now();
+        const bool open = tcp_connect_probe(host, PRINTER_PORT, PROBE_TIMEOUT_MS) == 0;
+        StatusPublisher::instance().publish_port(
+            open, (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                      std::chrono::steady_clock::now() - started).count());
+        if (!full) return;
+
+        int code = 0;
+        run_shell_capture("ping -c 1 -W 2 " + shell_quote(host) + " >/dev/null 2>&1", code);
+        StatusPublisher::instance().publish_ping(code == 0);
+
+        CupsClient cups(
+            [](const std::string& cmd) { int rc = 0; return run_shell_capture(cmd, rc); },
+            [](const std::string&) { return false; });
+        const std::string state = cups.printer_state_raw();
+        StatusPublisher::instance().publish_queue(cups.get_jobs(), state);
+    }
+
+    static void reply_test(const Glib::RefPtr<Gio::DBus::MethodInvocation>& invocation,
+                           const SharedStatus& s, bool full, bool cached) {
+        if (!full) {
+            invocation->return_value(tuple({Glib::Variant<int>::create(s.port_open),
+                                            Glib::Variant<int>::create(s.port_ms),
+                                            Glib::Variant<bool>::create(cached)}));
+            return;
+        }
+        Dict d = status_dict(s);
+        d["cached"] = cached ? "true" : "false";
+        invocation->return_value(tuple(Glib::Variant<Dict>::create(d)));
+    }
+
+    static Dict status_dict(const SharedStatus& s) {
+        const std::string state(s.printer_state, strnlen(s.printer_state, sizeof(s.printer_state)));
+        const std::string event(s.last_event, strnlen(s.last_event, sizeof(s.last_event)));
+        return {
+            {"host", std::string(s.host, strnlen(s.host, sizeof(s.host)))},
+            {"port_open", std::to_string(s.port_open)},
+            {"connect_ms", std::to_string(s.port_ms)},
+            {"port_checked_us", std::to_string(s.port_checked_us)},
+            {"ping_ok", std::to_string(s.ping_ok)},
+            {"ping_checked_us", std::to_string(s.ping_checked_us)},
+            {"queue_enabled", std::to_string(s.queue_enabled)},
+            {"jobs", std::to_string(s.jobs)},
+            {"queue_checked_us", std::to_string(s.queue_checked_us)},
+            {"printer_state", state},
+            {"last_event", event},
+            {"updated_us", std::to_string(s.updated_us)},
+        };
+    }
+
+    // Main loop: announce only what changed since the last signal.
+    void on_status(const SharedStatus& s, bool queue_changed) {
+        if (!m_connection) return;
+        const std::string state(s.printer_state, strnlen(s.printer_state, sizeof(s.printer_state)));
+        try {
+            if (s.port_open != m_sent_port || s.queue_enabled != m_sent_enabled || state != m_sent_state) {
+                m_sent_port = s.port_open;
+                m_sent_enabled = s.queue_enabled;
+                m_sent_state = state;
+                m_connection->emit_signal(DBUS_PATH, DBUS_INTERFACE, "PrinterStateChanged", Glib::ustring(),
+                                          tuple({Glib::Variant<int>::create(s.port_open),
+                                                 Glib::Variant<int>::create(s.queue_enabled),
+                                                 Glib::Variant<Glib::ustring>::create(state)}));
+            }
+            if (queue_changed || s.jobs != m_sent_jobs) {
+                m_sent_jobs = s.jobs;
+                m_connection->emit_signal(DBUS_PATH, DBUS_INTERFACE, "QueueChanged", Glib::ustring(),
+                                          tuple(Glib::Variant<int>::create(s.jobs)));
+            }
+        } catch (const Glib::Error& e) {
+            // Non-fatal: the bus went away; callers re-read with GetStatus
+            std::cerr << "D-Bus emit: " << e.what_s() << "\n";
+        }
+    }
+
+    void post_task(const Glib::RefPtr<Gio::DBus::MethodInvocation>& invocation, std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lk(m_task_mutex);
+            if (m_tasks.size() < MAX_PENDING_TASKS) {
+                m_tasks.push_back(std::move(task));
+                task = nullptr;
+            }
+        }
+        if (task) {
+            invocation->return_error(Gio::DBus::Error(Gio::DBus::Error::LIMITS_EXCEEDED, "Too many pending requests"));
+            return;
+        }
+        m_task_cv.notify_one();
+    }
 
-        for (size_t i = 0; i < tokens.size(); ++i) {
-            if (!is_month(tokens[i])) continue;
-            if (i == 0 || i + 2 >= tokens.size()) continue;
+    void worker_loop() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lk(m_task_mutex);
+                m_task_cv.wait(lk, [this]() { return m_worker_stop || !m_tasks.empty(); });
+                if (m_worker_stop) return;
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
 
-            std::string day  = tokens[i - 1];
-            std::string mon  = tokens[i];
-            std::string year = tokens[i + 1];
-            std::string time = tokens[i + 2];
+// ============================================================
+// Spool directory inspector
+// - Sizes queued documents from the CUPS spool: d<job>-<doc> data files
+// - getdents64 + statx relative to one directory fd; results are cached per
+//   inode, so a refresh re-stats only new or still-growing files and skips
+//   the listing while the directory's mtime is unchanged
+// - /var/spool/cups is normally root:lp 0710; without access callers fall
+//   back to the size lpstat reports
+// ============================================================
+static const char* CUPS_SPOOL_DIR = "/var/spool/cups";
 
-            if (time.find(':') == std::string::npos) continue;
+class SpoolScanner {
+public:
+    explicit SpoolScanner(std::string dir = CUPS_SPOOL_DIR) : m_dir(std::move(dir)) {}
+    ~SpoolScanner() {
+        if (m_dir_fd >= 0) ::close(m_dir_fd);
+    }
 
-            std::tm tm{};
-            std::istringstream dt(day + " " + mon + " " + year + " " + time);
-            dt >> std::get_time(&tm, "%d %b %Y %H:%M:%S");
-            if (dt.fail()) {
-                std::tm tm2{};
-                std::istringstream dt2(day + " " + mon + " " + year + " " + time);
-                dt2 >> std::get_time(&tm2, "%d %b %Y %H:%M");
-                if (dt2.fail()) continue;
-                tm = tm2;
-            }
-
-            if (i + 3 < tokens.size()) {
-                std::string ampm = tokens[i + 3];
-                if (ampm == "AM" || ampm == "PM") {
-                    int hour = tm.tm_hour;
-                    if (ampm == "AM") {
-                        if (hour == 12) hour = 0;
-                    } else {
-                        if (hour != 12) hour += 12;
-                    }
-                    tm.tm_hour = hour;
-                }
+    SpoolScanner(const SpoolScanner&) = delete;
+    SpoolScanner& operator=(const SpoolScanner&) = delete;
+
+    // Job number -> bytes of all its documents. False when the directory cannot be
+    // listed; error() says why.
+    bool scan(std::map<int, long long>& sizes) {
+        if (m_dir_fd < 0) {
+            m_dir_fd = ::open(m_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (m_dir_fd < 0) {
+                m_error = m_dir + ": " + std::strerror(errno);
+                return false;
             }
+        }
 
-            tm.tm_isdst = -1;
-            std::time_t tt = std::mktime(&tm);
-            if (tt == (std::time_t)-1) continue;
+        struct statx dir_st{};
+        if (::statx(m_dir_fd, "", AT_EMPTY_PATH | AT_STATX_DONT_SYNC, STATX_MTIME, &dir_st) != 0) {
+            m_error = m_dir + ": " + std::strerror(errno);
+            return false;
+        }
+        const int64_t dir_mtime = statx_ns(dir_st.stx_mtime);
+        const int64_t now_ns = journal_now_us() * 1000;
 
-            return std::chrono::system_clock::from_time_t(tt);
+        if (dir_mtime != m_dir_mtime_ns) {
+            if (!relist()) return false;
+            m_dir_mtime_ns = dir_mtime;
+        } else {
+            // Same names; only files still being spooled can have changed.
+            for (auto& e : m_inodes)
+                if (now_ns - e.second.mtime_ns < HOT_NS) restat(e.second);
         }
 
-        return std::nullopt;
+        sizes.clear();
+        for (const auto& e : m_inodes)
+            if (e.second.size >= 0) sizes[e.second.job] += e.second.size;
+        m_error.clear();
+        return true;
     }
 
-    static std::vector<PrintJob> parse_lpstat_jobs(const std::string& text) {
-        std::vector<PrintJob> jobs;
-        std::istringstream ss(text);
-        std::string line;
+    const std::string& error() const { return m_error; }
+
+private:
+    // Written within this window: may still be growing, so stat again.
+    static constexpr int64_t HOT_NS = 3'000'000'000LL;
+
+    struct Entry {
+        std::string name;
+        int job = 0;
+        long long size = -1;
+        int64_t mtime_ns = 0;
+        bool seen = false;
+    };
 
-        PrintJob current;
-        bool active = false;
+    std::string m_dir;
+    std::string m_error;
+    int m_dir_fd = -1;
+    int64_t m_dir_mtime_ns = -1;
+    std::unordered_map<uint64_t, Entry> m_inodes;
+
+    // linux_dirent64 from getdents64(2); glibc before 2.30 has no wrapper.
+    struct LinuxDirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    };
 
-        auto flush = [&]() {
-            if (active && !current.job_id.empty()) jobs.push_back(current);
-            current = PrintJob{};
-            active = false;
-        };
+    static int64_t statx_ns(const struct statx_timestamp& t) {
+        return (int64_t)t.tv_sec * 1000000000LL + t.tv_nsec;
+    }
 
-        while (std::getline(ss, line)) {
-            if (trim_copy(line).empty()) { flush(); continue; }
+    // "d00042-001" -> 42
+    static bool parse_data_name(const char* name, int& job) {
+        if (name[0] != 'd') return false;
+        const char* dash = std::strchr(name + 1, '-');
+        if (!dash || dash == name + 1) return false;
+        const auto res = std::from_chars(name + 1, dash, job);
+        return res.ec == std::errc() && res.ptr == dash;
+    }
 
-            bool continuation = !line.empty() && std::isspace((unsigned char)line[0]);
+    void restat(Entry& e) {
+        struct statx st{};
+        if (::statx(m_dir_fd, e.name.c_str(), AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                    STATX_SIZE | STATX_MTIME, &st) != 0) {
+            e.size = -1;  // Removed between listing and stat; dropped on the next relist
+            return;
+        }
+        e.size = (long long)st.stx_size;
+        e.mtime_ns = statx_ns(st.stx_mtime);
+    }
 
-            if (!continuation) {
-                flush();
-                active = true;
-                std::istringstream ls(line);
-                ls >> current.job_id >> current.user;
-
-                std::string rest;
-                std::getline(ls, rest);
-                rest = trim_copy(rest);
-
-                current.status = rest;
-                current.submitted_at = parse_datetime_from_line(rest);
-            } else if (active) {
-                std::string cont = trim_copy(line);
-                if (!cont.empty()) {
-                    if (!current.file.empty()) current.file += " | ";
-                    current.file += cont;
+    bool relist() {
+        if (::lseek(m_dir_fd, 0, SEEK_SET) < 0) {
+            m_error = m_dir + ": " + std::strerror(errno);
+            return false;
+        }
+        for (auto& e : m_inodes) e.second.seen = false;
+
+        const int64_t now_ns = journal_now_us() * 1000;
+        alignas(LinuxDirent64) char buf[16384];
+        for (;;) {
+            const long n = ::syscall(SYS_getdents64, m_dir_fd, buf, sizeof(buf));
+            if (n < 0) {
+                m_error = m_dir + ": " + std::strerror(errno);
+                return false;
+            }
+            if (n == 0) break;
+            for (long off = 0; off < n;) {
+                const auto* d = reinterpret_cast<const LinuxDirent64*>(buf + off);
+                off += d->d_reclen;
+                int job = 0;
+                if ((d->d_type != DT_REG && d->d_type != DT_UNKNOWN) || !parse_data_name(d->d_name, job)) continue;
+
+                auto it = m_inodes.find(d->d_ino);
+                if (it == m_inodes.end() || it->second.name != d->d_name) {
+                    Entry e;
+                    e.name = d->d_name;
+                    e.job = job;
+                    it = m_inodes.insert_or_assign(d->d_ino, std::move(e)).first;
+                    restat(it->second);
+                } else if (now_ns - it->second.mtime_ns < HOT_NS) {
+                    restat(it->second);
                 }
+                it->second.seen = true;
             }
         }
 
-        flush();
-        return jobs;
+        for (auto it = m_inodes.begin(); it != m_inodes.end();) {
+            if (it->second.seen) ++it;
+            else it = m_inodes.erase(it);
+        }
+        return true;
     }
 };
 
+// Latest measured bytes/s to the printer (0 = never measured): a raw port print
+// covers the whole path, so it wins over the PJL ECHO probe.
+static double latest_link_throughput() {
+    for (const char* metric : {"raw_print", "pjl_echo"}) {
+        const auto samples = metrics_recent(metric, 16);
+        for (auto it = samples.rbegin(); it != samples.rend(); ++it)
+            if (it->key == "bytes_per_sec" && it->value > 0) return it->value;
+    }
+    return 0;
+}
+
 // ============================================================
 // Advanced Queue Manager Dialog
 // ============================================================
 class QueueDialog : public Gtk::Dialog {
 public:
+    // Runs a helper op without blocking; done(ok) arrives on the main loop.
+    using PrivilegedAsync = std::function<void(const std::string& op, std::function<void(bool ok)> done)>;
+
     QueueDialog(Gtk::Window& parent,
                 CupsClient& cups,
                 std::function<void(const std::string&)> log_info,
                 std::function<void(const std::string&)> log_ok,
                 std::function<void(const std::string&)> log_warn,
-                std::function<void(const std::string&)> log_err)
+                std::function<void(const std::string&)> log_err,
+                PrivilegedAsync privileged,
+                std::function<void(const JobSnapshot&)> on_jobs = nullptr)
         : Gtk::Dialog("Print Queue Manager", parent, true),
           m_cups(cups),
+          m_privileged(std::move(privileged)),
           m_log_info(std::move(log_info)),
           m_log_ok(std::move(log_ok)),
           m_log_warn(std::move(log_warn)),
-          m_log_err(std::move(log_err)) {
+          m_log_err(std::move(log_err)),
+          m_on_jobs(std::move(on_jobs)) {
 
         set_default_size(980, 480);
 
@@ -358,6 +5157,8 @@ public:
 
         m_status.set_xalign(0.0f);
         m_root.pack_start(m_status, false, false, 0);
+        m_spool_info.set_xalign(0.0f);
+        m_root.pack_start(m_spool_info, false, false, 0);
 
         m_store = Gtk::ListStore::create(m_cols);
         m_tree.set_model(m_store);
@@ -367,6 +5168,8 @@ public:
         add_text_column("Job ID",  m_cols.job_id, 220);
         add_text_column("User",    m_cols.user, 120);
         add_text_column("Age",     m_cols.age, 90);
+        add_text_column("Size",    m_cols.size, 80);
+        add_text_column("ETA (link)", m_cols.eta, 90);
         add_text_column("Status",  m_cols.status, 320);
         add_text_column("File",    m_cols.file, 380);
 
@@ -418,6 +5221,9 @@ private:
             add(status);
             add(file);
             add(age_minutes);
+            add(size);
+            add(eta);
+            add(outlier);
             add(bg_color);
             add(bg_set);
         }
@@ -427,16 +5233,22 @@ private:
         Gtk::TreeModelColumn<std::string> status;
         Gtk::TreeModelColumn<std::string> file;
         Gtk::TreeModelColumn<int>         age_minutes;
+        Gtk::TreeModelColumn<std::string> size;
+        Gtk::TreeModelColumn<std::string> eta;
+        Gtk::TreeModelColumn<bool>        outlier;
         Gtk::TreeModelColumn<std::string> bg_color;
         Gtk::TreeModelColumn<bool>        bg_set;
     };
 
     CupsClient& m_cups;
+    PrivilegedAsync m_privileged;
+    std::shared_ptr<bool> m_alive = std::make_shared<bool>(true);  // Expires with the dialog
 
     std::function<void(const std::string&)> m_log_info;
     std::function<void(const std::string&)> m_log_ok;
     std::function<void(const std::string&)> m_log_warn;
     std::function<void(const std::string&)> m_log_err;
+    std::function<void(const JobSnapshot&)> m_on_jobs;
 
     Gtk::Box m_root{Gtk::ORIENTATION_VERTICAL};
     Gtk::Box m_controls{Gtk::ORIENTATION_HORIZONTAL};
@@ -450,6 +5262,7 @@ private:
     Gtk::SpinButton m_spin_age;
 
     Gtk::Label m_status;
+    Gtk::Label m_spool_info;
 
     Gtk::Button m_btn_refresh;
     Gtk::Button m_btn_cancel_selected;
@@ -463,6 +5276,16 @@ private:
 
     sigc::connection m_timer_conn;
 
+    // Job sizes: spool data files when readable, else lpstat's figure
+    SpoolScanner m_spool;
+    double m_link_bps = latest_link_throughput();
+
+    // A job this big is flagged when it is also 4x the queue median or needs 2+ minutes on the link.
+    static constexpr long long OUTLIER_MIN_BYTES = 10LL * 1024 * 1024;
+    static constexpr double OUTLIER_ETA_SEC = 120;
+    static constexpr const char* AGE_COLOR = "#3b2f1b";
+    static constexpr const char* OUTLIER_COLOR = "#4a1f1f";
+
     void add_text_column(const Glib::ustring& title,
                          const Gtk::TreeModelColumn<std::string>& col,
                          int min_width_px) {
@@ -514,42 +5337,131 @@ private:
         m_status.set_text(summary);
     }
 
+    static std::string fmt_eta(double seconds) {
+        const long s = std::lround(seconds);
+        if (s < 1) return "<1s";
+        if (s < 60) return std::to_string(s) + "s";
+        if (s < 3600) return std::to_string(s / 60) + "m " + std::to_string(s % 60) + "s";
+        return std::to_string(s / 3600) + "h " + std::to_string(s % 3600 / 60) + "m";
+    }
+
+    // "HP_LaserJet_Professional_P1102w-42" -> 42 (-1 if malformed)
+    static int job_number(std::string_view job_id) {
+        const size_t dash = job_id.rfind('-');
+        int n = -1;
+        if (dash == std::string_view::npos) return -1;
+        const auto res = std::from_chars(job_id.data() + dash + 1, job_id.data() + job_id.size(), n);
+        return res.ec == std::errc() ? n : -1;
+    }
+
+    // Outliers keep their colour; the rest follow the age threshold.
+    void highlight_row(const Gtk::TreeModel::Row& row, int threshold) {
+        const bool outlier = row[m_cols.outlier];
+        const int age = row[m_cols.age_minutes];
+        const bool old = threshold > 0 && age >= threshold;
+        set_if_changed(row, m_cols.bg_set, outlier || old);
+        set_if_changed(row, m_cols.bg_color, std::string(outlier ? OUTLIER_COLOR : old ? AGE_COLOR : ""));
+    }
+
     void apply_highlight_only() {
         const int threshold = (int)m_spin_age.get_value();
-        const std::string color = "#3b2f1b";
+        for (auto& row : m_store->children()) highlight_row(row, threshold);
+        m_tree.queue_draw();
+    }
+
+    template <class T>
+    static void set_if_changed(const Gtk::TreeModel::Row& row, const Gtk::TreeModelColumn<T>& col, const T& value) {
+        if (T(row[col]) != value) row[col] = value;
+    }
+
+    void fill_row(const Gtk::TreeModel::Row& row, const PrintJob& j, int threshold, long long bytes, bool outlier) {
+        set_if_changed(row, m_cols.job_id, std::string(j.job_id));
+        set_if_changed(row, m_cols.user, std::string(j.user));
 
-        for (auto& row : m_store->children()) {
-            int age = row[m_cols.age_minutes];
-            bool highlight = (threshold > 0 && age >= threshold);
-            row[m_cols.bg_set] = highlight;
-            row[m_cols.bg_color] = highlight ? color : "";
+        int age_min = 0;
+        set_if_changed(row, m_cols.age, fmt_age(j.submitted_at, age_min));
+        set_if_changed(row, m_cols.age_minutes, age_min);
+
+        set_if_changed(row, m_cols.size, format_bytes(bytes));
+        set_if_changed(row, m_cols.eta, bytes < 0 || m_link_bps <= 0 ? std::string("?") : fmt_eta(bytes / m_link_bps));
+        set_if_changed(row, m_cols.outlier, outlier);
+
+        set_if_changed(row, m_cols.status, std::string(j.status));
+        set_if_changed(row, m_cols.file, std::string(j.file));
+        highlight_row(row, threshold);
+    }
+
+    // Per-job bytes (-1 unknown) and the spool summary line.
+    std::map<std::string_view, long long> job_sizes(const JobSnapshot& jobs) {
+        std::map<int, long long> spooled;
+        const bool from_spool = m_spool.scan(spooled);
+
+        std::map<std::string_view, long long> sizes;
+        long long total = 0;
+        for (const auto& j : jobs) {
+            long long bytes = j.size_bytes;
+            if (from_spool) {
+                auto it = spooled.find(job_number(j.job_id));
+                if (it != spooled.end()) bytes = it->second;
+            }
+            sizes[j.job_id] = bytes;
+            if (bytes > 0) total += bytes;
         }
-        m_tree.queue_draw();
+
+        std::string info = "Queued data: " + format_bytes(total) +
+                           (from_spool ? " (spool files)" : " (lpstat; spool not readable: " + m_spool.error() + ")");
+        if (m_link_bps > 0) info += " - about " + fmt_eta(total / m_link_bps) + " at " +
+                                    format_bytes((long long)m_link_bps) + "/s measured link throughput";
+        else info += " - no throughput measured yet (options 13 / 15)";
+        m_spool_info.set_text(info);
+        return sizes;
+    }
+
+    bool is_outlier(long long bytes, long long median) const {
+        if (bytes < OUTLIER_MIN_BYTES) return false;
+        return bytes >= 4 * median || (m_link_bps > 0 && bytes / m_link_bps >= OUTLIER_ETA_SEC);
     }
 
+    // Rows are updated in place by job id: unchanged cells are not rewritten and
+    // the selection survives a refresh.
     void refresh() {
         set_status_line();
-        m_store->clear();
 
-        auto jobs = m_cups.get_jobs();
+        const auto jobs = m_cups.get_jobs();
+        if (m_on_jobs) m_on_jobs(jobs);
         const int threshold = (int)m_spin_age.get_value();
-        const std::string color = "#3b2f1b";
 
-        for (const auto& j : jobs) {
-            auto row = *m_store->append();
-            row[m_cols.job_id] = j.job_id;
-            row[m_cols.user] = j.user;
+        const auto sizes = job_sizes(jobs);
+        std::vector<long long> known;
+        for (const auto& s : sizes)
+            if (s.second >= 0) known.push_back(s.second);
+        long long median = 0;
+        if (!known.empty()) {
+            std::nth_element(known.begin(), known.begin() + known.size() / 2, known.end());
+            median = known[known.size() / 2];
+        }
+        auto fill = [&](const Gtk::TreeModel::Row& row, const PrintJob& j) {
+            const long long bytes = sizes.at(j.job_id);
+            fill_row(row, j, threshold, bytes, is_outlier(bytes, median));
+        };
 
-            int age_min = 0;
-            row[m_cols.age] = fmt_age(j.submitted_at, age_min);
-            row[m_cols.age_minutes] = age_min;
+        std::map<std::string_view, const PrintJob*> pending;
+        for (const auto& j : jobs) pending.emplace(j.job_id, &j);
 
-            row[m_cols.status] = j.status;
-            row[m_cols.file] = j.file;
+        for (auto it = m_store->children().begin(); it != m_store->children().end();) {
+            const std::string id = (*it)[m_cols.job_id];
+            auto found = pending.find(id);
+            if (found == pending.end()) {
+                it = m_store->erase(it);
+                continue;
+            }
+            fill(*it, *found->second);
+            pending.erase(found);
+            ++it;
+        }
 
-            bool highlight = (threshold > 0 && age_min >= threshold);
-            row[m_cols.bg_set] = highlight;
-            row[m_cols.bg_color] = highlight ? color : "";
+        for (const auto& j : jobs) {
+            if (pending.count(j.job_id)) fill(*m_store->append(), j);
         }
 
         m_tree.queue_draw();
@@ -573,87 +5485,823 @@ private:
         return resp == Gtk::RESPONSE_OK;
     }
 
-    Gtk::TreeModel::iterator selected_row() {
-        return m_tree.get_selection()->get_selected();
+    Gtk::TreeModel::iterator selected_row() {
+        return m_tree.get_selection()->get_selected();
+    }
+
+    void cancel_selected() {
+        auto sel = selected_row();
+        if (!sel) {
+            m_log_warn("Queue Manager: No job selected.");
+            return;
+        }
+        std::string job_id = (*sel)[m_cols.job_id];
+        std::string user   = (*sel)[m_cols.user];
+
+        if (!confirm_action("Confirm Cancel",
+                            "Cancel selected job?\n\nJob: " + job_id + "\nUser: " + user)) return;
+
+        m_log_info("Queue Manager: Cancelling job " + job_id + " ...");
+        m_cups.cancel_job(job_id);
+        m_log_ok("Queue Manager: Cancel requested for " + job_id);
+        refresh();
+    }
+
+    void cancel_all_from_user() {
+        auto sel = selected_row();
+        if (!sel) {
+            m_log_warn("Queue Manager: Select a job first to choose a user.");
+            return;
+        }
+        std::string user = (*sel)[m_cols.user];
+        if (user.empty()) {
+            m_log_warn("Queue Manager: Selected job has no user.");
+            return;
+        }
+
+        if (!confirm_action("Confirm Cancel",
+                            "Cancel ALL jobs owned by this user?\n\nUser: " + user)) return;
+
+        m_log_info("Queue Manager: Cancelling all jobs for user " + user + " ...");
+        m_cups.cancel_all_from_user(user);
+        m_log_ok("Queue Manager: Cancel requested for all jobs by " + user);
+        refresh();
+    }
+
+    void cancel_all_jobs() {
+        if (!confirm_action("Confirm Cancel",
+                            "Cancel ALL jobs in the queue?\n\nThis will cancel every pending job.")) return;
+
+        m_log_info("Queue Manager: Cancelling ALL jobs in queue ...");
+        m_cups.cancel_all();
+        m_log_ok("Queue Manager: Cancel requested for ALL jobs.");
+        refresh();
+    }
+
+    void pause_queue() {
+        if (!confirm_action("Confirm Pause",
+                            "Pause/disable the printer queue?\n\nThis requires administrator authorisation.")) return;
+
+        m_log_info("Queue Manager: Pausing queue (cupsdisable) ...");
+        run_queue_op("PAUSE_QUEUE", "Pause");
+    }
+
+    void resume_queue() {
+        if (!confirm_action("Confirm Resume",
+                            "Resume/enable the printer queue?\n\nThis requires administrator authorisation.")) return;
+
+        m_log_info("Queue Manager: Resuming queue (cupsenable) ...");
+        run_queue_op("RESUME_QUEUE", "Resume");
+    }
+
+    // The dialog may be gone when authorisation finishes; logging still applies.
+    void run_queue_op(const std::string& op, const std::string& label) {
+        std::weak_ptr<bool> alive = m_alive;
+        auto log_ok = m_log_ok, log_err = m_log_err;
+        m_privileged(op, [this, alive, label, log_ok, log_err](bool ok) {
+            if (ok) log_ok("Queue Manager: " + label + " requested.");
+            else log_err("Queue Manager: " + label + " failed.");
+            if (alive.lock()) refresh();
+        });
+    }
+};
+
+// ============================================================
+// ANSI SGR parsing
+// - Streaming: escape sequences split across chunks are carried over
+// - Emits runs of identically styled text; other CSI/OSC sequences are dropped
+// ============================================================
+struct SgrStyle {
+    int fg = -1;            // 0xRRGGBB, -1 = default
+    int bg = -1;
+    bool bold = false;
+    bool italic = false;
+    bool underline = false;
+
+    bool plain() const { return fg < 0 && bg < 0 && !bold && !italic && !underline; }
+    uint64_t key() const {
+        return (uint64_t)(fg + 1) | ((uint64_t)(bg + 1) << 25) |
+               ((uint64_t)bold << 50) | ((uint64_t)italic << 51) | ((uint64_t)underline << 52);
+    }
+};
+
+// xterm 256-colour palette entry as 0xRRGGBB.
+static int sgr_palette(int n) {
+    static const int base[16] = {
+        0x2e3436, 0xcc0000, 0x4e9a06, 0xc4a000, 0x3465a4, 0x75507b, 0x06989a, 0xd3d7cf,
+        0x555753, 0xef2929, 0x8ae234, 0xfce94f, 0x729fcf, 0xad7fa8, 0x34e2e2, 0xeeeeec,
+    };
+    if (n < 16) return base[n];
+    if (n < 232) {
+        n -= 16;
+        auto level = [](int v) { return v == 0 ? 0 : 55 + v * 40; };
+        return (level(n / 36) << 16) | (level(n / 6 % 6) << 8) | level(n % 6);
+    }
+    const int grey = 8 + (n - 232) * 10;
+    return (grey << 16) | (grey << 8) | grey;
+}
+
+class AnsiSgrParser {
+public:
+    using Sink = std::function<void(std::string_view, const SgrStyle&)>;
+
+    void feed(std::string_view chunk, const Sink& sink) {
+        std::string joined;
+        if (!m_pending.empty()) {
+            joined = m_pending + std::string(chunk);
+            m_pending.clear();
+            chunk = joined;
+        }
+
+        size_t run = 0;
+        size_t i = 0;
+        while (i < chunk.size()) {
+            if (chunk[i] != '\x1b') { ++i; continue; }
+            if (i > run) sink(chunk.substr(run, i - run), m_style);
+
+            const size_t end = sequence_end(chunk, i);
+            if (end == std::string_view::npos) {
+                m_pending.assign(chunk.substr(i));
+                return;
+            }
+            if (end - i >= 3 && chunk[i + 1] == '[' && chunk[end - 1] == 'm')
+                apply_sgr(chunk.substr(i + 2, end - i - 3));
+            i = run = end;
+        }
+        if (i > run) sink(chunk.substr(run, i - run), m_style);
+    }
+
+private:
+    // One past the sequence starting at ESC (chunk[i]); npos when incomplete.
+    static size_t sequence_end(std::string_view s, size_t i) {
+        if (i + 1 >= s.size()) return std::string_view::npos;
+        const char kind = s[i + 1];
+        if (kind == '[') {  // CSI: parameters, then a final byte in @..~
+            for (size_t j = i + 2; j < s.size(); ++j)
+                if (s[j] >= '@' && s[j] <= '~') return j + 1;
+            return std::string_view::npos;
+        }
+        if (kind == ']') {  // OSC: ends with BEL or ESC backslash
+            for (size_t j = i + 2; j < s.size(); ++j) {
+                if (s[j] == '\a') return j + 1;
+                if (s[j] == '\x1b' && j + 1 < s.size() && s[j + 1] == '\\') return j + 2;
+            }
+            return std::string_view::npos;
+        }
+        if (kind && std::strchr("()*+", kind)) {  // Charset designation, e.g. ESC ( B from `tput sgr0`
+            return i + 2 < s.size() ? i + 3 : std::string_view::npos;
+        }
+        return i + 2;
+    }
+
+    void apply_sgr(std::string_view params) {
+        std::array<int, 16> codes{};
+        size_t count = 0;
+        while (count < codes.size()) {
+            const size_t sep = params.find_first_of(";:");
+            std::string_view part = params.substr(0, sep);
+            int v = 0;
+            std::from_chars(part.data(), part.data() + part.size(), v);
+            codes[count++] = v;  // Empty parameter means 0
+            if (sep == std::string_view::npos) break;
+            params.remove_prefix(sep + 1);
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            const int c = codes[i];
+            if (c == 0) m_style = SgrStyle{};
+            else if (c == 1) m_style.bold = true;
+            else if (c == 3) m_style.italic = true;
+            else if (c == 4) m_style.underline = true;
+            else if (c == 22) m_style.bold = false;
+            else if (c == 23) m_style.italic = false;
+            else if (c == 24) m_style.underline = false;
+            else if (c >= 30 && c <= 37) m_style.fg = sgr_palette(c - 30);
+            else if (c >= 90 && c <= 97) m_style.fg = sgr_palette(c - 90 + 8);
+            else if (c >= 40 && c <= 47) m_style.bg = sgr_palette(c - 40);
+            else if (c >= 100 && c <= 107) m_style.bg = sgr_palette(c - 100 + 8);
+            else if (c == 39) m_style.fg = -1;
+            else if (c == 49) m_style.bg = -1;
+            else if (c == 38 || c == 48) {
+                int rgb = -1;
+                if (i + 2 < count && codes[i + 1] == 5) {
+                    rgb = sgr_palette(std::clamp(codes[i + 2], 0, 255));
+                    i += 2;
+                } else if (i + 4 < count && codes[i + 1] == 2) {
+                    rgb = (std::clamp(codes[i + 2], 0, 255) << 16) | (std::clamp(codes[i + 3], 0, 255) << 8) |
+                          std::clamp(codes[i + 4], 0, 255);
+                    i += 4;
+                }
+                (c == 38 ? m_style.fg : m_style.bg) = rgb;
+            }
+        }
+    }
+
+    SgrStyle m_style;
+    std::string m_pending;  // Incomplete escape sequence from the previous chunk
+};
+
+// ============================================================
+// Output search index
+// - Flat mirror of every output line plus an ASCII case-folded copy (same
+//   byte offsets) and the line start offsets; lines are only appended
+// - Every 64 lines form a block with a bitmap of the character pairs in it, so
+//   a scan memmem()s only blocks that hold every pair of the query
+// - A query that extends the previous one narrows its hits when they are few
+// - Scans are resumable under a time budget so the UI can spread a large
+//   one over idle callbacks
+// ============================================================
+class OutputSearchIndex {
+public:
+    void append_line(std::string_view line) {
+        if (m_starts.size() % BLOCK_LINES == 0) m_blocks.emplace_back();
+        Block& block = m_blocks.back();
+
+        m_starts.push_back(m_text.size());
+        m_text.append(line);
+        m_text.push_back('\n');
+
+        int prev = -1;
+        for (char c : line) {
+            const char f = (char)std::tolower((unsigned char)c);
+            m_folded.push_back(f);
+            const int cls = char_class(f);
+            block.single |= 1ull << cls;
+            if (prev >= 0) set_pair(block, prev, cls);
+            prev = cls;
+        }
+        m_folded.push_back('\n');
+    }
+
+    size_t line_count() const { return m_starts.size(); }
+
+    std::string_view line(size_t i) const {
+        return std::string_view(m_text).substr(m_starts[i], line_end(i) - m_starts[i]);
+    }
+
+    // Byte column of the first match of query in line i, or npos.
+    size_t match_column(size_t i, const std::string& query) const {
+        if (query.empty()) return std::string_view::npos;
+        const std::string folded = fold(query);
+        const char* hit = find(m_folded.data() + m_starts[i], line_end(i) - m_starts[i], folded);
+        return hit ? (size_t)(hit - m_folded.data()) - m_starts[i] : std::string_view::npos;
+    }
+
+    // Puts older's lines in front of this index's; the last search is dropped.
+    void splice_front(OutputSearchIndex&& older) {
+        for (size_t i = 0; i < line_count(); ++i) older.append_line(line(i));
+        *this = std::move(older);
+        m_query.clear();
+        m_hits.clear();
+        m_scanned = 0;
+    }
+
+    // Lines containing the last query (ASCII case-insensitive), ascending.
+    const std::vector<size_t>& hits() const { return m_hits; }
+
+    // Updates hits() for query, scanning for at most budget (but at least one block).
+    // Returns true once every line has been scanned; call again with the same query
+    // to continue.
+    bool search(const std::string& query, std::chrono::steady_clock::duration budget) {
+        const auto deadline = std::chrono::steady_clock::now() + budget;
+        const std::string folded = fold(query);
+        if (folded.empty() || folded.find('\n') != std::string::npos) {
+            m_hits.clear();
+            m_query.clear();
+            m_scanned = 0;
+            return true;
+        }
+
+        const bool narrows = !m_query.empty() && folded.compare(0, m_query.size(), m_query) == 0;
+        if (narrows && folded != m_query && m_hits.size() < m_scanned / 8) {
+            // Only lines that matched the shorter query can match this one.
+            std::vector<size_t> kept;
+            for (size_t i : m_hits)
+                if (find(m_folded.data() + m_starts[i], line_end(i) - m_starts[i], folded)) kept.push_back(i);
+            m_hits.swap(kept);
+        } else if (!(narrows && folded == m_query)) {
+            m_hits.clear();
+            m_scanned = 0;
+        }
+        m_query = folded;
+
+        // Scan what was appended since (everything after a reset), block by block.
+        Block need;
+        for (size_t i = 0; i < folded.size(); ++i) {
+            need.single |= 1ull << char_class(folded[i]);
+            if (i > 0) set_pair(need, char_class(folded[i - 1]), char_class(folded[i]));
+        }
+        const size_t first_block = m_scanned / BLOCK_LINES;
+        for (size_t b = first_block; b < m_blocks.size(); ++b) {
+            size_t line = std::max(b * BLOCK_LINES, m_scanned);
+            const size_t last = std::min((b + 1) * BLOCK_LINES, m_starts.size());
+            if (line >= last) continue;
+            if (b > first_block && std::chrono::steady_clock::now() >= deadline) {
+                m_scanned = line;
+                return false;
+            }
+            m_scanned = last;
+            if (!covers(m_blocks[b], need)) continue;
+            const size_t end = last < m_starts.size() ? m_starts[last] : m_folded.size();
+            size_t pos = m_starts[line];
+            while (const char* hit = find(m_folded.data() + pos, end - pos, folded)) {
+                const size_t off = (size_t)(hit - m_folded.data());
+                while (line + 1 < last && m_starts[line + 1] <= off) ++line;
+                m_hits.push_back(line);
+                if (++line >= last) break;
+                pos = m_starts[line];
+            }
+        }
+        return true;
+    }
+
+private:
+    static const size_t BLOCK_LINES = 64;
+
+    struct Block {
+        uint64_t single = 0;               // Character classes present
+        std::array<uint64_t, 64> pairs{};  // Adjacent class pairs present (64 x 64 bits)
+    };
+
+    // 64 classes: letters and digits exact, the rest folded together.
+    static int char_class(char c) {
+        const unsigned char u = (unsigned char)c;
+        if (u >= 'a' && u <= 'z') return u - 'a';
+        if (u >= '0' && u <= '9') return 26 + (u - '0');
+        if (u == ' ') return 36;
+        return 37 + u % 27;
+    }
+
+    static void set_pair(Block& b, int first, int second) { b.pairs[first] |= 1ull << second; }
+
+    static bool covers(const Block& have, const Block& need) {
+        if ((have.single & need.single) != need.single) return false;
+        for (size_t i = 0; i < need.pairs.size(); ++i)
+            if ((have.pairs[i] & need.pairs[i]) != need.pairs[i]) return false;
+        return true;
+    }
+
+    static std::string fold(const std::string& s) {
+        std::string out(s);
+        for (auto& c : out) c = (char)std::tolower((unsigned char)c);
+        return out;
+    }
+
+    // memchr on the first byte, then memcmp: cheaper than memmem's setup on the
+    // short ranges the block filter leaves.
+    static const char* find(const char* p, size_t n, const std::string& needle) {
+        const size_t m = needle.size();
+        if (m == 0) return nullptr;
+        while (n >= m) {
+            const char* c = (const char*)std::memchr(p, needle[0], n - m + 1);
+            if (!c) return nullptr;
+            if (std::memcmp(c + 1, needle.data() + 1, m - 1) == 0) return c;
+            n -= (size_t)(c + 1 - p);
+            p = c + 1;
+        }
+        return nullptr;
+    }
+
+    size_t line_end(size_t i) const {
+        return (i + 1 < m_starts.size() ? m_starts[i + 1] : m_text.size()) - 1;
+    }
+
+    std::string m_text;
+    std::string m_folded;
+    std::vector<size_t> m_starts;
+    std::vector<Block> m_blocks;
+
+    // Last search
+    std::string m_query;
+    std::vector<size_t> m_hits;
+    size_t m_scanned = 0;       // Lines covered by m_hits
+};
+
+// ============================================================
+// Support bundle
+// - Every source runs on its own thread under a deadline; commands go
+//   through timeout(1), which kills the command's whole process group
+// - Finished sources become ustar entries in completion order, streamed
+//   straight into zstd (Gio gzip when zstd is missing); nothing is staged
+// - The bundle is ready after roughly its slowest source
+// ============================================================
+struct BundleSource {
+    std::string name;                                 // Path inside the archive
+    int deadline_ms = 5000;
+    std::function<std::string(int deadline_ms)> collect;  // Worker thread; values only
+};
+
+struct BundleEntry {
+    std::string name;
+    size_t bytes = 0;
+    long ms = 0;
+    bool finished = false;                            // false: missed its deadline
+};
+
+struct BundleResult {
+    std::string error;
+    long total_ms = 0;
+    std::vector<BundleEntry> entries;                 // Archive order
+};
+
+static std::string hp_info_command() {
+    // HPLIP wants ?ip= for addresses; names (e.g. mDNS) go through ?hostname=.
+    const std::string ipv4 = resolve_ipv4(printer_host());
+    const std::string query = ipv4.empty() ? "hostname=" + printer_host() : "ip=" + ipv4;
+    return "hp-info -d " + shell_quote("hp:/net/" + PRINTER_NAME + "?" + query) + " 2>&1";
+}
+
+// Output is kept when the deadline kills the command; the reason is appended.
+static std::function<std::string(int)> bundle_command(const std::string& cmd) {
+    return [cmd](int deadline_ms) {
+        const int secs = std::max(1, deadline_ms / 1000);
+        int code = 0;
+        std::string out = run_shell_capture(
+            "timeout -k 1 " + std::to_string(secs) + " sh -c " + shell_quote(cmd) + " 2>&1", code);
+        if (code == 124 || code == 137) out += "\n[stopped after " + std::to_string(secs) + " s]\n";
+        else if (code != 0) out += "\n[exit " + std::to_string(code) + "]\n";
+        return out;
+    };
+}
+
+// Last max_bytes of a file (large logs keep only their newest part).
+static std::function<std::string(int)> bundle_file(const std::string& path, size_t max_bytes = 4u << 20) {
+    return [path, max_bytes](int) {
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in) return std::string("[not readable: " + path + "]\n");
+        const std::streamoff size = in.tellg();
+        const std::streamoff skip = size > (std::streamoff)max_bytes ? size - (std::streamoff)max_bytes : 0;
+        in.seekg(skip);
+        std::string data((size_t)(size - skip), '\0');
+        in.read(&data[0], (std::streamsize)data.size());
+        data.resize((size_t)in.gcount());
+        return data;
+    };
+}
+
+// Built on the main thread; session_output is the window text at that moment.
+static std::vector<BundleSource> support_bundle_sources(const std::string& session_output) {
+    const std::string host = printer_host();
+    const std::string printer = shell_quote(PRINTER_NAME);
+
+    std::vector<BundleSource> sources = {
+        {"cups/lpstat-t.txt", 8000, bundle_command("lpstat -t")},
+        {"cups/jobs.txt", 5000, bundle_command("lpstat -W not-completed -o -l " + printer)},
+        {"cups/printer-state.txt", 5000, bundle_command("lpstat -l -p " + printer + "; lpstat -v " + printer)},
+        {"cups/journal.txt", 10000,
+         bundle_command("journalctl -u cups --since '-24h' -n 2000 --no-pager -q")},
+        {"cups/error_log.txt", 3000, bundle_command("tail -n 2000 /var/log/cups/error_log")},
+        {"probes/ping.txt", 8000, bundle_command("ping -c 3 -W 2 " + shell_quote(host))},
+        {"probes/hp-info.txt", 20000, bundle_command(hp_info_command())},
+        {"probes/port9100.txt", 4000, [host](int deadline_ms) {
+             const auto started = std::chrono::steady_clock::now();
+             const int err = tcp_connect_probe(host, PRINTER_PORT, std::max(1000, deadline_ms - 1000));
+             const long ms = (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                                 std::chrono::steady_clock::now() - started).count();
+             return host + ":" + std::to_string(PRINTER_PORT) + " " +
+                    (err == 0 ? "open" : std::string("closed (") + std::strerror(err) + ")") +
+                    " in " + std::to_string(ms) + " ms\n";
+         }},
+        {"probes/status.txt", 2000, [](int) {
+             SharedStatus st{};
+             return read_shared_status(st) ? format_shared_status(st) : std::string("running=0\n");
+         }},
+        {"history/metrics.csv", 3000, bundle_file(metrics_file_path())},
+        {"history/wake_stats.ini", 2000, bundle_file(wake_stats_path())},
+        {"history/journal-24h.txt", 5000, [](int) {
+             std::string out;
+             for (const auto& rec : Journal::read_since(journal_now_us() - 24LL * 3600 * 1000000))
+                 out += journal_format(rec) + "\n";
+             return out;
+         }},
+        {"config.ini", 2000, bundle_file(config_file_path())},
+        {"session-output.txt", 1000, [session_output](int) { return session_output; }},
+    };
+    return sources;
+}
+
+// POSIX ustar records; names must fit the 100-byte field.
+class TarWriter {
+public:
+    using Sink = std::function<bool(const char* data, size_t len)>;
+
+    explicit TarWriter(Sink sink) : m_sink(std::move(sink)) {}
+
+    bool add(const std::string& name, const std::string& data, std::time_t mtime) {
+        char header[512] = {};
+        std::snprintf(header, 100, "%s", name.c_str());
+        std::snprintf(header + 100, 8, "%07o", 0644);
+        std::snprintf(header + 108, 8, "%07o", 0);
+        std::snprintf(header + 116, 8, "%07o", 0);
+        std::snprintf(header + 124, 12, "%011llo", (unsigned long long)data.size());
+        std::snprintf(header + 136, 12, "%011llo", (unsigned long long)mtime);
+        header[156] = '0';
+        std::memcpy(header + 257, "ustar", 6);
+        std::memcpy(header + 263, "00", 2);
+
+        // Checksum is computed with its own field read as spaces.
+        std::memset(header + 148, ' ', 8);
+        unsigned sum = 0;
+        for (unsigned char c : header) sum += c;
+        std::snprintf(header + 148, 8, "%06o", sum);
+
+        static const char zeros[512] = {};
+        const size_t pad = (512 - data.size() % 512) % 512;
+        return m_sink(header, sizeof(header)) && m_sink(data.data(), data.size()) && m_sink(zeros, pad);
+    }
+
+    bool finish() {
+        static const char zeros[1024] = {};
+        return m_sink(zeros, sizeof(zeros));
+    }
+
+private:
+    Sink m_sink;
+};
+
+// Compressed archive file: `zstd -o` fed through a pipe, or gzip via Gio for *.gz
+// paths and systems without zstd.
+class BundleOutput {
+public:
+    ~BundleOutput() { close(); }
+
+    bool open(const std::string& path, std::string& error) {
+        m_path = path;
+        const bool gz = path.size() > 3 && path.compare(path.size() - 3, 3, ".gz") == 0;
+        if (!gz && !Glib::find_program_in_path("zstd").empty()) {
+            m_pipe = popen(("zstd -q -f -T0 -o " + shell_quote(path)).c_str(), "w");
+            if (!m_pipe) error = std::string("cannot start zstd: ") + std::strerror(errno);
+            return m_pipe != nullptr;
+        }
+        try {
+            m_gzip = Gio::ConverterOutputStream::create(
+                Gio::File::create_for_path(path)->replace(),
+                Gio::ZlibCompressor::create(Gio::ZLIB_COMPRESSOR_FORMAT_GZIP, 6));
+            return true;
+        } catch (const Glib::Error& e) {
+            error = e.what_s();
+            return false;
+        }
+    }
+
+    bool write(const char* data, size_t len) {
+        if (len == 0) return true;
+        if (m_pipe) return std::fwrite(data, 1, len, m_pipe) == len;
+        if (!m_gzip) return false;
+        try {
+            gsize written = 0;
+            return m_gzip->write_all(data, len, written);
+        } catch (...) {
+            return false;
+        }
     }
 
-    void cancel_selected() {
-        auto sel = selected_row();
-        if (!sel) {
-            m_log_warn("Queue Manager: No job selected.");
-            return;
+    // Flushes and reports compressor failures; removes the file on error.
+    bool close(std::string* error = nullptr) {
+        bool ok = true;
+        if (m_pipe) {
+            const int status = pclose(m_pipe);
+            m_pipe = nullptr;
+            ok = status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            if (!ok && error) *error = "zstd failed (disk full or unwritable path?)";
+        } else if (m_gzip) {
+            try {
+                m_gzip->close();
+            } catch (const Glib::Error& e) {
+                ok = false;
+                if (error) *error = e.what_s();
+            }
+            m_gzip.reset();
+        } else {
+            return false;
         }
-        std::string job_id = (*sel)[m_cols.job_id];
-        std::string user   = (*sel)[m_cols.user];
+        if (!ok) ::unlink(m_path.c_str());
+        return ok;
+    }
 
-        if (!confirm_action("Confirm Cancel",
-                            "Cancel selected job?\n\nJob: " + job_id + "\nUser: " + user)) return;
+private:
+    std::string m_path;
+    FILE* m_pipe = nullptr;
+    Glib::RefPtr<Gio::ConverterOutputStream> m_gzip;
+};
 
-        m_log_info("Queue Manager: Cancelling job " + job_id + " ...");
-        m_cups.cancel_job(job_id);
-        m_log_ok("Queue Manager: Cancel requested for " + job_id);
-        refresh();
+// Blocks until every source finished or missed its deadline (worker thread).
+// cancel stops the wait within 100 ms; the partial archive is removed and the
+// detached collectors run out on their own deadlines.
+static BundleResult write_support_bundle(const std::string& path, const std::vector<BundleSource>& sources,
+                                         const std::atomic<bool>& cancel) {
+    static constexpr int KILL_GRACE_MS = 1500;  // timeout -k 1 plus reading the pipe dry
+    BundleResult result;
+    const auto started = std::chrono::steady_clock::now();
+    const size_t n = sources.size();
+
+    // A source stuck past its deadline (say, a read hung on a dead mount) must
+    // not hold the bundle, so workers are detached and own only this state.
+    struct Shared {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<size_t> done;
+        std::vector<std::string> data;
+        std::vector<long> ms;
+    };
+    auto shared = std::make_shared<Shared>();
+    shared->data.resize(n);
+    shared->ms.resize(n);
+
+    BundleOutput out;
+    if (!out.open(path, result.error)) return result;
+
+    for (size_t i = 0; i < n; ++i) {
+        std::thread([shared, i, collect = sources[i].collect, deadline = sources[i].deadline_ms, started]() {
+            std::string data;
+            try {
+                data = collect(deadline);
+            } catch (const std::exception& e) {
+                data = std::string("[failed: ") + e.what() + "]\n";
+            }
+            std::lock_guard<std::mutex> lk(shared->mutex);
+            shared->data[i] = std::move(data);
+            shared->ms[i] = (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                                std::chrono::steady_clock::now() - started).count();
+            shared->done.push_back(i);
+            shared->cv.notify_all();
+        }).detach();
     }
 
-    void cancel_all_from_user() {
-        auto sel = selected_row();
-        if (!sel) {
-            m_log_warn("Queue Manager: Select a job first to choose a user.");
-            return;
+    // zstd dying early must fail the write, not SIGPIPE the whole process. Only
+    // this thread blocks it, after zstd and the collectors exist, so neither they
+    // nor the commands they start inherit the mask.
+    sigset_t pipe_set, old_set;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+
+    const std::string root = "hp-p1102w-support-" + now_timestamp_yyyymmdd_hhmmss() + "/";
+    const std::time_t mtime = std::time(nullptr);
+    TarWriter tar([&out](const char* data, size_t len) { return out.write(data, len); });
+    std::vector<bool> written(n, false);
+    size_t remaining = n;
+    bool ok = true;
+
+    while (remaining > 0 && ok && !cancel) {
+        std::vector<std::pair<size_t, std::string>> ready;
+        {
+            std::unique_lock<std::mutex> lk(shared->mutex);
+            auto next_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+            for (size_t i = 0; i < n; ++i)
+                if (!written[i])
+                    next_deadline = std::min(next_deadline, started + std::chrono::milliseconds(
+                                                                          sources[i].deadline_ms + KILL_GRACE_MS));
+            shared->cv.wait_until(lk, next_deadline, [&]() { return !shared->done.empty(); });
+
+            for (size_t i : shared->done) {
+                if (written[i]) continue;  // Already given up on
+                ready.emplace_back(i, std::move(shared->data[i]));
+                result.entries.push_back({sources[i].name, ready.back().second.size(), shared->ms[i], true});
+                written[i] = true;
+                --remaining;
+            }
+            shared->done.clear();
+
+            const auto now = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < n; ++i) {
+                if (written[i] || now < started + std::chrono::milliseconds(sources[i].deadline_ms + KILL_GRACE_MS))
+                    continue;
+                ready.emplace_back(i, "[no result within " + std::to_string(sources[i].deadline_ms) + " ms]\n");
+                result.entries.push_back({sources[i].name, 0, sources[i].deadline_ms + KILL_GRACE_MS, false});
+                written[i] = true;
+                --remaining;
+            }
         }
-        std::string user = (*sel)[m_cols.user];
-        if (user.empty()) {
-            m_log_warn("Queue Manager: Selected job has no user.");
-            return;
+        // Compress outside the lock so workers can keep finishing.
+        for (const auto& entry : ready) {
+            ok = tar.add(root + sources[entry.first].name, entry.second, mtime);
+            if (!ok) break;
         }
-
-        if (!confirm_action("Confirm Cancel",
-                            "Cancel ALL jobs owned by this user?\n\nUser: " + user)) return;
-
-        m_log_info("Queue Manager: Cancelling all jobs for user " + user + " ...");
-        m_cups.cancel_all_from_user(user);
-        m_log_ok("Queue Manager: Cancel requested for all jobs by " + user);
-        refresh();
     }
 
-    void cancel_all_jobs() {
-        if (!confirm_action("Confirm Cancel",
-                            "Cancel ALL jobs in the queue?\n\nThis will cancel every pending job.")) return;
-
-        m_log_info("Queue Manager: Cancelling ALL jobs in queue ...");
-        m_cups.cancel_all();
-        m_log_ok("Queue Manager: Cancel requested for ALL jobs.");
-        refresh();
+    result.total_ms = (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::steady_clock::now() - started).count();
+    if (cancel) {
+        ok = false;
+        result.error = "cancelled";
+    }
+    if (ok) {
+        std::ostringstream manifest;
+        manifest << "host=" << printer_host() << "\nprinter=" << PRINTER_NAME << "\ncollected_ms=" << result.total_ms
+                 << "\n\n";
+        for (const auto& e : result.entries)
+            manifest << std::left << std::setw(28) << e.name << std::right << std::setw(9) << e.bytes << " B "
+                     << std::setw(6) << e.ms << " ms" << (e.finished ? "" : "  deadline missed") << "\n";
+        ok = tar.add(root + "manifest.txt", manifest.str(), mtime) && tar.finish();
     }
+    if (!ok) result.error = "write failed";
+    std::string close_error;
+    if (!out.close(&close_error) && result.error.empty()) result.error = close_error;
+    if (!ok) ::unlink(path.c_str());
+
+    // Drop a SIGPIPE raised by a dead zstd before restoring the mask.
+    const timespec no_wait{0, 0};
+    while (sigtimedwait(&pipe_set, nullptr, &no_wait) > 0) {}
+    pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+    return result;
+}
 
-    void pause_queue() {
-        if (!confirm_action("Confirm Pause",
-                            "Pause/disable the printer queue?\n\nThis may require sudo privileges.")) return;
+// ============================================================
+// HPLIP plugin metadata
+// - Installed HPLIP version: [hplip] version in /etc/hp/hplip.conf
+// - Plugin stamp: [plugin] installed/version in /var/lib/hp/hplip.state,
+//   plus the driver blobs in <home>/prnt/plugins
+// - Parsed only when a file's mtime/size/inode changes; otherwise three stat()s
+// ============================================================
+static const char* HPLIP_CONF_PATH  = "/etc/hp/hplip.conf";
+static const char* HPLIP_STATE_PATH = "/var/lib/hp/hplip.state";
+
+struct HplipPluginStatus {
+    std::string hplip_version;      // "" when HPLIP is not installed
+    std::string plugin_version;     // Stamp written by hp-plugin / the distro package
+    bool plugin_installed = false;
+    std::string plugin_dir;
+    int plugin_files = 0;           // *.so blobs in plugin_dir
+
+    bool hplip_present() const { return !hplip_version.empty(); }
+    bool plugin_present() const { return plugin_installed && plugin_files > 0; }
+    // hpcups refuses to load a plugin whose stamp differs from the running HPLIP.
+    bool versions_match() const { return plugin_version == hplip_version; }
+};
 
-        m_log_info("Queue Manager: Pausing queue (cupsdisable) ...");
-        m_cups.pause_queue();
-        m_log_ok("Queue Manager: Pause requested.");
-        refresh();
+static std::string hplip_plugin_dir(const std::string& home) {
+    return Glib::build_filename(home.empty() ? std::string("/usr/share/hplip") : home, "prnt", "plugins");
+}
+
+// Changes whenever HPLIP or the plugin is (re)installed.
+static std::string hplip_metadata_key(const std::string& plugin_dir) {
+    std::ostringstream key;
+    for (const std::string& path : {std::string(HPLIP_CONF_PATH), std::string(HPLIP_STATE_PATH), plugin_dir}) {
+        struct stat st{};
+        if (::stat(path.c_str(), &st) == 0)
+            key << st.st_ino << ":" << st.st_size << ":" << st.st_mtim.tv_sec << "." << st.st_mtim.tv_nsec;
+        key << ";";
     }
+    return key.str();
+}
 
-    void resume_queue() {
-        if (!confirm_action("Confirm Resume",
-                            "Resume/enable the printer queue?\n\nThis may require sudo privileges.")) return;
+static std::string hplip_ini_value(const std::string& path, const char* group, const char* key) {
+    Glib::KeyFile kf;
+    try {
+        if (!kf.load_from_file(path)) return "";
+        return trim_copy(kf.get_string(group, key));
+    } catch (...) {
+        return "";  // Missing file, group or key
+    }
+}
 
-        m_log_info("Queue Manager: Resuming queue (cupsenable) ...");
-        m_cups.resume_queue();
-        m_log_ok("Queue Manager: Resume requested.");
-        refresh();
+static HplipPluginStatus read_hplip_plugin_status() {
+    static std::mutex mutex;
+    static std::string cached_key;
+    static HplipPluginStatus cached;
+    std::lock_guard<std::mutex> lk(mutex);
+
+    // The plugin directory comes from hplip.conf, so the key needs the last parse.
+    const std::string dir = cached.plugin_dir.empty() ? hplip_plugin_dir("") : cached.plugin_dir;
+    const std::string key = hplip_metadata_key(dir);
+    if (!cached_key.empty() && key == cached_key) return cached;
+
+    HplipPluginStatus st;
+    st.hplip_version = hplip_ini_value(HPLIP_CONF_PATH, "hplip", "version");
+    st.plugin_dir = hplip_plugin_dir(hplip_ini_value(HPLIP_CONF_PATH, "dirs", "home"));
+    st.plugin_version = hplip_ini_value(HPLIP_STATE_PATH, "plugin", "version");
+    const std::string installed = hplip_ini_value(HPLIP_STATE_PATH, "plugin", "installed");
+    st.plugin_installed = installed == "1" || installed == "true";
+
+    if (DIR* d = ::opendir(st.plugin_dir.c_str())) {
+        while (dirent* e = ::readdir(d)) {
+            const std::string name = e->d_name;
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, ".so") == 0) ++st.plugin_files;
+        }
+        ::closedir(d);
     }
-};
+
+    cached = st;
+    cached_key = st.plugin_dir == dir ? key : hplip_metadata_key(st.plugin_dir);
+    return cached;
+}
 
 // ============================================================
 // Main Diagnostic Window
 // ============================================================
 class PrinterDiagnostic : public Gtk::Window {
 public:
-    PrinterDiagnostic();
-    ~PrinterDiagnostic() override = default;
+    PrinterDiagnostic(ConfigStore& config,
+                      PrivilegedHelper& priv,
+                      WakeScheduler& wake,
+                      JobLatencyTracker& latency,
+                      const std::string& restored_output,
+                      std::function<void()> on_quit);
+    ~PrinterDiagnostic() override;
+
+    void apply_external_config();
+    std::string output_text() { return m_buffer->get_text(); }
 
 private:
     // Layout
@@ -672,11 +6320,21 @@ private:
     Gtk::CheckButton m_chk_strip_hplip{"Strip ANSI for HPLIP (hp-info)"};
     Gtk::Button m_btn_export{"Export Output"};
 
+    // Output search (the whole session, optionally past sessions from the journal)
+    Gtk::Box m_searchbar{Gtk::ORIENTATION_HORIZONTAL};
+    Gtk::SearchEntry m_search;
+    Gtk::Button m_btn_search_prev{"Previous"};
+    Gtk::Button m_btn_search_next{"Next"};
+    Gtk::CheckButton m_chk_search_history{"Include past sessions"};
+    Gtk::Label m_lbl_search;
+
     // Continuous wake controls
     Gtk::CheckButton m_chk_wake_enabled{"Enable Continuous Wake Mode"};
+    Gtk::ComboBoxText m_combo_wake_mode;
     Gtk::Label m_lbl_wake_interval{"Wake interval (min):"};
     Gtk::SpinButton m_spin_wake_interval;
     Gtk::Label m_lbl_wake_status{"Status: Disabled"};
+    Gtk::CheckButton m_chk_background{"Keep running in background when closed"};
 
     // Buttons
     Gtk::Button m_btn_quick_test{"1. Quick Test (ping + port check)"};
@@ -685,11 +6343,21 @@ private:
     Gtk::Button m_btn_stuck_jobs{"4. Check for Stuck Jobs"};
     Gtk::Button m_btn_plugin_version{"5. Check Plugin Version"};
     Gtk::Button m_btn_printer_info{"6. Get Printer Info (HPLIP)"};
+    Gtk::Button m_btn_link_probe{"13. Link Speed Probe (PJL ECHO)"};
+    Gtk::Button m_btn_benchmark{"14. Print Benchmark..."};
+    Gtk::Button m_btn_raw_print{"15. Raw Port Print (bypass CUPS)..."};
+    Gtk::Button m_btn_job_latency{"16. Job Latency Report"};
+    Gtk::Button m_btn_trace_path{"17. Trace Path to Printer"};
+    Gtk::Button m_btn_interfaces{"18. Probe All Interfaces"};
+    Gtk::Button m_btn_rerun{"19. Re-run Diagnostics (only what changed)"};
+    Gtk::Button m_btn_bundle{"20. Collect Support Bundle..."};
+    Gtk::Button m_btn_transfer{"22. Live Transfer Monitor"};
 
     Gtk::Button m_btn_clear_jobs{"7. Clear Stuck Jobs"};
     Gtk::Button m_btn_wake_command{"8. Send Wake Command to Printer"};
     Gtk::Button m_btn_restart_cups{"9. Restart CUPS Service"};
     Gtk::Button m_btn_test_page{"10. Print Test Page"};
+    Gtk::Button m_btn_repoint{"21. Re-point Queue to Printer Address"};
 
     Gtk::Button m_btn_view_logs{"11. View Recent CUPS Logs"};
     Gtk::Button m_btn_queue_manager{"12. Manage Print Queue"};
@@ -703,25 +6371,85 @@ private:
     Glib::RefPtr<Gtk::TextTag> m_tag_white;
     Glib::RefPtr<Gtk::TextTag> m_tag_bold;
     Glib::RefPtr<Gtk::TextTag> m_tag_bold_cyan;
+    std::map<uint64_t, Glib::RefPtr<Gtk::TextTag>> m_ansi_tags;  // By SgrStyle::key(), created on first use
+    Glib::RefPtr<Gtk::TextTag> m_tag_search;
+
+    // Search index: [past sessions][this session; buffer line 0 = m_buffer_base ...]
+    OutputSearchIndex m_search_index;
+    size_t m_history_lines = 0;
+    bool m_history_loaded = false;
+    bool m_history_loading = false;
+    std::thread m_history_thread;
+    std::atomic<bool> m_history_cancel{false};
+    size_t m_buffer_base = 0;
+    int m_indexed_buffer_lines = 0;   // Complete buffer lines mirrored so far
+    size_t m_search_pos = 0;          // Into the shown hits
+    bool m_search_positioned = false;
+    sigc::connection m_search_conn;
 
     // State
     bool m_show_raw = false;
     bool m_strip_global = false;
-    bool m_strip_hplip = true;
+    bool m_strip_hplip = false;
     bool m_wake_enabled = false;
     int m_wake_interval_minutes = 5;
-    sigc::connection m_wake_timer_conn;
+    std::string m_wake_mode = "interval";
+    bool m_run_in_background = false;
 
     // CUPS client
     std::unique_ptr<CupsClient> m_cups;
 
+    // Incremental re-diagnosis: rendered check output plus the state it was computed under
+    struct CachedCheck {
+        bool ok = false;
+        std::chrono::steady_clock::time_point computed_at;
+        std::map<std::string, std::string> fingerprints;  // Dependency -> fingerprint at compute time
+        Glib::RefPtr<Gtk::TextBuffer> output;            // Shares m_buffer's tag table
+    };
+    std::map<std::string, CachedCheck> m_diag_cache;
+    std::map<std::string, uint64_t> m_diag_events;       // Explicit invalidations per dependency
+    int m_diag_hits = 0;
+
+    // Print benchmark worker; posted results are dropped once m_alive is false
+    std::thread m_bench_thread;
+    std::atomic<bool> m_bench_cancel{false};
+    bool m_bench_running = false;
+    std::thread m_raw_thread;
+    std::atomic<bool> m_raw_cancel{false};
+    bool m_raw_running = false;
+    std::thread m_bundle_thread;
+    std::atomic<bool> m_bundle_cancel{false};
+    bool m_bundle_running = false;
+    std::thread m_transfer_thread;
+    std::atomic<bool> m_transfer_stop{false};
+    bool m_transfer_running = false;
+    std::shared_ptr<bool> m_alive = std::make_shared<bool>(true);
+
+    // Application-lifetime services (outlive this window in background mode)
+    ConfigStore& m_config;
+    PrivilegedHelper& m_priv;
+    WakeScheduler& m_wake;
+    JobLatencyTracker& m_latency;
+    std::function<void()> m_on_quit;
+
     // Config
+    bool m_applying_config = false;
     void load_config();
     void save_config();
 
     // Output helpers
     void print_header(const std::string& text);
     void scroll_to_end();
+
+    // Output search
+    void sync_search_index(bool flush_partial);
+    void on_search_changed();
+    bool continue_search();
+    void search_step(int delta);
+    void show_search_hit();
+    void update_search_label(bool done);
+    void load_search_history();
+    size_t first_shown_hit() const;
     void print_success(const std::string& text);
     void print_error(const std::string& text);
     void print_warning(const std::string& text);
@@ -729,6 +6457,10 @@ private:
 
     // Command runner with per-command ANSI policy
     std::string execute_command(const std::string& cmd, bool is_hplip=false);
+    std::string clean_output(const std::string& raw, bool is_hplip) const;
+    void insert_output(const std::string& text, const Glib::RefPtr<Gtk::TextTag>& base = {});
+    Glib::RefPtr<Gtk::TextTag> ansi_tag(const SgrStyle& style);
+    void run_privileged(const std::string& op, std::function<void(const std::string& output)> on_ok = nullptr);
 
     // Diagnostics
     bool check_ping();
@@ -736,12 +6468,28 @@ private:
     bool check_cups_status();
     bool check_stuck_jobs();
     bool check_plugin_version();
+    bool check_device_uri();
     bool get_printer_info();
+    bool check_link_speed();
+    bool trace_path();
+    bool check_interfaces();
+
+    // Incremental re-diagnosis
+    bool run_cached(const std::string& id, bool force);
+    std::string dependency_fingerprint(const std::string& dep);
+    void invalidate(const std::string& dep) { ++m_diag_events[dep]; }
+    void run_full_diagnostic(bool force);
+    void show_job_latency();
+    void start_benchmark(const BenchSettings& settings);
+    void report_benchmark(const BenchReport& rep);
+    void start_raw_print(const std::string& host, int port, int pages, int padding_kb);
+    void start_transfer_monitor();
 
     // Fixes
     void clear_stuck_jobs();
     void send_wake_command();
     void restart_cups();
+    void repoint_queue();
     void print_test_page();
 
     // Other
@@ -752,7 +6500,6 @@ private:
     // Continuous wake
     void start_wake_timer();
     void stop_wake_timer();
-    void send_wake_silent();
     void update_wake_status();
 
     // Button handlers
@@ -762,17 +6509,33 @@ private:
     void on_stuck_jobs();
     void on_plugin_version();
     void on_printer_info();
+    void on_link_probe();
+    void on_benchmark();
+    void on_raw_print();
+    void on_job_latency();
+    void on_trace_path();
+    void on_interfaces();
+    void on_rerun();
+    void on_support_bundle();
+    void on_transfer_monitor();
     void on_clear_jobs();
     void on_wake_command();
     void on_restart_cups();
     void on_test_page();
+    void on_repoint_queue();
     void on_view_logs();
     void on_queue_manager();
     void on_export();
     void on_exit();
 };
 
-PrinterDiagnostic::PrinterDiagnostic() {
+PrinterDiagnostic::PrinterDiagnostic(ConfigStore& config,
+                                     PrivilegedHelper& priv,
+                                     WakeScheduler& wake,
+                                     JobLatencyTracker& latency,
+                                     const std::string& restored_output,
+                                     std::function<void()> on_quit)
+    : m_config(config), m_priv(priv), m_wake(wake), m_latency(latency), m_on_quit(std::move(on_quit)) {
     set_title("HP P1102w Printer Diagnostic Tool - Complete Edition");
     set_default_size(1000, 720);
 
@@ -790,6 +6553,16 @@ PrinterDiagnostic::PrinterDiagnostic() {
     m_tag_white = Gtk::TextTag::create(); m_tag_white->property_foreground() = "white"; m_buffer->get_tag_table()->add(m_tag_white);
     m_tag_bold = Gtk::TextTag::create(); m_tag_bold->property_weight() = Pango::WEIGHT_BOLD; m_buffer->get_tag_table()->add(m_tag_bold);
     m_tag_bold_cyan = Gtk::TextTag::create(); m_tag_bold_cyan->property_foreground() = "cyan"; m_tag_bold_cyan->property_weight() = Pango::WEIGHT_BOLD; m_buffer->get_tag_table()->add(m_tag_bold_cyan);
+    m_tag_search = Gtk::TextTag::create(); m_tag_search->property_background() = "#fce94f"; m_tag_search->property_foreground() = "black"; m_buffer->get_tag_table()->add(m_tag_search);
+
+    // Clearing the pane keeps its lines searchable: mirror them before they go.
+    m_buffer->signal_erase().connect(
+        [this](const Gtk::TextBuffer::iterator&, const Gtk::TextBuffer::iterator&) {
+            sync_search_index(true);
+            m_buffer_base = m_search_index.line_count();
+            m_indexed_buffer_lines = 0;
+        },
+        false);
 
     // Load saved preferences
     load_config();
@@ -797,6 +6570,7 @@ PrinterDiagnostic::PrinterDiagnostic() {
     // Layout
     add(m_vbox);
     m_vbox.pack_start(m_topbar, false, false, 6);
+    m_vbox.pack_start(m_searchbar, false, false, 0);
     m_vbox.pack_start(m_wakebar, false, false, 6);
     m_vbox.pack_start(m_hbox, true, true, 0);
 
@@ -813,21 +6587,54 @@ PrinterDiagnostic::PrinterDiagnostic() {
     m_topbar.pack_start(m_chk_strip_hplip, false, false, 0);
     m_topbar.pack_end(m_btn_export, false, false, 0);
 
+    // Search bar
+    m_searchbar.set_spacing(10);
+    m_searchbar.set_border_width(6);
+    m_search.set_placeholder_text("Search output (Enter = next)");
+    m_search.set_width_chars(32);
+    m_lbl_search.set_xalign(0.0f);
+    m_lbl_search.set_ellipsize(Pango::ELLIPSIZE_END);
+    m_searchbar.pack_start(m_search, false, false, 0);
+    m_searchbar.pack_start(m_btn_search_prev, false, false, 0);
+    m_searchbar.pack_start(m_btn_search_next, false, false, 0);
+    m_searchbar.pack_start(m_chk_search_history, false, false, 0);
+    m_searchbar.pack_start(m_lbl_search, true, true, 0);
+
+    m_search.signal_search_changed().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_search_changed));
+    m_search.signal_activate().connect([this]() { search_step(1); });
+    m_search.signal_next_match().connect([this]() { search_step(1); });
+    m_search.signal_previous_match().connect([this]() { search_step(-1); });
+    m_search.signal_stop_search().connect([this]() { m_search.set_text(""); });
+    m_btn_search_next.signal_clicked().connect([this]() { search_step(1); });
+    m_btn_search_prev.signal_clicked().connect([this]() { search_step(-1); });
+    m_chk_search_history.signal_toggled().connect([this]() {
+        if (m_chk_search_history.get_active()) load_search_history();
+        on_search_changed();
+        if (m_history_loading) m_lbl_search.set_text("Loading past sessions...");
+    });
+
     // Wake bar - Continuous wake controls
     m_wakebar.set_spacing(10);
     m_wakebar.set_border_width(6);
 
     m_chk_wake_enabled.set_active(m_wake_enabled);
+    m_combo_wake_mode.append("interval", "On a timer");
+    m_combo_wake_mode.append("on_job", "On job arrival");
+    m_combo_wake_mode.set_active_id(m_wake_mode);
     m_spin_wake_interval.set_range(1, 60);
     m_spin_wake_interval.set_increments(1, 5);
     m_spin_wake_interval.set_value(m_wake_interval_minutes);
     m_lbl_wake_status.set_xalign(0.0f);
 
     m_wakebar.pack_start(m_chk_wake_enabled, false, false, 0);
+    m_wakebar.pack_start(m_combo_wake_mode, false, false, 0);
     m_wakebar.pack_start(m_lbl_wake_interval, false, false, 0);
     m_wakebar.pack_start(m_spin_wake_interval, false, false, 0);
     m_wakebar.pack_start(m_lbl_wake_status, true, true, 0);
 
+    m_chk_background.set_active(m_run_in_background);
+    m_wakebar.pack_end(m_chk_background, false, false, 0);
+
     // Settings info
     Gtk::Box* settings_box = Gtk::manage(new Gtk::Box(Gtk::ORIENTATION_VERTICAL));
     settings_box->set_spacing(2);
@@ -836,7 +6643,7 @@ PrinterDiagnostic::PrinterDiagnostic() {
     lbl_settings->set_xalign(0.0f);
 
     Gtk::Label* lbl_raw = Gtk::manage(new Gtk::Label(
-        "• Raw output: show exact command output (includes ANSI color codes)."));
+        "• Raw output: show exact command output (escape codes as text). Otherwise ANSI colours are rendered."));
     lbl_raw->set_xalign(0.0f);
 
     Gtk::Label* lbl_global = Gtk::manage(new Gtk::Label(
@@ -851,11 +6658,21 @@ PrinterDiagnostic::PrinterDiagnostic() {
         "• Continuous Wake: automatically send wake commands at regular intervals to prevent deep sleep."));
     lbl_wake->set_xalign(0.0f);
 
+    Gtk::Label* lbl_wake_on_job = Gtk::manage(new Gtk::Label(
+        "• On job arrival: wake only when a job is queued, briefly holding the queue until port 9100 accepts."));
+    lbl_wake_on_job->set_xalign(0.0f);
+
+    Gtk::Label* lbl_background = Gtk::manage(new Gtk::Label(
+        "• Background mode: closing the window keeps wake running; reopen from the tray icon or by launching again."));
+    lbl_background->set_xalign(0.0f);
+
     settings_box->pack_start(*lbl_settings, false, false, 0);
     settings_box->pack_start(*lbl_raw, false, false, 0);
     settings_box->pack_start(*lbl_global, false, false, 0);
     settings_box->pack_start(*lbl_hplip, false, false, 0);
     settings_box->pack_start(*lbl_wake, false, false, 0);
+    settings_box->pack_start(*lbl_wake_on_job, false, false, 0);
+    settings_box->pack_start(*lbl_background, false, false, 0);
 
     m_vbox.pack_start(*settings_box, false, false, 6);
 
@@ -865,7 +6682,8 @@ PrinterDiagnostic::PrinterDiagnostic() {
         m_chk_strip_hplip.set_sensitive(!raw && !m_chk_strip_global.get_active());
         
         bool wake_on = m_chk_wake_enabled.get_active();
-        m_spin_wake_interval.set_sensitive(wake_on);
+        m_combo_wake_mode.set_sensitive(wake_on);
+        m_spin_wake_interval.set_sensitive(wake_on && m_combo_wake_mode.get_active_id() == "interval");
     };
     update_toggle_sensitivity();
 
@@ -906,6 +6724,20 @@ PrinterDiagnostic::PrinterDiagnostic() {
         save_config();
     });
 
+    m_combo_wake_mode.signal_changed().connect([this, update_toggle_sensitivity]() {
+        m_wake_mode = m_combo_wake_mode.get_active_id();
+        if (m_wake_enabled) {
+            start_wake_timer();
+        }
+        update_toggle_sensitivity();
+        save_config();
+    });
+
+    m_chk_background.signal_toggled().connect([this]() {
+        m_run_in_background = m_chk_background.get_active();
+        save_config();
+    });
+
     m_btn_export.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_export));
 
     // Left panel
@@ -914,15 +6746,16 @@ PrinterDiagnostic::PrinterDiagnostic() {
     m_hbox.pack_start(m_leftbox, false, false, 0);
 
     // CUPS client for friendly name
-    m_cups = std::make_unique<CupsClient>([this](const std::string& cmd) {
-        return this->execute_command(cmd, false);
-    });
+    // Privileged queue actions go through run_privileged (async), never this blocking hook.
+    m_cups = std::make_unique<CupsClient>(
+        [this](const std::string& cmd) { return this->execute_command(cmd, false); },
+        [](const std::string&) { return false; });
 
     std::string friendly_name = m_cups->get_printer_friendly_name();
 
     Gtk::Label lbl_printer("Printer: " + friendly_name); lbl_printer.set_xalign(0.0f);
     Gtk::Label lbl_queue("CUPS Queue: " + PRINTER_NAME); lbl_queue.set_xalign(0.0f);
-    Gtk::Label lbl_ip("IP Address: " + PRINTER_IP); lbl_ip.set_xalign(0.0f);
+    Gtk::Label lbl_ip("Address: " + printer_host()); lbl_ip.set_xalign(0.0f);
     Gtk::Label lbl_port("Port: " + std::to_string(PRINTER_PORT)); lbl_port.set_xalign(0.0f);
 
     m_leftbox.pack_start(lbl_printer, false, false, 0);
@@ -939,6 +6772,15 @@ PrinterDiagnostic::PrinterDiagnostic() {
     m_leftbox.pack_start(m_btn_stuck_jobs, false, false, 0);
     m_leftbox.pack_start(m_btn_plugin_version, false, false, 0);
     m_leftbox.pack_start(m_btn_printer_info, false, false, 0);
+    m_leftbox.pack_start(m_btn_link_probe, false, false, 0);
+    m_leftbox.pack_start(m_btn_benchmark, false, false, 0);
+    m_leftbox.pack_start(m_btn_raw_print, false, false, 0);
+    m_leftbox.pack_start(m_btn_job_latency, false, false, 0);
+    m_leftbox.pack_start(m_btn_trace_path, false, false, 0);
+    m_leftbox.pack_start(m_btn_interfaces, false, false, 0);
+    m_leftbox.pack_start(m_btn_rerun, false, false, 0);
+    m_leftbox.pack_start(m_btn_bundle, false, false, 0);
+    m_leftbox.pack_start(m_btn_transfer, false, false, 0);
 
     Gtk::Label lbl_fixes("\nFIXES:"); lbl_fixes.set_xalign(0.0f);
     m_leftbox.pack_start(lbl_fixes, false, false, 0);
@@ -947,6 +6789,7 @@ PrinterDiagnostic::PrinterDiagnostic() {
     m_leftbox.pack_start(m_btn_wake_command, false, false, 0);
     m_leftbox.pack_start(m_btn_restart_cups, false, false, 0);
     m_leftbox.pack_start(m_btn_test_page, false, false, 0);
+    m_leftbox.pack_start(m_btn_repoint, false, false, 0);
 
     Gtk::Label lbl_other("\nOTHER:"); lbl_other.set_xalign(0.0f);
     m_leftbox.pack_start(lbl_other, false, false, 0);
@@ -962,10 +6805,20 @@ PrinterDiagnostic::PrinterDiagnostic() {
     m_btn_stuck_jobs.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_stuck_jobs));
     m_btn_plugin_version.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_plugin_version));
     m_btn_printer_info.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_printer_info));
+    m_btn_link_probe.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_link_probe));
+    m_btn_benchmark.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_benchmark));
+    m_btn_raw_print.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_raw_print));
+    m_btn_job_latency.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_job_latency));
+    m_btn_trace_path.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_trace_path));
+    m_btn_interfaces.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_interfaces));
+    m_btn_rerun.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_rerun));
+    m_btn_bundle.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_support_bundle));
+    m_btn_transfer.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_transfer_monitor));
     m_btn_clear_jobs.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_clear_jobs));
     m_btn_wake_command.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_wake_command));
     m_btn_restart_cups.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_restart_cups));
     m_btn_test_page.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_test_page));
+    m_btn_repoint.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_repoint_queue));
     m_btn_view_logs.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_view_logs));
     m_btn_queue_manager.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_queue_manager));
     m_btn_exit.signal_clicked().connect(sigc::mem_fun(*this, &PrinterDiagnostic::on_exit));
@@ -975,105 +6828,119 @@ PrinterDiagnostic::PrinterDiagnostic() {
     m_scrolled.set_policy(Gtk::POLICY_AUTOMATIC, Gtk::POLICY_AUTOMATIC);
     m_hbox.pack_start(m_scrolled, true, true, 0);
 
-    // Persist on window hide
+    // Persist on window hide (the app decides whether wake keeps running)
     signal_hide().connect([this]() { 
-        stop_wake_timer();
         save_config(); 
+        m_config.flush();
     });
 
-    // Start wake timer if enabled
+    // Restore output from before the window was last closed
+    if (!restored_output.empty()) {
+        m_buffer->set_text(restored_output);
+        print_info("Window restored from background mode");
+    }
+
+    // Wake runs in the app-level scheduler; this window only shows its status
+    m_wake.set_on_status([this]() { update_wake_status(); });
     if (m_wake_enabled) {
         start_wake_timer();
     }
+    update_wake_status();
 
     show_all_children();
 }
 
+PrinterDiagnostic::~PrinterDiagnostic() {
+    m_wake.set_on_status(nullptr);
+    *m_alive = false;
+    m_bench_cancel = true;
+    if (m_bench_thread.joinable()) m_bench_thread.join();
+    m_raw_cancel = true;
+    if (m_raw_thread.joinable()) m_raw_thread.join();
+    m_bundle_cancel = true;
+    if (m_bundle_thread.joinable()) m_bundle_thread.join();
+    m_transfer_stop = true;
+    if (m_transfer_thread.joinable()) m_transfer_thread.join();
+    m_history_cancel = true;
+    if (m_history_thread.joinable()) m_history_thread.join();
+}
+
 // ============================================================
 // Config persistence
 // ============================================================
 void PrinterDiagnostic::load_config() {
-    ensure_config_dir_exists();
-
-    Glib::KeyFile kf;
-    try {
-        kf.load_from_file(config_file_path());
-        m_show_raw = kf.get_boolean("output", "raw");
-        m_strip_global = kf.get_boolean("output", "strip_global");
-        m_strip_hplip = kf.get_boolean("output", "strip_hplip");
-        m_wake_enabled = kf.get_boolean("wake", "enabled");
-        m_wake_interval_minutes = kf.get_integer("wake", "interval_minutes");
-    } catch (...) {
-        // Keep defaults
-    }
+    const AppConfig& cfg = m_config.get();
+    m_show_raw = cfg.show_raw;
+    m_strip_global = cfg.strip_global;
+    m_strip_hplip = cfg.strip_hplip;
+    m_wake_enabled = cfg.wake_enabled;
+    m_wake_interval_minutes = cfg.wake_interval_minutes;
+    m_wake_mode = cfg.wake_mode;
+    m_run_in_background = cfg.run_in_background;
 }
 
+// Cheap: only marks the store dirty; the write happens off-thread once settled.
 void PrinterDiagnostic::save_config() {
-    ensure_config_dir_exists();
-    Glib::KeyFile kf;
-    try {
-        kf.set_boolean("output", "raw", m_show_raw);
-        kf.set_boolean("output", "strip_global", m_strip_global);
-        kf.set_boolean("output", "strip_hplip", m_strip_hplip);
-        kf.set_boolean("wake", "enabled", m_wake_enabled);
-        kf.set_integer("wake", "interval_minutes", m_wake_interval_minutes);
-
-        std::string data = kf.to_data();
-        std::ofstream out(config_file_path(), std::ios::binary);
-        if (out) out << data;
-    } catch (...) {
-        // Ignore
-    }
+    if (m_applying_config) return;
+
+    AppConfig cfg = m_config.get();
+    cfg.show_raw = m_show_raw;
+    cfg.strip_global = m_strip_global;
+    cfg.strip_hplip = m_strip_hplip;
+    cfg.wake_enabled = m_wake_enabled;
+    cfg.wake_interval_minutes = m_wake_interval_minutes;
+    cfg.wake_mode = m_wake_mode;
+    cfg.run_in_background = m_run_in_background;
+    m_config.update(cfg);
+}
+
+// config.ini was edited outside the app (e.g. fleet management): apply live.
+void PrinterDiagnostic::apply_external_config() {
+    m_applying_config = true;
+    load_config();
+    m_chk_raw.set_active(m_show_raw);
+    m_chk_strip_global.set_active(m_strip_global);
+    m_chk_strip_hplip.set_active(m_strip_hplip);
+    m_spin_wake_interval.set_value(m_wake_interval_minutes);
+    m_combo_wake_mode.set_active_id(m_wake_mode);
+    m_chk_wake_enabled.set_active(m_wake_enabled);
+    m_chk_background.set_active(m_run_in_background);
+    m_applying_config = false;
+
+    print_info("Configuration reloaded from " + config_file_path());
 }
 
 // ============================================================
 // Continuous wake functions
 // ============================================================
 void PrinterDiagnostic::start_wake_timer() {
-    stop_wake_timer();  // Clear existing timer
-    
-    if (m_wake_interval_minutes <= 0) return;
-    
-    // Convert minutes to seconds for the timer
-    int interval_seconds = m_wake_interval_minutes * 60;
-    
-    m_wake_timer_conn = Glib::signal_timeout().connect_seconds([this]() -> bool {
-        send_wake_silent();
-        return true;  // Keep running
-    }, interval_seconds);
-    
-    update_wake_status();
+    m_wake.configure(true, m_wake_interval_minutes, wake_mode_from_string(m_wake_mode));
 }
 
 void PrinterDiagnostic::stop_wake_timer() {
-    if (m_wake_timer_conn.connected()) {
-        m_wake_timer_conn.disconnect();
-    }
-    update_wake_status();
-}
-
-void PrinterDiagnostic::send_wake_silent() {
-    // Send wake command without logging to output
-    std::string cmd =
-        "printf '\\x1B%%-12345X@PJL\\r\\n@PJL INFO STATUS\\r\\n\\x1B%%-12345X\\r\\n' | "
-        "nc " + PRINTER_IP + " " + std::to_string(PRINTER_PORT) + " -w 3 2>/dev/null";
-    execute_command(cmd, false);
-    
-    update_wake_status();
+    m_wake.configure(false, m_wake_interval_minutes, wake_mode_from_string(m_wake_mode));
 }
 
 void PrinterDiagnostic::update_wake_status() {
-    if (m_wake_enabled && m_wake_timer_conn.connected()) {
-        std::time_t t = std::time(nullptr);
-        std::tm tm{};
-        localtime_r(&t, &tm);
-        char time_str[32];
-        strftime(time_str, sizeof(time_str), "%H:%M:%S", &tm);
+    if (m_wake.active()) {
+        std::string time_str = "not yet";
+        if (auto t = m_wake.last_wake()) {
+            std::tm tm{};
+            localtime_r(&*t, &tm);
+            char buf[32];
+            strftime(buf, sizeof(buf), "%H:%M:%S", &tm);
+            time_str = buf;
+        }
         
-        m_lbl_wake_status.set_markup(
-            "<span foreground='green'>Status: <b>ACTIVE</b></span>  |  "
-            "Interval: " + std::to_string(m_wake_interval_minutes) + " min  |  "
-            "Last wake: " + std::string(time_str));
+        std::string schedule = (m_wake.mode() == WakeMode::Interval)
+            ? "Interval: " + std::to_string(m_wake.interval_minutes()) + " min"
+            : "On job arrival";
+        std::string markup =
+            "<span foreground='green'>Status: <b>ACTIVE</b></span>  |  " + schedule + "  |  "
+            "Last wake: " + time_str;
+        if (!m_wake.last_event().empty())
+            markup += "  |  " + Glib::Markup::escape_text(m_wake.last_event()).raw();
+        m_lbl_wake_status.set_markup(markup);
     } else {
         m_lbl_wake_status.set_markup("<span foreground='red'>Status: <b>DISABLED</b></span>");
     }
@@ -1088,23 +6955,28 @@ void PrinterDiagnostic::print_header(const std::string& text) {
     iter = m_buffer->insert_with_tag(iter, text + "\n", m_tag_bold_cyan);
     iter = m_buffer->insert_with_tag(iter, "=======================================\n\n", m_tag_bold_cyan);
     scroll_to_end();
+    journal_line("header", text);
 }
 
 void PrinterDiagnostic::print_success(const std::string& text) {
     m_buffer->insert_with_tag(m_buffer->end(), "✓ " + text + "\n", m_tag_green);
     scroll_to_end();
+    journal_line("success", text);
 }
 void PrinterDiagnostic::print_error(const std::string& text) {
     m_buffer->insert_with_tag(m_buffer->end(), "✗ " + text + "\n", m_tag_red);
     scroll_to_end();
+    journal_line("error", text);
 }
 void PrinterDiagnostic::print_warning(const std::string& text) {
     m_buffer->insert_with_tag(m_buffer->end(), "⚠ " + text + "\n", m_tag_yellow);
     scroll_to_end();
+    journal_line("warning", text);
 }
 void PrinterDiagnostic::print_info(const std::string& text) {
     m_buffer->insert_with_tag(m_buffer->end(), "ℹ " + text + "\n", m_tag_blue);
     scroll_to_end();
+    journal_line("info", text);
 }
 
 void PrinterDiagnostic::scroll_to_end() {
@@ -1112,26 +6984,372 @@ void PrinterDiagnostic::scroll_to_end() {
     m_textview.scroll_to(iter);
 }
 
+// ============================================================
+// Output search
+// - The index mirrors the pane lazily: only lines added since the last sync are
+//   read back, and lines about to be cleared are mirrored first
+// - Large scans run in 8 ms slices from idle so typing stays responsive
+// ============================================================
+void PrinterDiagnostic::sync_search_index(bool flush_partial) {
+    if (m_indexed_buffer_lines >= m_buffer->get_line_count()) return;
+    const std::string text =
+        m_buffer->get_text(m_buffer->get_iter_at_line(m_indexed_buffer_lines), m_buffer->end()).raw();
+
+    size_t pos = 0;
+    for (size_t nl; (nl = text.find('\n', pos)) != std::string::npos; pos = nl + 1) {
+        m_search_index.append_line(std::string_view(text).substr(pos, nl - pos));
+        ++m_indexed_buffer_lines;
+    }
+    // The last line may still grow; it is indexed once complete (or on clear).
+    if (flush_partial && pos < text.size()) {
+        m_search_index.append_line(std::string_view(text).substr(pos));
+        ++m_indexed_buffer_lines;
+    }
+}
+
+// Past sessions are decoded and indexed on a worker, one journal segment at a
+// time; the finished index is spliced in front of this session's lines.
+void PrinterDiagnostic::load_search_history() {
+    if (m_history_loaded) return;
+    m_history_loaded = true;
+    m_history_loading = true;
+
+    auto alive = m_alive;
+    m_history_thread = std::thread([this, alive]() {
+        auto history = std::make_shared<OutputSearchIndex>();
+        const int64_t opened_us = Journal::instance().opened_us();
+        Journal::read_segments(0, [this, &history, opened_us](std::vector<JournalRecord>& recs) {
+            for (const auto& rec : recs) {
+                if (rec.time_us >= opened_us) return false;
+                const std::string line = journal_format(rec);
+                size_t pos = 0;
+                for (size_t nl; (nl = line.find('\n', pos)) != std::string::npos; pos = nl + 1)
+                    history->append_line(std::string_view(line).substr(pos, nl - pos));
+                history->append_line(std::string_view(line).substr(pos));
+            }
+            return !m_history_cancel;
+        });
+        if (m_history_cancel) return;
+
+        run_on_main([this, alive, history]() {
+            if (!*alive) return;
+            m_history_loading = false;
+            m_history_lines = history->line_count();
+            m_search_index.splice_front(std::move(*history));
+            m_buffer_base += m_history_lines;
+            on_search_changed();
+        });
+    });
+}
+
+size_t PrinterDiagnostic::first_shown_hit() const {
+    if (m_chk_search_history.get_active()) return 0;
+    const auto& hits = m_search_index.hits();
+    return (size_t)(std::lower_bound(hits.begin(), hits.end(), m_history_lines) - hits.begin());
+}
+
+void PrinterDiagnostic::on_search_changed() {
+    if (m_search_conn.connected()) m_search_conn.disconnect();
+    m_buffer->remove_tag(m_tag_search, m_buffer->begin(), m_buffer->end());
+    m_search_positioned = false;
+    m_search_pos = 0;
+    sync_search_index(false);
+    if (continue_search()) {
+        m_search_conn = Glib::signal_idle().connect(sigc::mem_fun(*this, &PrinterDiagnostic::continue_search));
+    }
+}
+
+// One slice of the current scan; returns true while more remains (idle handler).
+bool PrinterDiagnostic::continue_search() {
+    const std::string query = m_search.get_text();
+    const bool done = m_search_index.search(query, std::chrono::milliseconds(8));
+
+    // Jump to the first hit still in the pane, or else the newest one.
+    const auto& hits = m_search_index.hits();
+    const size_t first = first_shown_hit();
+    if (!m_search_positioned && !query.empty()) {
+        auto in_pane = std::lower_bound(hits.begin() + (long)first, hits.end(), m_buffer_base);
+        if (in_pane != hits.end()) {
+            m_search_pos = (size_t)(in_pane - hits.begin()) - first;
+            m_search_positioned = true;
+        } else if (done && hits.size() > first) {
+            m_search_pos = hits.size() - first - 1;
+            m_search_positioned = true;
+        }
+        if (m_search_positioned) show_search_hit();
+    }
+    update_search_label(done);
+    return !done;
+}
+
+void PrinterDiagnostic::search_step(int delta) {
+    // Pick up output added since the query was typed.
+    sync_search_index(false);
+    if (!m_search_conn.connected() && !m_search_index.search(m_search.get_text(), std::chrono::milliseconds(8)))
+        m_search_conn = Glib::signal_idle().connect(sigc::mem_fun(*this, &PrinterDiagnostic::continue_search));
+
+    const size_t first = first_shown_hit();
+    const size_t count = m_search_index.hits().size() - first;
+    if (count == 0) return;
+
+    if (!m_search_positioned) {
+        m_search_pos = delta > 0 ? 0 : count - 1;
+        m_search_positioned = true;
+    } else {
+        m_search_pos = (m_search_pos + (delta > 0 ? 1 : count - 1)) % count;
+    }
+    show_search_hit();
+    update_search_label(!m_search_conn.connected());
+}
+
+void PrinterDiagnostic::show_search_hit() {
+    m_buffer->remove_tag(m_tag_search, m_buffer->begin(), m_buffer->end());
+    const size_t line = m_search_index.hits()[first_shown_hit() + m_search_pos];
+    if (line < m_buffer_base || line - m_buffer_base >= (size_t)m_indexed_buffer_lines) return;
+
+    // Byte columns to character offsets for the buffer.
+    const std::string_view text = m_search_index.line(line);
+    const std::string query = m_search.get_text();
+    const size_t col = std::min(m_search_index.match_column(line, query), text.size());
+    auto chars = [](std::string_view s) {
+        int n = 0;
+        for (unsigned char c : s)
+            if ((c & 0xC0) != 0x80) ++n;
+        return n;
+    };
+    const int from = chars(text.substr(0, col));
+    const int to = from + chars(text.substr(col, query.size()));
+
+    const int buffer_line = (int)(line - m_buffer_base);
+    auto start = m_buffer->get_iter_at_line_offset(buffer_line, from);
+    m_buffer->apply_tag(m_tag_search, start, m_buffer->get_iter_at_line_offset(buffer_line, to));
+    m_textview.scroll_to(start, 0.2);
+}
+
+void PrinterDiagnostic::update_search_label(bool done) {
+    if (m_search.get_text().empty()) {
+        m_lbl_search.set_text("");
+        return;
+    }
+    const size_t first = first_shown_hit();
+    const size_t count = m_search_index.hits().size() - first;
+    std::string label;
+    if (count == 0) {
+        label = done ? "No matches" : "Searching...";
+    } else {
+        label = (m_search_positioned ? std::to_string(m_search_pos + 1) : std::string("-")) + " of " +
+                std::to_string(count) + (done ? "" : "+");
+        // Hits no longer in the pane (cleared earlier, or past sessions) are shown here.
+        if (m_search_positioned) {
+            const size_t line = m_search_index.hits()[first + m_search_pos];
+            if (line < m_buffer_base)
+                label += (line < m_history_lines ? "  [past session] " : "  [cleared] ") +
+                         std::string(m_search_index.line(line).substr(0, 200));
+        }
+    }
+    m_lbl_search.set_text(label);
+}
+
 // ============================================================
 // Command runner
 // ============================================================
 std::string PrinterDiagnostic::execute_command(const std::string& cmd, bool is_hplip) {
-    std::array<char, 256> buffer{};
-    std::string result;
+    int exit_code = 0;
+    return clean_output(run_shell_capture(cmd, exit_code), is_hplip);
+}
 
-    auto deleter = [](FILE* f) { if (f) pclose(f); };
-    std::unique_ptr<FILE, decltype(deleter)> pipe(popen(cmd.c_str(), "r"), deleter);
-    if (!pipe) return "";
+std::string PrinterDiagnostic::clean_output(const std::string& raw, bool is_hplip) const {
+    if (m_show_raw) return raw;
+    if (m_strip_global) return strip_ansi(raw);
+    if (is_hplip && m_strip_hplip) return strip_ansi(raw);
 
-    while (fgets(buffer.data(), (int)buffer.size(), pipe.get()) != nullptr) {
-        result += buffer.data();
+    return raw;
+}
+
+Glib::RefPtr<Gtk::TextTag> PrinterDiagnostic::ansi_tag(const SgrStyle& style) {
+    auto& tag = m_ansi_tags[style.key()];
+    if (tag) return tag;
+
+    auto hex = [](int rgb) {
+        char buf[8];
+        std::snprintf(buf, sizeof(buf), "#%06x", rgb);
+        return Glib::ustring(buf);
+    };
+    tag = Gtk::TextTag::create();
+    if (style.fg >= 0) tag->property_foreground() = hex(style.fg);
+    if (style.bg >= 0) tag->property_background() = hex(style.bg);
+    if (style.bold) tag->property_weight() = Pango::WEIGHT_BOLD;
+    if (style.italic) tag->property_style() = Pango::STYLE_ITALIC;
+    if (style.underline) tag->property_underline() = Pango::UNDERLINE_SINGLE;
+    m_buffer->get_tag_table()->add(tag);
+    return tag;
+}
+
+// Command output: SGR colours become cached tags unless raw output is on. The
+// text goes in with one insert; each styled run then gets one apply_tag.
+void PrinterDiagnostic::insert_output(const std::string& text, const Glib::RefPtr<Gtk::TextTag>& base) {
+    if (m_show_raw || text.find('\x1b') == std::string::npos) {
+        if (base) m_buffer->insert_with_tag(m_buffer->end(), text, base);
+        else m_buffer->insert(m_buffer->end(), text);
+        return;
     }
 
-    if (m_show_raw) return result;
-    if (m_strip_global) return strip_ansi(result);
-    if (is_hplip && m_strip_hplip) return strip_ansi(result);
+    struct Span { int from, to; SgrStyle style; };
+    std::string plain;
+    std::vector<Span> spans;
+    int chars = 0;
+
+    AnsiSgrParser parser;
+    parser.feed(text, [&](std::string_view run, const SgrStyle& style) {
+        const int from = chars;
+        for (unsigned char c : run)
+            if ((c & 0xC0) != 0x80) ++chars;  // Buffer offsets count characters, not bytes
+        plain.append(run);
+        if (style.plain()) return;
+        if (!spans.empty() && spans.back().to == from && spans.back().style.key() == style.key())
+            spans.back().to = chars;
+        else
+            spans.push_back({from, chars, style});
+    });
 
-    return result;
+    const int start = m_buffer->end().get_offset();
+    if (base) m_buffer->insert_with_tag(m_buffer->end(), plain, base);
+    else m_buffer->insert(m_buffer->end(), plain);
+    for (const auto& span : spans) {
+        m_buffer->apply_tag(ansi_tag(span.style), m_buffer->get_iter_at_offset(start + span.from),
+                            m_buffer->get_iter_at_offset(start + span.to));
+    }
+}
+
+// One IPC round trip to the privileged helper on its worker; the window stays live
+// through a polkit prompt. Errors are printed; on_ok gets the cleaned output.
+void PrinterDiagnostic::run_privileged(const std::string& op, std::function<void(const std::string& output)> on_ok) {
+    auto alive = m_alive;
+    m_priv.call_async(op, [this, alive, on_ok](const PrivResult& res) {
+        if (!*alive) return;
+        if (!res.ok) {
+            print_error(res.error);
+            return;
+        }
+        if (on_ok) on_ok(clean_output(res.output, false));
+    });
+}
+
+// ============================================================
+// Incremental re-diagnosis
+// - Each check's output is cached with fingerprints of what it depends on
+// - Events (wake, queue change, CUPS restart...) bump a dependency;
+//   stale or aged-out results are recomputed, the rest replayed
+// ============================================================
+std::string PrinterDiagnostic::dependency_fingerprint(const std::string& dep) {
+    std::ostringstream fp;
+    fp << m_diag_events[dep] << "|";
+    if (dep == "link") {
+        for (const auto& i : up_ipv4_interfaces()) fp << i.name << "=" << i.addr << ";";
+    } else if (dep == "neighbour") {
+        // Printer address and its ARP entry (flags + MAC) - changes on DHCP moves and lost neighbours.
+        const std::string ipv4 = resolve_ipv4(printer_host());
+        fp << printer_host() << ";";
+        std::ifstream arp("/proc/net/arp");
+        for (std::string line; std::getline(arp, line);) {
+            std::istringstream ls(line);
+            std::string ip, hw_type, flags, mac;
+            if (ls >> ip >> hw_type >> flags >> mac && ip == ipv4) fp << flags << " " << mac;
+        }
+    } else if (dep == "wake") {
+        if (auto t = m_wake.last_wake()) fp << (long long)*t;
+    } else if (dep == "queue") {
+        fp << m_latency.generation();
+    } else if (dep == "plugin") {
+        fp << hplip_metadata_key(read_hplip_plugin_status().plugin_dir);
+    }
+    return fp.str();
+}
+
+bool PrinterDiagnostic::run_cached(const std::string& id, bool force) {
+    struct CheckSpec {
+        std::vector<std::string> deps;
+        int max_age_sec;   // Upper bound even when nothing observable changed
+        bool (PrinterDiagnostic::*fn)();
+    };
+    static const std::map<std::string, CheckSpec> specs = {
+        {"ping",       {{"link", "neighbour", "wake"}, 120,  &PrinterDiagnostic::check_ping}},
+        {"port",       {{"link", "neighbour", "wake"}, 30,   &PrinterDiagnostic::check_port_9100}},
+        {"interfaces", {{"link", "neighbour", "wake"}, 60,   &PrinterDiagnostic::check_interfaces}},
+        {"cups",       {{"queue"},                     120,  &PrinterDiagnostic::check_cups_status}},
+        {"jobs",       {{"queue"},                     60,   &PrinterDiagnostic::check_stuck_jobs}},
+        {"plugin",     {{"plugin"},                    3600, &PrinterDiagnostic::check_plugin_version}},
+        {"uri",        {{"neighbour", "uri"},          60,   &PrinterDiagnostic::check_device_uri}},
+    };
+    const CheckSpec& spec = specs.at(id);
+
+    std::map<std::string, std::string> fingerprints;
+    for (const auto& d : spec.deps) fingerprints[d] = dependency_fingerprint(d);
+
+    const auto now = std::chrono::steady_clock::now();
+    auto it = m_diag_cache.find(id);
+    if (!force && it != m_diag_cache.end() && it->second.fingerprints == fingerprints &&
+        now - it->second.computed_at < std::chrono::seconds(spec.max_age_sec)) {
+        long age = (long)std::chrono::duration_cast<std::chrono::seconds>(now - it->second.computed_at).count();
+        m_buffer->insert_with_tag(m_buffer->end(), "(cached " + std::to_string(age) + " s ago - nothing it depends on changed)\n", m_tag_blue);
+        m_buffer->insert(m_buffer->end(), it->second.output->begin(), it->second.output->end());
+        scroll_to_end();
+        ++m_diag_hits;
+        return it->second.ok;
+    }
+
+    const int start = m_buffer->get_char_count();
+    bool ok = (this->*spec.fn)();
+
+    CachedCheck entry;
+    entry.ok = ok;
+    entry.computed_at = now;
+    entry.fingerprints = fingerprints;   // Taken before the run: a change mid-check re-runs next time
+    entry.output = Gtk::TextBuffer::create(m_buffer->get_tag_table());
+    entry.output->insert(entry.output->end(), m_buffer->get_iter_at_offset(start), m_buffer->end());
+    m_diag_cache[id] = entry;
+    return ok;
+}
+
+void PrinterDiagnostic::run_full_diagnostic(bool force) {
+    m_diag_hits = 0;
+
+    bool ping = run_cached("ping", force);
+    m_buffer->insert(m_buffer->end(), "\n");
+
+    bool port = run_cached("port", force);
+    m_buffer->insert(m_buffer->end(), "\n");
+
+    if (up_ipv4_interfaces().size() > 1) {
+        run_cached("interfaces", force);
+        m_buffer->insert(m_buffer->end(), "\n");
+    }
+
+    bool cups = run_cached("cups", force);
+    m_buffer->insert(m_buffer->end(), "\n");
+
+    bool uri = run_cached("uri", force);
+    m_buffer->insert(m_buffer->end(), "\n");
+
+    bool jobs = run_cached("jobs", force);
+    m_buffer->insert(m_buffer->end(), "\n");
+
+    bool plugin = run_cached("plugin", force);
+    m_buffer->insert(m_buffer->end(), "\n");
+
+    print_header("Diagnostic Summary");
+    bool all_ok = ping && port && cups && uri && jobs && plugin;
+
+    if (all_ok) {
+        print_success("All diagnostics passed! Printer should be working.");
+        if (!m_wake_enabled) {
+            print_info("Tip: Enable Continuous Wake Mode to prevent printer from sleeping");
+        }
+    } else {
+        print_warning("Some issues detected. Review the results above.");
+        print_info("Use the FIX menu options to resolve issues");
+    }
+    if (!force) print_info(std::to_string(m_diag_hits) + " check(s) reused from cache; the rest re-ran");
 }
 
 // ============================================================
@@ -1139,81 +7357,194 @@ std::string PrinterDiagnostic::execute_command(const std::string& cmd, bool is_h
 // ============================================================
 bool PrinterDiagnostic::check_ping() {
     print_info("Testing network connectivity (ping)...");
-    std::string cmd = "ping -c 3 -W 2 " + PRINTER_IP + " 2>&1";
+    std::string cmd = "ping -c 3 -W 2 " + shell_quote(printer_host()) + " 2>&1";
     std::string result = execute_command(cmd, false);
 
     if (result.find("0% packet loss") != std::string::npos || result.find("3 received") != std::string::npos) {
+        StatusPublisher::instance().publish_ping(true);
         print_success("Printer responds to ping - Network OK");
         return true;
     }
+    StatusPublisher::instance().publish_ping(false);
     print_error("Printer does not respond to ping - Network issue");
     print_warning("Check: Printer power, WiFi connection, router/bridge path");
+    trace_path();
     return false;
 }
 
-bool PrinterDiagnostic::check_port_9100() {
-    print_info("Testing JetDirect port 9100...");
-
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock == -1) {
-        print_error("Socket error creating test socket.");
+bool PrinterDiagnostic::trace_path() {
+    const std::string ipv4 = resolve_ipv4(printer_host());
+    if (ipv4.empty()) {
+        print_warning("Path probe needs an IPv4 address; " + printer_host() +
+                      (AddressCache::instance().resolving(printer_host()) ? " is still resolving" : " has none"));
         return false;
     }
+    print_info("Probing every hop to " + ipv4 + " at once (UDP + ICMP, ~1 s)...");
+    PathProbeResult res = probe_path(ipv4);
+    if (!res.error.empty()) {
+        print_error("Path probe failed: " + res.error);
+        return false;
+    }
+    if (!res.icmp_used) print_info("ICMP ping sockets unavailable (net.ipv4.ping_group_range) - UDP probes only");
+
+    std::ostringstream table;
+    table << "  Hop  Address           Loss   Min RTT   Avg RTT\n";
+    for (const auto& hop : res.hops) {
+        int loss = hop.sent ? 100 * (hop.sent - hop.received) / hop.sent : 100;
+        table << "  " << std::setw(3) << hop.ttl << "  " << std::left << std::setw(16)
+              << (hop.addr.empty() ? "*" : hop.addr) << std::right << std::setw(5) << loss << "%";
+        if (hop.received > 0)
+            table << std::fixed << std::setprecision(1) << std::setw(8) << hop.min_rtt_ms << " ms"
+                  << std::setw(7) << hop.sum_rtt_ms / hop.received << " ms";
+        if (hop.unreachable) table << "  unreachable";
+        table << "\n";
+    }
+    m_buffer->insert(m_buffer->end(), table.str());
+
+    if (res.target_ttl) {
+        const HopStat& last = res.hops.back();
+        int loss = last.sent ? 100 * (last.sent - last.received) / last.sent : 0;
+        if (loss > 0) {
+            print_warning("Printer reached at hop " + std::to_string(res.target_ttl) + " but " +
+                          std::to_string(loss) + "% of probes were lost - unstable last link");
+        } else {
+            print_success("Printer reached at hop " + std::to_string(res.target_ttl));
+        }
+        return true;
+    }
 
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(PRINTER_PORT);
-    addr.sin_addr.s_addr = inet_addr(PRINTER_IP.c_str());
+    const HopStat* last_ok = nullptr;
+    for (const auto& hop : res.hops)
+        if (hop.received > 0) last_ok = &hop;
 
-    fcntl(sock, F_SETFL, O_NONBLOCK);
+    if (!last_ok) {
+        print_error("No hop answered - this host's own link (Wi-Fi/Ethernet) or first router is down");
+    } else if (last_ok->unreachable) {
+        print_error("Hop " + std::to_string(last_ok->ttl) + " (" + last_ok->addr + ") reports the printer unreachable");
+        print_warning("That node has no route/ARP entry for the printer - check the mesh node or bridge it hangs off");
+    } else {
+        print_error("Path stops after hop " + std::to_string(last_ok->ttl) + " (" + last_ok->addr +
+                    ") - the next hop lost the printer");
+        print_warning("Check the mesh node / bridge behind " + last_ok->addr + " and the printer's Wi-Fi link");
+    }
+    print_info("Mesh nodes that bridge at layer 2 are invisible here: a same-subnet printer is always hop 1");
+    return false;
+}
 
-    int res = connect(sock, (sockaddr*)&addr, sizeof(addr));
-    if (res == 0) {
-        ::close(sock);
+bool PrinterDiagnostic::check_port_9100() {
+    print_info("Testing JetDirect port 9100...");
+
+    const auto started = std::chrono::steady_clock::now();
+    int err = tcp_connect_probe(printer_host(), PRINTER_PORT, 3000);
+    StatusPublisher::instance().publish_port(
+        err == 0, (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                      std::chrono::steady_clock::now() - started).count());
+    if (err == 0) {
         print_success("Port 9100 is OPEN - Printer ready to receive jobs");
         return true;
     }
-
-    if (errno != EINPROGRESS) {
-        ::close(sock);
-        print_error("Port 9100 ERROR: " + std::string(strerror(errno)));
+    if (err == ETIMEDOUT) {
+        print_error("Port 9100 TIMEOUT - Printer not responding");
+        print_warning("Solution: Power cycle the printer (deep sleep / network stack)");
+        return false;
+    }
+    if (err == ECONNREFUSED) {
+        print_error("Port 9100 REFUSED - Printer is in deep sleep");
+        print_warning("Solution: Press printer power button once to wake (or use option 8)");
         return false;
     }
 
-    fd_set writeSet;
-    FD_ZERO(&writeSet);
-    FD_SET(sock, &writeSet);
+    print_error("Port 9100 ERROR: " + std::string(strerror(err)));
+    return false;
+}
 
-    timeval tv{};
-    tv.tv_sec = 3;
-    tv.tv_usec = 0;
+// Per-interface view of ping + port 9100 (quick/full tests call this only on multi-homed hosts).
+bool PrinterDiagnostic::check_interfaces() {
+    auto ifaces = up_ipv4_interfaces();
+    if (ifaces.empty()) {
+        print_error("No IPv4 interface is up");
+        return false;
+    }
 
-    res = select(sock + 1, nullptr, &writeSet, nullptr, &tv);
-    if (res <= 0) {
-        ::close(sock);
-        if (res == 0) print_error("Port 9100 TIMEOUT - Printer not responding");
-        else print_error("Port 9100 ERROR: " + std::string(strerror(errno)));
-        print_warning("Solution: Power cycle the printer (deep sleep / network stack)");
+    // Both probes go to one IPv4 literal: ICMP cannot take a name, and a
+    // hostname or IPv6-only printer must not turn into a ping of 0.0.0.0.
+    const std::string ipv4 = resolve_ipv4(printer_host());
+    if (ipv4.empty()) {
+        if (AddressCache::instance().resolving(printer_host()))
+            print_warning(printer_host() + " is still resolving - run the check again in a moment");
+        else
+            print_error(printer_host() + " has no IPv4 address - per-interface probes need one");
         return false;
     }
 
-    int so_error = 0;
-    socklen_t len = sizeof(so_error);
-    getsockopt(sock, SOL_SOCKET, SO_ERROR, &so_error, &len);
-    ::close(sock);
+    print_info("Probing " + printer_host() + " (" + ipv4 + ") over each of " + std::to_string(ifaces.size()) +
+               " interface(s) at once...");
+    auto results = probe_interfaces(ipv4, PRINTER_PORT, 2000);
+
+    std::ostringstream table;
+    table << "  Interface   Source           Pinned by  Ping        Port 9100\n";
+    // Only SO_BINDTODEVICE results are known to have used their interface, so only
+    // they count toward the summary and the route suggestion.
+    const InterfaceProbe* fastest = nullptr;
+    int working = 0;
+    for (const auto& r : results) {
+        auto cell = [](bool ok, double ms, const std::string& err) {
+            std::ostringstream c;
+            if (ok) c << std::fixed << std::setprecision(1) << ms << " ms";
+            else c << err;
+            return c.str();
+        };
+        table << "  " << std::left << std::setw(12) << r.iface.name << std::setw(17) << r.iface.addr
+              << std::setw(11) << (r.pin.empty() ? "unverified" : r.pin)
+              << std::setw(12) << cell(r.icmp_err.empty(), r.icmp_ms, r.icmp_err)
+              << cell(r.tcp_err == 0, r.tcp_ms, r.tcp_err > 0 ? strerror(r.tcp_err) : "not tried") << "\n";
+        if (r.pin == "device" && r.tcp_err == 0) {
+            ++working;
+            if (!fastest || r.tcp_ms < fastest->tcp_ms) fastest = &r;
+        }
+    }
+    m_buffer->insert(m_buffer->end(), table.str());
+
+    int tested = 0;
+    bool source_reached = false;
+    for (const auto& r : results) {
+        if (r.pin == "device") {
+            ++tested;
+        } else if (r.pin == "source") {
+            // A source bind only picks the address; report where that traffic really
+            // leaves, but make no recommendation from it.
+            const std::string egress = route_egress(ipv4, r.iface.addr);
+            if (egress == r.iface.name)
+                print_info(r.iface.name + ": SO_BINDTODEVICE not permitted; traffic from " + r.iface.addr +
+                           " leaves via " + egress + ", so its result applies to this link (not ranked)");
+            else
+                print_warning(r.iface.name + ": SO_BINDTODEVICE not permitted; traffic from " + r.iface.addr +
+                              " leaves via " + (egress.empty() ? std::string("an unknown interface") : egress) +
+                              " - its result does not describe this link");
+            source_reached = source_reached || r.tcp_err == 0;
+        } else {
+            print_warning(r.iface.name + ": could not pin a socket to it (no SO_BINDTODEVICE, source bind failed) - not tested");
+        }
+    }
 
-    if (so_error == 0) {
-        print_success("Port 9100 is OPEN - Printer ready to receive jobs");
-        return true;
+    if (tested == 0) {
+        print_error("No interface could be pinned with SO_BINDTODEVICE - per-interface results are unavailable");
+        return source_reached;
     }
-    if (so_error == ECONNREFUSED) {
-        print_error("Port 9100 REFUSED - Printer is in deep sleep");
-        print_warning("Solution: Press printer power button once to wake (or use option 8)");
+    if (!fastest) {
+        print_error("Port 9100 unreachable over every tested interface");
         return false;
     }
-
-    print_error("Port 9100 ERROR: " + std::string(strerror(so_error)));
-    return false;
+    if (working < tested) {
+        print_warning("Only " + std::to_string(working) + " of " + std::to_string(tested) +
+                      " tested paths reach the printer");
+        print_info("Pin the working path: sudo ip route add " + ipv4 + "/32 dev " + fastest->iface.name);
+    } else if (tested > 1) {
+        print_success("All tested paths reach the printer; fastest is " + fastest->iface.name);
+    } else {
+        print_success("Printer reachable via " + fastest->iface.name);
+    }
+    return true;
 }
 
 bool PrinterDiagnostic::check_cups_status() {
@@ -1226,7 +7557,7 @@ bool PrinterDiagnostic::check_cups_status() {
     }
     if (result.find("disabled") != std::string::npos) {
         print_error("CUPS queue is DISABLED");
-        print_warning("Run: sudo cupsenable \"" + PRINTER_NAME + "\"");
+        print_warning("Run: sudo cupsenable \"" + PRINTER_NAME + "\" (or Resume Queue in option 12)");
 
         // Auto-recovery assessment (from dev version)
         try {
@@ -1255,7 +7586,7 @@ bool PrinterDiagnostic::check_cups_status() {
     }
 
     print_warning("Unknown CUPS status");
-    m_buffer->insert(m_buffer->end(), result + "\n");
+    insert_output(result + "\n");
     return false;
 }
 
@@ -1269,43 +7600,148 @@ bool PrinterDiagnostic::check_stuck_jobs() {
     }
 
     print_warning("Found jobs in queue:");
-    m_buffer->insert(m_buffer->end(), result + "\n");
+    insert_output(result + "\n");
     return false;
 }
 
 bool PrinterDiagnostic::check_plugin_version() {
     print_info("Checking HPLIP plugin version...");
-    std::string cmd = "sudo journalctl -u cups --since '5 minutes ago' 2>&1 | grep -i 'plugin.*mismatch'";
-    std::string result = execute_command(cmd, false);
+    const HplipPluginStatus st = read_hplip_plugin_status();
 
-    if (trim_copy(result).empty()) {
-        print_success("No plugin version errors detected");
+    if (!st.hplip_present()) {
+        print_error(std::string("HPLIP not found (no version in ") + HPLIP_CONF_PATH + ")");
+        print_warning("Install hplip, then the plugin: yay -S hplip-plugin");
+        return false;
+    }
+    if (!st.plugin_present()) {
+        print_error("HP plugin not installed (HPLIP " + st.hplip_version + ", " +
+                    std::to_string(st.plugin_files) + " plugin file(s) in " + st.plugin_dir + ")");
+        print_warning("The P1102w needs it: yay -S hplip-plugin (or hp-plugin -i)");
+        return false;
+    }
+    if (!st.versions_match()) {
+        print_error("Plugin version mismatch: HPLIP " + st.hplip_version + ", plugin " +
+                    (st.plugin_version.empty() ? std::string("unknown") : st.plugin_version));
+        print_warning("Run: yay -S hplip-plugin --rebuild");
+        print_warning("Then: sudo systemctl restart cups");
+        return false;
+    }
+
+    print_success("HPLIP " + st.hplip_version + " and plugin " + st.plugin_version + " match");
+    return true;
+}
+
+bool PrinterDiagnostic::check_device_uri() {
+    print_info("Checking the queue's device URI against the printer address...");
+    const DeviceUriCheck c = check_device_uri_drift(m_cups->device_uri(), printer_host());
+
+    switch (c.state) {
+    case DeviceUriCheck::State::Ok:
+        print_success("Device URI matches: " + c.summary());
+        return true;
+    case DeviceUriCheck::State::NotNetwork:
+        print_info("Device URI not checked: " + c.summary());
         return true;
+    case DeviceUriCheck::State::Unknown:
+        print_warning("Device URI not checked: " + c.summary());
+        return false;
+    case DeviceUriCheck::State::Unconfirmed:
+        print_warning("Device URI mismatch: " + c.summary());
+        print_info("Port 9100 is closed at both addresses - not suggesting a re-point until the printer answers");
+        return false;
+    case DeviceUriCheck::State::Drift:
+        break;
     }
 
-    print_error("Plugin version mismatch detected!");
-    print_warning("Run: yay -S hplip-plugin --rebuild");
-    print_warning("Then: sudo systemctl restart cups");
+    print_error("Device URI drift: " + c.summary());
+    print_info(std::string("Port 9100 at the old target: ") +
+               (c.uri_port_open ? "open (another device answers there)" : "closed") + "; at the printer: open");
+    print_warning("Jobs will wait out backend timeouts until the queue is re-pointed (option 21):");
+    print_warning("  " + c.suggested_uri);
     return false;
 }
 
 bool PrinterDiagnostic::get_printer_info() {
     print_info("Getting detailed printer information...");
-    std::string cmd = "hp-info -d hp:/net/" + PRINTER_NAME + "?ip=" + PRINTER_IP + " 2>&1";
-    std::string result = execute_command(cmd, true);
+    std::string result = execute_command(hp_info_command(), true);
 
     if (result.find("Communication status: Good") != std::string::npos || 
         result.find("Device") != std::string::npos) {
         print_success("HPLIP can communicate with printer");
-        m_buffer->insert_with_tag(m_buffer->end(), "\n" + result + "\n", m_tag_white);
+        insert_output("\n" + result + "\n", m_tag_white);
         return true;
     }
 
     print_warning("HPLIP returned output (see below)");
-    m_buffer->insert_with_tag(m_buffer->end(), "\n" + result + "\n", m_tag_white);
+    insert_output("\n" + result + "\n", m_tag_white);
     return false;
 }
 
+bool PrinterDiagnostic::check_link_speed() {
+    print_info("Probing formatter round-trip time and throughput (PJL ECHO)...");
+    EchoProbeResult res = pjl_echo_probe(printer_host(), PRINTER_PORT);
+
+    if (res.samples.empty()) {
+        print_error("Link probe failed: " + res.error);
+        print_info("Run option 1 first: the port must accept connections");
+        return false;
+    }
+    if (!res.error.empty()) print_warning("Probe incomplete: " + res.error);
+
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(1)
+        << "Connect: " << res.connect_ms << " ms, echo RTT min " << res.min_rtt_ms
+        << " ms / median " << res.median_rtt_ms << " ms, throughput "
+        << res.bytes_per_sec / 1024.0 << " KB/s (" << res.samples.size() << " echoes)";
+
+    metrics_append("pjl_echo", "connect_ms", res.connect_ms);
+    metrics_append("pjl_echo", "rtt_min_ms", res.min_rtt_ms);
+    metrics_append("pjl_echo", "rtt_median_ms", res.median_rtt_ms);
+    metrics_append("pjl_echo", "bytes_per_sec", res.bytes_per_sec);
+
+    // Thresholds: a healthy formatter on Wi-Fi answers in tens of ms.
+    bool ok = res.error.empty() && res.median_rtt_ms < 250.0 && res.bytes_per_sec > 20.0 * 1024;
+    if (ok) print_success(oss.str());
+    else {
+        print_warning(oss.str());
+        print_warning("Printer is reachable but slow - check Wi-Fi signal / mesh hop or formatter load");
+    }
+
+    auto history = metrics_recent("pjl_echo", 40);
+    std::vector<std::string> rows;
+    for (const auto& h : history) {
+        if (h.key != "rtt_median_ms") continue;
+        char when[32];
+        std::tm tm{};
+        localtime_r(&h.when, &tm);
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &tm);
+        std::ostringstream row;
+        row << "  " << when << "  median RTT " << std::fixed << std::setprecision(1) << h.value << " ms\n";
+        rows.push_back(row.str());
+    }
+    if (rows.size() > 1) {
+        m_buffer->insert_with_tag(m_buffer->end(), "\nRecent probes:\n", m_tag_bold);
+        size_t first = rows.size() > 10 ? rows.size() - 10 : 0;
+        for (size_t i = first; i < rows.size(); ++i) m_buffer->insert(m_buffer->end(), rows[i]);
+    }
+    return ok;
+}
+
+void PrinterDiagnostic::show_job_latency() {
+    auto lines = job_latency_report(500);
+    if (lines.empty()) {
+        print_info("No completed jobs recorded yet - latency is tracked while the program runs");
+        return;
+    }
+    print_info("Rolling percentiles over the last 500 jobs (p50/p90, seconds)");
+    for (const auto& line : lines) {
+        if (line.rfind("  ", 0) == 0) m_buffer->insert(m_buffer->end(), line + "\n");
+        else if (line.find("SLOWER") != std::string::npos) print_warning(line);
+        else m_buffer->insert_with_tag(m_buffer->end(), "\n" + line + "\n", m_tag_bold);
+    }
+    scroll_to_end();
+}
+
 // ============================================================
 // Fix actions
 // ============================================================
@@ -1316,41 +7752,245 @@ void PrinterDiagnostic::clear_stuck_jobs() {
 }
 
 void PrinterDiagnostic::send_wake_command() {
-    print_info("Sending wake command to printer...");
-    std::string cmd =
-        "printf '\\x1B%%-12345X@PJL\\r\\n@PJL INFO STATUS\\r\\n\\x1B%%-12345X\\r\\n' | "
-        "nc " + PRINTER_IP + " " + std::to_string(PRINTER_PORT) + " -w 3 2>/dev/null";
-    execute_command(cmd, false);
-    sleep(2);
-    print_success("Wake command sent - wait 5 seconds then test again");
-    
-    if (m_wake_enabled) {
-        update_wake_status();  // Update status with new timestamp
-    }
+    print_info("Racing wake strategies (preferred: " + m_wake.engine().preferred() + ")...");
+    auto alive = m_alive;
+    // Also updates the status line timestamp
+    const bool started = m_wake.wake_async("Manual", [this, alive](const WakeResult& res) {
+        if (!*alive) return;
+        if (res.already_awake) {
+            print_success("Port 9100 already accepting - keep-alive sent");
+        } else if (res.awake) {
+            print_success("Printer " + describe_wake(res));
+        } else {
+            print_error("Printer " + describe_wake(res));
+            print_warning("Solution: Press printer power button once to wake");
+        }
+        for (const auto& f : res.failures) print_warning("Strategy failed - " + f);
+
+        m_buffer->insert_with_tag(m_buffer->end(), "\nWake strategy history for " + m_wake.engine().host() + ":\n", m_tag_bold);
+        for (const auto& line : m_wake.engine().stats_lines())
+            m_buffer->insert(m_buffer->end(), "  " + line + "\n");
+        invalidate("wake");
+    });
+    if (!started) print_warning("A wake race is already running (timer or D-Bus) - its result shows in the status line");
 }
 
 void PrinterDiagnostic::restart_cups() {
     print_info("Restarting CUPS service...");
-    execute_command("sudo systemctl restart cups 2>&1", false);
-    print_success("CUPS restarted");
+    run_privileged("RESTART_CUPS", [this](const std::string& result) {
+        if (!trim_copy(result).empty()) insert_output(result + "\n");
+        print_success("CUPS restarted");
+        invalidate("queue");
+        invalidate("plugin");
+    });
+}
+
+// lpadmin -v through the helper, after the user confirms the exact change.
+void PrinterDiagnostic::repoint_queue() {
+    print_info("Comparing the queue's device URI with the printer address...");
+    const DeviceUriCheck c = check_device_uri_drift(m_cups->device_uri(), printer_host());
+    if (c.state == DeviceUriCheck::State::Unconfirmed) {
+        print_warning("Not re-pointing: " + c.summary() + ", and port 9100 does not answer there either");
+        return;
+    }
+    if (c.state != DeviceUriCheck::State::Drift) {
+        print_info("Nothing to re-point: " + c.summary());
+        return;
+    }
+    if (!valid_device_uri(c.suggested_uri)) {
+        print_error("Cannot derive a valid URI from " + c.uri);
+        return;
+    }
+
+    {
+        Gtk::MessageDialog dlg(*this, "Re-point the print queue?", false, Gtk::MESSAGE_QUESTION,
+                               Gtk::BUTTONS_OK_CANCEL, true);
+        dlg.set_secondary_text("From: " + c.uri + "\nTo: " + c.suggested_uri);
+        if (dlg.run() != Gtk::RESPONSE_OK) {
+            print_info("Queue left unchanged");
+            return;
+        }
+    }
+
+    print_info("Waiting for authorisation...");
+    const std::string target = c.suggested_uri;
+    run_privileged("SET_DEVICE_URI " + target, [this, target](const std::string& result) {
+        if (!trim_copy(result).empty()) insert_output(result + "\n");
+        const std::string now_uri = m_cups->device_uri();
+        if (now_uri == target) print_success("Queue now sends to " + now_uri);
+        else print_error("lpadmin ran, but the queue reports " + (now_uri.empty() ? std::string("no device URI") : now_uri));
+        invalidate("uri");
+    });
 }
 
 void PrinterDiagnostic::print_test_page() {
     print_info("Sending test page to printer...");
     std::string ts = now_timestamp_yyyymmdd_hhmmss();
-    std::string cmd = "echo \"Diagnostic Test Page - " + ts + "\" | lpr 2>&1";
+    std::string cmd = "echo \"Diagnostic Test Page - " + ts + "\" | lpr -P " + shell_quote(PRINTER_NAME) + " 2>&1";
     execute_command(cmd, false);
     print_success("Test page sent - check printer");
 }
 
+// ============================================================
+// Print benchmark
+// ============================================================
+void PrinterDiagnostic::start_benchmark(const BenchSettings& settings) {
+    if (m_bench_thread.joinable()) m_bench_thread.join();
+    m_bench_cancel = false;
+    m_bench_running = true;
+    m_btn_benchmark.set_label("14. Cancel Print Benchmark");
+
+    auto alive = m_alive;
+    m_bench_thread = std::thread([this, alive, settings]() {
+        BenchReport rep = run_print_benchmark(
+            settings,
+            [this, alive](const std::string& line) {
+                run_on_main([this, alive, line]() { if (*alive) print_info(line); });
+            },
+            [this]() { return m_bench_cancel.load(); });
+        run_on_main([this, alive, rep]() {
+            if (!*alive) return;
+            m_bench_running = false;
+            m_btn_benchmark.set_label("14. Print Benchmark...");
+            report_benchmark(rep);
+        });
+    });
+}
+
+void PrinterDiagnostic::report_benchmark(const BenchReport& rep) {
+    std::vector<double> queue_ms, first_page_ms, job_ppm;
+    int pages_done = 0;
+    for (const auto& job : rep.jobs) {
+        if (!job.completed) continue;
+        double queued = std::chrono::duration<double, std::milli>(*job.processing - job.submitted).count();
+        double printing = std::chrono::duration<double, std::milli>(*job.completed - *job.processing).count();
+        queue_ms.push_back(queued);
+        // lpstat has no per-sheet event: the first page is placed at its share of the print time.
+        first_page_ms.push_back(queued + printing / rep.settings.pages);
+        if (printing > 0) job_ppm.push_back(rep.settings.pages * 60000.0 / printing);
+        pages_done += rep.settings.pages;
+    }
+
+    if (!rep.error.empty()) print_warning("Benchmark stopped: " + rep.error);
+    if (queue_ms.empty()) {
+        print_error("No benchmark job completed");
+        return;
+    }
+
+    auto row = [](const std::string& name, const std::vector<double>& v, const char* unit, double scale) {
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(1) << "  " << std::left << std::setw(18) << name
+            << "p50 " << percentile(v, 50) * scale << unit << "  p90 " << percentile(v, 90) * scale << unit
+            << "  max " << percentile(v, 100) * scale << unit << "\n";
+        return oss.str();
+    };
+
+    double overall_ppm = rep.wall_ms > 0 ? pages_done * 60000.0 / rep.wall_ms : 0;
+    std::ostringstream head;
+    head << std::fixed << std::setprecision(1) << "Completed " << queue_ms.size() << "/" << rep.jobs.size()
+         << " jobs, " << pages_done << " pages in " << rep.wall_ms / 1000.0 << " s (" << overall_ppm << " ppm overall)";
+    print_success(head.str());
+
+    m_buffer->insert_with_tag(m_buffer->end(), "\nPer-job timing:\n", m_tag_bold);
+    m_buffer->insert(m_buffer->end(), row("Time in queue", queue_ms, " s", 0.001));
+    m_buffer->insert(m_buffer->end(), row("First page (est.)", first_page_ms, " s", 0.001));
+    if (!job_ppm.empty()) m_buffer->insert(m_buffer->end(), row("Pages per minute", job_ppm, "", 1.0));
+    scroll_to_end();
+
+    metrics_append("print_bench", "queue_p50_ms", percentile(queue_ms, 50));
+    metrics_append("print_bench", "first_page_p50_ms", percentile(first_page_ms, 50));
+    metrics_append("print_bench", "ppm_overall", overall_ppm);
+}
+
+void PrinterDiagnostic::start_raw_print(const std::string& host, int port, int pages, int padding_kb) {
+    if (m_raw_thread.joinable()) m_raw_thread.join();
+    m_raw_cancel = false;
+    m_raw_running = true;
+    m_btn_raw_print.set_label("15. Cancel Raw Port Print");
+
+    auto alive = m_alive;
+    m_raw_thread = std::thread([this, alive, host, port, pages, padding_kb]() {
+        const std::string doc = build_raw_test_document(pages, padding_kb);
+        RawSendResult res = raw_send_document(doc, host, port, [this]() { return m_raw_cancel.load(); });
+        run_on_main([this, alive, res, host, port]() {
+            if (!*alive) return;
+            m_raw_running = false;
+            m_btn_raw_print.set_label("15. Raw Port Print (bypass CUPS)...");
+
+            std::ostringstream oss;
+            oss << std::fixed << std::setprecision(1) << res.bytes / 1024.0 << " KB to " << host << ":" << port
+                << " - connect " << res.connect_ms << " ms, queued in " << res.send_ms << " ms, acknowledged in "
+                << res.total_ms << " ms (" << res.bytes_per_sec / 1024.0 << " KB/s)";
+            if (!res.error.empty()) {
+                print_error("Raw print failed: " + res.error);
+                if (res.bytes > 0) print_warning("Partial: " + oss.str());
+                return;
+            }
+            print_success(oss.str());
+            metrics_append("raw_print", "bytes_per_sec", res.bytes_per_sec);
+            metrics_append("raw_print", "total_ms", res.total_ms);
+            print_info("Compare with option 14: a much slower CUPS path points at the driver/filters, not the network");
+        });
+    });
+}
+
+// One line per flow per second; silent intervals are not printed twice.
+void PrinterDiagnostic::start_transfer_monitor() {
+    if (m_transfer_thread.joinable()) m_transfer_thread.join();
+    m_transfer_stop = false;
+    m_transfer_running = true;
+    m_btn_transfer.set_label("22. Stop Transfer Monitor");
+
+    auto alive = m_alive;
+    m_transfer_thread = std::thread([this, alive]() {
+        TransferMonitor monitor;
+        std::string last_error;
+        bool was_empty = false;
+        while (!m_transfer_stop) {
+            std::vector<TransferFlow> flows;
+            const bool ok = monitor.poll(AddressCache::instance().lookup(printer_host()), PRINTER_PORT, flows);
+            const std::string error = ok ? "" : monitor.error();
+            const bool quiet = flows.empty();
+            if (error != last_error || !quiet || !was_empty) {
+                run_on_main([this, alive, flows, error, quiet]() {
+                    if (!*alive) return;
+                    if (!error.empty()) print_error(error);
+                    else if (quiet) print_info("No connection to " + printer_host() + ":" + std::to_string(PRINTER_PORT) + " - waiting for a job");
+                    // Not journaled per line: the background poll journals stalls once.
+                    const std::time_t t = std::time(nullptr);
+                    std::tm tm{};
+                    localtime_r(&t, &tm);
+                    for (const auto& f : flows) {
+                        std::ostringstream line;
+                        line << std::put_time(&tm, "%H:%M:%S") << "  " << format_transfer_flow(f) << "\n";
+                        if (f.stalled) m_buffer->insert_with_tag(m_buffer->end(), line.str(), m_tag_yellow);
+                        else m_buffer->insert(m_buffer->end(), line.str());
+                    }
+                    scroll_to_end();
+                });
+            }
+            last_error = error;
+            was_empty = quiet;
+            for (int i = 0; i < 10 && !m_transfer_stop; ++i) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        run_on_main([this, alive]() {
+            if (!*alive) return;
+            m_transfer_running = false;
+            m_btn_transfer.set_label("22. Live Transfer Monitor");
+            print_info("Transfer monitor stopped");
+        });
+    });
+}
+
 // ============================================================
 // Other actions
 // ============================================================
 void PrinterDiagnostic::view_cups_logs() {
     print_header("Recent CUPS Logs (last 50 lines)");
-    std::string cmd = "sudo journalctl -u cups -n 50 --no-pager 2>&1";
-    std::string result = execute_command(cmd, false);
-    m_buffer->insert_with_tag(m_buffer->end(), result + "\n", m_tag_white);
+    run_privileged("CUPS_LOGS", [this](const std::string& result) {
+        m_buffer->insert_with_tag(m_buffer->end(), result + "\n", m_tag_white);
+        scroll_to_end();
+    });
 }
 
 void PrinterDiagnostic::open_queue_manager() {
@@ -1362,9 +8002,19 @@ void PrinterDiagnostic::open_queue_manager() {
         [this](const std::string& s) { this->print_info(s); },
         [this](const std::string& s) { this->print_success(s); },
         [this](const std::string& s) { this->print_warning(s); },
-        [this](const std::string& s) { this->print_error(s); }
+        [this](const std::string& s) { this->print_error(s); },
+        [this](const std::string& op, std::function<void(bool)> done) {
+            auto alive = m_alive;
+            m_priv.call_async(op, [this, alive, done](const PrivResult& res) {
+                if (!*alive) return;  // Window (and its log) gone
+                if (!res.ok) print_error(res.error);
+                done(res.ok);
+            });
+        },
+        [this](const JobSnapshot& jobs) { m_latency.observe(jobs, ""); }
     );
     dlg.run();
+    invalidate("queue");  // Jobs may have been cancelled or the queue paused
 }
 
 void PrinterDiagnostic::export_output() {
@@ -1392,8 +8042,9 @@ void PrinterDiagnostic::on_quick_test() {
     m_buffer->set_text("");
     print_header("Quick Diagnostic Test");
 
-    bool ping_ok = check_ping();
-    bool port_ok = check_port_9100();
+    bool ping_ok = run_cached("ping", true);
+    bool port_ok = run_cached("port", true);
+    if (up_ipv4_interfaces().size() > 1) run_cached("interfaces", true);
 
     m_buffer->insert_with_tag(m_buffer->end(), "\nSUMMARY:\n", m_tag_bold);
 
@@ -1413,52 +8064,31 @@ void PrinterDiagnostic::on_quick_test() {
 void PrinterDiagnostic::on_full_diagnostic() {
     m_buffer->set_text("");
     print_header("Full Diagnostic Scan");
+    run_full_diagnostic(true);
+}
 
-    bool ping = check_ping();
-    m_buffer->insert(m_buffer->end(), "\n");
-
-    bool port = check_port_9100();
-    m_buffer->insert(m_buffer->end(), "\n");
-
-    bool cups = check_cups_status();
-    m_buffer->insert(m_buffer->end(), "\n");
-
-    bool jobs = check_stuck_jobs();
-    m_buffer->insert(m_buffer->end(), "\n");
-
-    bool plugin = check_plugin_version();
-    m_buffer->insert(m_buffer->end(), "\n");
-
-    print_header("Diagnostic Summary");
-    bool all_ok = ping && port && cups && jobs && plugin;
-
-    if (all_ok) {
-        print_success("All diagnostics passed! Printer should be working.");
-        if (!m_wake_enabled) {
-            print_info("Tip: Enable Continuous Wake Mode to prevent printer from sleeping");
-        }
-    } else {
-        print_warning("Some issues detected. Review the results above.");
-        print_info("Use the FIX menu options to resolve issues");
-    }
+void PrinterDiagnostic::on_rerun() {
+    m_buffer->set_text("");
+    print_header("Re-run Diagnostics (incremental)");
+    run_full_diagnostic(false);
 }
 
 void PrinterDiagnostic::on_cups_status() {
     m_buffer->set_text("");
     print_header("CUPS Status Check");
-    check_cups_status();
+    run_cached("cups", true);
 }
 
 void PrinterDiagnostic::on_stuck_jobs() {
     m_buffer->set_text("");
     print_header("Stuck Jobs Check");
-    check_stuck_jobs();
+    run_cached("jobs", true);
 }
 
 void PrinterDiagnostic::on_plugin_version() {
     m_buffer->set_text("");
     print_header("Plugin Version Check");
-    check_plugin_version();
+    run_cached("plugin", true);
 }
 
 void PrinterDiagnostic::on_printer_info() {
@@ -1467,28 +8097,211 @@ void PrinterDiagnostic::on_printer_info() {
     get_printer_info();
 }
 
+void PrinterDiagnostic::on_link_probe() {
+    m_buffer->set_text("");
+    print_header("Link Speed Probe (PJL ECHO)");
+    check_link_speed();
+}
+
+void PrinterDiagnostic::on_benchmark() {
+    if (m_bench_running) {
+        m_bench_cancel = true;
+        print_warning("Cancelling benchmark - remaining jobs will be removed from the queue");
+        return;
+    }
+
+    Gtk::Dialog dlg("Print Benchmark", *this, true);
+    Gtk::Grid grid;
+    grid.set_row_spacing(6);
+    grid.set_column_spacing(10);
+    grid.set_border_width(10);
+
+    Gtk::Label lbl_jobs("Jobs:"), lbl_pages("Pages per job:"), lbl_lines("Lines per page:");
+    Gtk::SpinButton spin_jobs, spin_pages, spin_lines;
+    spin_jobs.set_range(1, 50);   spin_jobs.set_increments(1, 5);   spin_jobs.set_value(3);
+    spin_pages.set_range(1, 20);  spin_pages.set_increments(1, 5);  spin_pages.set_value(2);
+    spin_lines.set_range(2, BENCH_MAX_LINES_PER_PAGE); spin_lines.set_increments(1, 10);
+    spin_lines.set_value(BENCH_MAX_LINES_PER_PAGE);
+    Gtk::Label lbl_note("This prints real pages on " + PRINTER_NAME + " (one sheet per page).");
+
+    lbl_jobs.set_xalign(0.0f); lbl_pages.set_xalign(0.0f); lbl_lines.set_xalign(0.0f);
+    grid.attach(lbl_jobs, 0, 0, 1, 1);  grid.attach(spin_jobs, 1, 0, 1, 1);
+    grid.attach(lbl_pages, 0, 1, 1, 1); grid.attach(spin_pages, 1, 1, 1, 1);
+    grid.attach(lbl_lines, 0, 2, 1, 1); grid.attach(spin_lines, 1, 2, 1, 1);
+    grid.attach(lbl_note, 0, 3, 2, 1);
+    dlg.get_content_area()->pack_start(grid);
+    dlg.add_button("_Cancel", Gtk::RESPONSE_CANCEL);
+    dlg.add_button("_Start", Gtk::RESPONSE_OK);
+    dlg.show_all_children();
+    if (dlg.run() != Gtk::RESPONSE_OK) return;
+
+    BenchSettings settings;
+    settings.jobs = spin_jobs.get_value_as_int();
+    settings.pages = spin_pages.get_value_as_int();
+    settings.lines_per_page = spin_lines.get_value_as_int();
+
+    m_buffer->set_text("");
+    print_header("Print Benchmark");
+    print_info("Submitting " + std::to_string(settings.jobs) + " job(s) x " + std::to_string(settings.pages) +
+               " page(s) to " + PRINTER_NAME + " - click 14 again to cancel");
+    start_benchmark(settings);
+}
+
+void PrinterDiagnostic::on_raw_print() {
+    if (m_raw_running) {
+        m_raw_cancel = true;
+        print_warning("Cancelling raw port print");
+        return;
+    }
+
+    AppConfig cfg = m_config.get();
+    Gtk::Dialog dlg("Raw Port Print", *this, true);
+    Gtk::Grid grid;
+    grid.set_row_spacing(6);
+    grid.set_column_spacing(10);
+    grid.set_border_width(10);
+
+    Gtk::Label lbl_host("Host:"), lbl_port("Port:"), lbl_pages("Pages (sheets):"), lbl_kb("Extra KB (not printed):");
+    Gtk::Entry entry_host;
+    entry_host.set_text(cfg.raw_host.empty() ? printer_host() : cfg.raw_host);
+    Gtk::SpinButton spin_port, spin_pages, spin_kb;
+    spin_port.set_range(1, 65535); spin_port.set_increments(1, 100); spin_port.set_value(cfg.raw_port);
+    spin_pages.set_range(1, 20);   spin_pages.set_increments(1, 5);  spin_pages.set_value(2);
+    spin_kb.set_range(0, 4096);    spin_kb.set_increments(1, 64);    spin_kb.set_value(128);
+    Gtk::Label lbl_note("Sends PJL/PCL straight to the port, bypassing CUPS.\n"
+                        "Extra KB goes as PJL comments: more data to time, no more paper.\n"
+                        "Use 127.0.0.1 and a listener (nc -l 9100 > /dev/null) to test without a printer.");
+
+    lbl_host.set_xalign(0.0f); lbl_port.set_xalign(0.0f); lbl_pages.set_xalign(0.0f); lbl_kb.set_xalign(0.0f);
+    grid.attach(lbl_host, 0, 0, 1, 1);  grid.attach(entry_host, 1, 0, 1, 1);
+    grid.attach(lbl_port, 0, 1, 1, 1);  grid.attach(spin_port, 1, 1, 1, 1);
+    grid.attach(lbl_pages, 0, 2, 1, 1); grid.attach(spin_pages, 1, 2, 1, 1);
+    grid.attach(lbl_kb, 0, 3, 1, 1);    grid.attach(spin_kb, 1, 3, 1, 1);
+    grid.attach(lbl_note, 0, 4, 2, 1);
+    dlg.get_content_area()->pack_start(grid);
+    dlg.add_button("_Cancel", Gtk::RESPONSE_CANCEL);
+    dlg.add_button("_Send", Gtk::RESPONSE_OK);
+    dlg.show_all_children();
+    if (dlg.run() != Gtk::RESPONSE_OK) return;
+
+    const std::string host = trim_copy(entry_host.get_text());
+    cfg.raw_host = (host.empty() || host == printer_host()) ? "" : host;  // Empty follows the printer
+    cfg.raw_port = spin_port.get_value_as_int();
+    m_config.update(cfg);
+    const std::string target = cfg.raw_host.empty() ? printer_host() : cfg.raw_host;
+
+    m_buffer->set_text("");
+    print_header("Raw Port Print");
+    print_info("Streaming " + std::to_string(spin_pages.get_value_as_int()) + " page(s) to " + target + ":" +
+               std::to_string(cfg.raw_port) + " with sendfile...");
+    if (cfg.raw_host.empty())
+        print_warning("The P1102w is host-based (ZjStream): it may discard PCL, but the transfer timing is still valid");
+    start_raw_print(target, cfg.raw_port, spin_pages.get_value_as_int(), spin_kb.get_value_as_int());
+}
+
+void PrinterDiagnostic::on_job_latency() {
+    m_buffer->set_text("");
+    print_header("Job Latency Report");
+    show_job_latency();
+}
+
+void PrinterDiagnostic::on_trace_path() {
+    m_buffer->set_text("");
+    print_header("Trace Path to Printer");
+    trace_path();
+}
+
+void PrinterDiagnostic::on_interfaces() {
+    m_buffer->set_text("");
+    print_header("Probe All Interfaces");
+    check_interfaces();
+}
+
+// Keeps the current output: it goes into the bundle as session-output.txt.
+void PrinterDiagnostic::on_support_bundle() {
+    if (m_bundle_running) return;
+
+    const bool zstd = !Glib::find_program_in_path("zstd").empty();
+    Gtk::FileChooserDialog dlg(*this, "Save Support Bundle", Gtk::FILE_CHOOSER_ACTION_SAVE);
+    dlg.add_button("_Cancel", Gtk::RESPONSE_CANCEL);
+    dlg.add_button("_Save", Gtk::RESPONSE_OK);
+    dlg.set_current_name("hp-p1102w-support-" + now_timestamp_yyyymmdd_hhmmss() + (zstd ? ".tar.zst" : ".tar.gz"));
+    if (dlg.run() != Gtk::RESPONSE_OK) return;
+    const std::string path = dlg.get_filename();
+
+    std::vector<BundleSource> sources = support_bundle_sources(m_buffer->get_text());
+    print_header("Collect Support Bundle");
+    print_info("Collecting " + std::to_string(sources.size()) + " sources in parallel" +
+               (zstd ? "" : " (zstd not found - writing gzip)") + "...");
+
+    if (m_bundle_thread.joinable()) m_bundle_thread.join();
+    m_bundle_cancel = false;
+    m_bundle_running = true;
+    m_btn_bundle.set_sensitive(false);
+
+    auto alive = m_alive;
+    m_bundle_thread = std::thread([this, alive, path, sources]() {
+        BundleResult res = write_support_bundle(path, sources, m_bundle_cancel);
+        run_on_main([this, alive, path, res]() {
+            if (!*alive) return;
+            m_bundle_running = false;
+            m_btn_bundle.set_sensitive(true);
+            if (!res.error.empty()) {
+                print_error("Support bundle failed: " + res.error);
+                return;
+            }
+            for (const auto& e : res.entries) {
+                if (e.finished) continue;
+                print_warning(e.name + ": no result within its deadline (placeholder written)");
+            }
+            print_success("Support bundle written to " + path + " in " +
+                          std::to_string(res.total_ms) + " ms");
+        });
+    });
+}
+
+void PrinterDiagnostic::on_transfer_monitor() {
+    if (m_transfer_running) {
+        m_transfer_stop = true;
+        return;
+    }
+    m_buffer->set_text("");
+    print_header("Live Transfer Monitor");
+    print_info("Sampling TCP sockets to " + printer_host() + ":" + std::to_string(PRINTER_PORT) +
+               " every second (sock_diag) - click 22 again to stop");
+    start_transfer_monitor();
+}
+
 void PrinterDiagnostic::on_clear_jobs() {
     m_buffer->set_text("");
     print_header("Clear Stuck Jobs");
     clear_stuck_jobs();
+    invalidate("queue");
 }
 
 void PrinterDiagnostic::on_wake_command() {
     m_buffer->set_text("");
     print_header("Send Wake Command");
-    send_wake_command();
+    send_wake_command();  // Invalidates wake once the race is done
 }
 
 void PrinterDiagnostic::on_restart_cups() {
     m_buffer->set_text("");
     print_header("Restart CUPS");
-    restart_cups();
+    restart_cups();  // Invalidates queue and plugin once the restart is done
 }
 
 void PrinterDiagnostic::on_test_page() {
     m_buffer->set_text("");
     print_header("Print Test Page");
     print_test_page();
+    invalidate("queue");
+}
+
+void PrinterDiagnostic::on_repoint_queue() {
+    m_buffer->set_text("");
+    print_header("Re-point Queue");
+    repoint_queue();  // Invalidates uri once lpadmin ran
 }
 
 void PrinterDiagnostic::on_view_logs() {
@@ -1507,16 +8320,465 @@ void PrinterDiagnostic::on_export() {
 }
 
 void PrinterDiagnostic::on_exit() {
-    stop_wake_timer();
     save_config();
-    hide();
+    m_config.flush();
+    m_on_quit();
 }
 
+// ============================================================
+// Application controller
+// - Owns everything that must outlive the window (config, helper, wake)
+// - Background mode: closing the window destroys it; a tray icon
+//   (or launching the app again) rebuilds it from cached output
+// - Services start in startup(), which GApplication runs only in the primary
+//   instance; a second launch just activates the first one and exits
+// ============================================================
+class DiagnosticApp {
+public:
+    explicit DiagnosticApp(Glib::RefPtr<Gtk::Application> app)
+        : m_app(std::move(app)) {}
+
+    // signal_startup: primary instance only.
+    void startup() {
+        if (m_started) return;
+        m_started = true;
+        Journal::instance().open();
+        StatusPublisher::instance().open();
+        apply_service_config(m_wake, m_config.get());
+        m_config.watch([this](const AppConfig& c) { on_config_changed(c); });
+        m_latency.start();
+        m_dbus.start();
+    }
+
+    ~DiagnosticApp() {
+        m_wake.set_on_status(nullptr);
+        if (!m_started) return;
+        StatusPublisher::instance().close();
+        Journal::instance().close();
+    }
+
+    // Creates the window if needed and brings it to front.
+    void show_window() {
+        if (m_teardown_conn.connected()) m_teardown_conn.disconnect();
+
+        if (!m_window) {
+            m_window = std::make_unique<PrinterDiagnostic>(
+                m_config, m_priv, m_wake, m_latency, m_cached_output, [this]() { quit(); });
+            m_cached_output.clear();
+            m_window->signal_hide().connect(sigc::mem_fun(*this, &DiagnosticApp::on_window_hidden));
+        }
+        m_app->add_window(*m_window);  // Hidden windows are dropped from the app
+        if (m_held) {
+            m_app->release();
+            m_held = false;
+        }
+        m_window->present();
+    }
+
+    void quit() {
+        m_quitting = true;
+        m_dbus.stop();
+        m_wake.stop();
+        m_latency.stop();
+        m_config.flush();
+        StatusPublisher::instance().close();
+        Journal::instance().close();
+        if (m_tray) m_tray->set_visible(false);
+        if (m_window) m_window->hide();
+        if (m_held) {
+            m_app->release();
+            m_held = false;
+        }
+        m_app->quit();
+    }
+
+private:
+    Glib::RefPtr<Gtk::Application> m_app;
+    ConfigStore m_config;
+    PrivilegedHelper m_priv;
+    WakeScheduler m_wake{[this](const std::string& op) { return run_privileged_logged(m_priv, op); }};
+    JobLatencyTracker m_latency;
+    DBusService m_dbus{m_wake};
+
+    std::unique_ptr<PrinterDiagnostic> m_window;
+    std::string m_cached_output;
+    sigc::connection m_teardown_conn;
+
+    Glib::RefPtr<Gtk::StatusIcon> m_tray;
+    std::unique_ptr<Gtk::Menu> m_tray_menu;
+
+    bool m_held = false;
+    bool m_quitting = false;
+    bool m_started = false;
+
+    void on_window_hidden() {
+        if (m_quitting) return;
+
+        if (!m_config.get().run_in_background) {
+            quit();
+            return;
+        }
+
+        // Keep the process alive without a window and free the widgets.
+        if (!m_held) {
+            m_app->hold();
+            m_held = true;
+        }
+        m_cached_output = m_window->output_text();
+        m_teardown_conn = Glib::signal_idle().connect([this]() -> bool {
+            m_window.reset();
+            m_wake.set_on_status([this]() { update_tray_tooltip(); });
+            update_tray_tooltip();
+            return false;
+        });
+
+        ensure_tray();
+        m_tray->set_visible(true);
+        update_tray_tooltip();
+    }
+
+    void on_config_changed(const AppConfig& cfg) {
+        apply_service_config(m_wake, cfg);
+        if (m_window) m_window->apply_external_config();
+    }
+
+    void ensure_tray() {
+        if (m_tray) return;
+
+        m_tray = Gtk::StatusIcon::create("printer");
+        m_tray->signal_activate().connect([this]() { show_window(); });
+
+        m_tray_menu = std::make_unique<Gtk::Menu>();
+        auto* item_open = Gtk::manage(new Gtk::MenuItem("Open Diagnostic Tool"));
+        auto* item_quit = Gtk::manage(new Gtk::MenuItem("Quit"));
+        item_open->signal_activate().connect([this]() { show_window(); });
+        item_quit->signal_activate().connect([this]() { quit(); });
+        m_tray_menu->append(*item_open);
+        m_tray_menu->append(*item_quit);
+        m_tray_menu->show_all();
+
+        m_tray->signal_popup_menu().connect([this](guint button, guint32 activate_time) {
+            m_tray_menu->popup(button, activate_time);
+        });
+    }
+
+    void update_tray_tooltip() {
+        if (!m_tray) return;
+        std::string tip = "HP P1102w Diagnostic - Wake: ";
+        if (!m_wake.active()) tip += "disabled";
+        else if (m_wake.mode() == WakeMode::Interval)
+            tip += "active every " + std::to_string(m_wake.interval_minutes()) + " min";
+        else tip += "on job arrival";
+        if (auto t = m_wake.last_wake()) {
+            std::tm tm{};
+            localtime_r(&*t, &tm);
+            char buf[32];
+            strftime(buf, sizeof(buf), "%H:%M:%S", &tm);
+            tip += std::string(" (last ") + buf + ")";
+        }
+        m_tray->set_tooltip_text(tip);
+    }
+};
+
 // ============================================================
 // main
 // ============================================================
+// ============================================================
+// Journal reader (--journal [SINCE])
+// SINCE: "-30m" / "-2h" / "-1d", or local "YYYY-MM-DD[ HH:MM[:SS]]"; default -1d
+// ============================================================
+static bool parse_journal_since(const std::string& arg, int64_t& since_us) {
+    const int64_t now_us = journal_now_us();
+    if (arg.size() >= 3 && arg[0] == '-') {
+        char unit = arg.back();
+        long long n = 0;
+        try {
+            n = std::stoll(arg.substr(1, arg.size() - 2));
+        } catch (...) {
+            return false;
+        }
+        const int64_t mult = unit == 's' ? 1 : unit == 'm' ? 60 : unit == 'h' ? 3600 : unit == 'd' ? 86400 : 0;
+        if (mult == 0 || n < 0) return false;
+        since_us = now_us - (int64_t)n * mult * 1000000;
+        return true;
+    }
+    std::tm tm{};
+    int matched = std::sscanf(arg.c_str(), "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                              &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    if (matched < 3) return false;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    std::time_t t = std::mktime(&tm);
+    if (t == (std::time_t)-1) return false;
+    since_us = (int64_t)t * 1000000;
+    return true;
+}
+
+static int run_journal_reader(const std::string& since_arg) {
+    int64_t since_us = 0;
+    if (!parse_journal_since(since_arg.empty() ? "-1d" : since_arg, since_us)) {
+        std::cerr << "Invalid SINCE: " << since_arg << " (use -30m, -2h, -1d or YYYY-MM-DD HH:MM)\n";
+        return 2;
+    }
+    Gio::init();
+
+    for (const auto& rec : Journal::read_since(since_us)) std::cout << journal_format(rec) << '\n';
+    return 0;
+}
+
+// ============================================================
+// Status reader (--status)
+// Prints the running instance's shared status as key=value lines; exit 1 when none.
+// ============================================================
+static int run_status_reader() {
+    SharedStatus st{};
+    if (!read_shared_status(st)) {
+        std::cout << "running=0\n";
+        return 1;
+    }
+    std::cout << "running=1\n" << format_shared_status(st);
+    return 0;
+}
+
+// ============================================================
+// Self test (--self-test)
+// Parser and decision checks that need no display, printer or CUPS; run by ctest.
+// Prints one line per failure; exit 1 when any check fails.
+// ============================================================
+static int run_self_test() {
+    int failures = 0;
+    auto check = [&failures](bool ok, const std::string& what) {
+        if (!ok) {
+            std::cout << "FAIL " << what << '\n';
+            ++failures;
+        }
+    };
+
+    // Text runs (with their style) produced by feeding chunks to one parser.
+    auto sgr_runs = [](const std::vector<std::string>& chunks) {
+        std::vector<std::pair<std::string, SgrStyle>> runs;
+        AnsiSgrParser parser;
+        for (const auto& c : chunks)
+            parser.feed(c, [&runs](std::string_view text, const SgrStyle& style) {
+                if (!runs.empty() && runs.back().second.key() == style.key()) runs.back().first += text;
+                else runs.emplace_back(std::string(text), style);
+            });
+        return runs;
+    };
+
+    // `tput sgr0` on xterm-256color is ESC ( B ESC [ m.
+    const std::string sgr0 = "\x1b(B\x1b[m";
+    auto runs = sgr_runs({"\x1b[1;31mError" + sgr0 + " done\n"});
+    check(runs.size() == 2, "tput sgr0: two runs");
+    check(runs.size() == 2 && runs[0].first == "Error" && runs[0].second.bold && runs[0].second.fg >= 0,
+          "tput sgr0: styled run before reset");
+    check(runs.size() == 2 && runs[1].first == " done\n" && runs[1].second.plain(),
+          "tput sgr0: no stray 'B' and plain after reset");
+
+    runs = sgr_runs({"\x1b[32mok\x1b(", "B\x1b[m", "next"});
+    check(runs.size() == 2 && runs.back().first == "next" && runs.back().second.plain(),
+          "tput sgr0 split across chunks");
+
+    runs = sgr_runs({"\x1b)0\x1b*B\x1b+Ax"});
+    check(runs.size() == 1 && runs[0].first == "x", "G1-G3 charset designations are consumed");
+
+    check(strip_ansi("\x1b[31mred" + sgr0 + "\n") == "red\n", "strip_ansi: tput sgr0");
+
+    // Device URIs: the host parse_device_uri finds, and the URI re-pointed at 192.168.1.60.
+    struct UriCase {
+        const char* uri;
+        const char* host;
+        const char* repointed;
+    };
+    const UriCase uri_cases[] = {
+        {"ipp://192.168.1.50:631/ipp/print", "192.168.1.50", "ipp://192.168.1.60:631/ipp/print"},
+        {"ipp://lp@printer.lan/ipp", "printer.lan", "ipp://lp@192.168.1.60/ipp"},
+        {"socket://192.168.1.50:9100", "192.168.1.50", "socket://192.168.1.60:9100"},
+        {"socket://printer.lan", "printer.lan", "socket://192.168.1.60"},
+        {"hpwake://192.168.1.50:9100?wake_timeout=60", "192.168.1.50", "hpwake://192.168.1.60:9100?wake_timeout=60"},
+        {"hp:/net/HP_LaserJet_Professional_P1102w?ip=192.168.1.50", "192.168.1.50",
+         "hp:/net/HP_LaserJet_Professional_P1102w?ip=192.168.1.60"},
+        {"hp:/net/HP_LaserJet_Professional_P1102w?hostname=NPI1.lan&port=1", "NPI1.lan",
+         "hp:/net/HP_LaserJet_Professional_P1102w?ip=192.168.1.60&port=1"},
+        {"socket://[fd00::50]:9100", "fd00::50", "socket://192.168.1.60:9100"},
+        {"hp:/net/HP_LaserJet_Professional_P1102w?zc=NPI1", "", ""},
+        {"usb://HP/LaserJet%20Professional%20P1102w", "", ""},
+        {"dnssd://HP%20P1102w._pdl-datastream._tcp.local/", "", ""},
+    };
+    for (const auto& c : uri_cases) {
+        const DeviceUri d = parse_device_uri(c.uri);
+        check(d.host == c.host, std::string("parse_device_uri host: ") + c.uri);
+        check(valid_device_uri(c.uri) == (*c.host != 0), std::string("valid_device_uri: ") + c.uri);
+        if (*c.repointed)
+            check(repoint_device_uri(d, "192.168.1.60") == c.repointed, std::string("repoint_device_uri: ") + c.uri);
+    }
+    check(repoint_device_uri(parse_device_uri("socket://192.168.1.50:9100"), "fd00::60") == "socket://[fd00::60]:9100",
+          "repoint_device_uri: IPv6 literal is bracketed");
+    check(repoint_device_uri(parse_device_uri("hp:/net/P1102w?ip=192.168.1.50"), "printer.lan") ==
+              "hp:/net/P1102w?hostname=printer.lan",
+          "repoint_device_uri: hp name uses hostname=");
+    check(!valid_device_uri("socket://printer.lan;reboot"), "valid_device_uri: rejects shell metacharacters");
+
+    // Drift decisions against a canned network: names, open ports, neighbour table and mDNS.
+    struct DriftCase {
+        const char* what;
+        const char* uri;
+        const char* live_host;
+        std::map<std::string, std::string> names;   // Also maps a literal to itself
+        std::set<std::string> open;
+        std::string discovered;
+        DeviceUriCheck::State state;
+        const char* suggested;
+    };
+    const DriftCase drift_cases[] = {
+        {"target answers", "socket://192.168.1.50:9100", "192.168.1.50", {{"192.168.1.50", "192.168.1.50"}},
+         {"192.168.1.50"}, "", DeviceUriCheck::State::Ok, ""},
+        {"configured address moved", "socket://192.168.1.50:9100", "192.168.1.60",
+         {{"192.168.1.50", "192.168.1.50"}, {"192.168.1.60", "192.168.1.60"}}, {"192.168.1.60"}, "",
+         DeviceUriCheck::State::Drift, "socket://192.168.1.60:9100"},
+        {"name-based queue, configured name moved", "socket://printer.lan:9100", "p1102w.lan",
+         {{"printer.lan", "192.168.1.50"}, {"p1102w.lan", "192.168.1.60"}}, {"192.168.1.60"}, "",
+         DeviceUriCheck::State::Drift, "socket://p1102w.lan:9100"},
+        {"name-based queue, configured literal moved", "ipp://printer.lan/ipp/print", "192.168.1.60",
+         {{"printer.lan", "192.168.1.50"}, {"192.168.1.60", "192.168.1.60"}}, {"192.168.1.60"}, "",
+         DeviceUriCheck::State::Drift, "ipp://192.168.1.60/ipp/print"},
+        {"hp URI found by mDNS", "hp:/net/P1102w?ip=192.168.1.50", "192.168.1.50",
+         {{"192.168.1.50", "192.168.1.50"}}, {"192.168.1.70"}, "192.168.1.70",
+         DeviceUriCheck::State::Drift, "hp:/net/P1102w?ip=192.168.1.70"},
+        {"found elsewhere but closed", "hpwake://192.168.1.50:9100", "192.168.1.50",
+         {{"192.168.1.50", "192.168.1.50"}}, {}, "192.168.1.70", DeviceUriCheck::State::Unconfirmed, ""},
+        {"not found anywhere", "socket://192.168.1.50:9100", "192.168.1.50", {{"192.168.1.50", "192.168.1.50"}},
+         {}, "", DeviceUriCheck::State::Unknown, ""},
+        {"bracketed IPv6 moved", "socket://[fd00::50]:9100", "fd00::60",
+         {{"fd00::50", "fd00::50"}, {"fd00::60", "fd00::60"}}, {"fd00::60"}, "",
+         DeviceUriCheck::State::Drift, "socket://[fd00::60]:9100"},
+        {"USB queue", "usb://HP/LaserJet", "192.168.1.50", {}, {}, "", DeviceUriCheck::State::NotNetwork, ""},
+        {"no device-uri", "", "192.168.1.50", {}, {}, "", DeviceUriCheck::State::Unknown, ""},
+    };
+    for (const auto& c : drift_cases) {
+        DriftProbes probe;
+        probe.address = [&c](const std::string& host, int family) {
+            auto it = c.names.find(host);
+            if (it == c.names.end() || (it->second.find(':') != std::string::npos) != (family == AF_INET6))
+                return std::string();
+            return it->second;
+        };
+        probe.port_open = [&c](const std::string& addr) { return c.open.count(addr) > 0; };
+        probe.mac_of = [](const std::string&) { return std::string(); };
+        probe.ipv4_of = [](const std::string&) { return std::string(); };
+        probe.discover = [&c]() { return c.discovered; };
+        const DeviceUriCheck r = check_device_uri_drift(c.uri, c.live_host, probe);
+        check(r.state == c.state, std::string("check_device_uri_drift state: ") + c.what);
+        check(r.suggested_uri == c.suggested, std::string("check_device_uri_drift suggestion: ") + c.what);
+    }
+
+    // Output search: 64-line blocks, narrowing, resumed scans and history splicing.
+    auto filler = [](OutputSearchIndex& index, size_t from, size_t to) {
+        for (size_t i = from; i < to; ++i) index.append_line("line " + std::to_string(i) + ": idle");
+    };
+    auto full_scan = [](OutputSearchIndex& index, const std::string& query) {
+        index.search(query, std::chrono::hours(1));
+        return index.hits();
+    };
+    OutputSearchIndex index;
+    filler(index, 0, 10);
+    index.append_line("Printer OK");
+    filler(index, 11, 100);
+    index.append_line("printer offline: Paper Jam");
+    filler(index, 101, 170);
+    index.append_line("printer offline again");
+    filler(index, 171, 300);
+    check(full_scan(index, "paper jam") == std::vector<size_t>{100}, "search: hit in a later block");
+    check(index.match_column(100, "PAPER") == 17, "search: match column is case-insensitive");
+    check(index.match_column(100, "") == std::string_view::npos, "search: empty query matches no column");
+    check(full_scan(index, "").empty(), "search: empty query has no hits");
+    check(full_scan(index, "printer o") == std::vector<size_t>{10, 100, 170}, "search: shorter query");
+    check(full_scan(index, "printer of") == std::vector<size_t>{100, 170}, "search: narrowed query");
+    check(full_scan(index, "printer ok") == std::vector<size_t>{10}, "search: query after a narrowed one");
+
+    int calls = 1;
+    while (!index.search("offline", std::chrono::nanoseconds(0))) ++calls;
+    check(calls > 1 && index.hits() == std::vector<size_t>{100, 170}, "search: scan resumed after the budget ran out");
+
+    OutputSearchIndex history;
+    filler(history, 0, 5);
+    history.append_line("old session: paper jam");
+    filler(history, 6, 100);
+    index.splice_front(std::move(history));
+    check(index.line_count() == 400 && index.line(200) == "printer offline: Paper Jam",
+          "search: history lines go in front of the session's");
+    check(full_scan(index, "paper jam") == std::vector<size_t>{5, 200}, "search: hits across spliced history");
+
+    std::cout << (failures ? "self test failed\n" : "self test passed\n");
+    return failures ? 1 : 0;
+}
+
+// --service: the D-Bus API and background wake without GTK (no display needed).
+static gboolean quit_service_loop(gpointer loop) {
+    static_cast<Glib::MainLoop*>(loop)->quit();
+    return G_SOURCE_REMOVE;
+}
+
+static int run_service() {
+    Gio::init();
+    auto loop = Glib::MainLoop::create();
+
+    int status = 0;
+    bool owned = false;
+    {
+        ConfigStore config;
+        PrivilegedHelper priv;
+        WakeScheduler wake([&priv](const std::string& op) { return run_privileged_logged(priv, op); });
+        JobLatencyTracker latency;
+        DBusService service(wake);
+
+        // Shared state is only touched once the name is ours: a second instance
+        // exits 1 without opening the journal or the status segment.
+        service.start(
+            [&loop, &status]() {
+                status = 1;
+                loop->quit();
+            },
+            [&]() {
+                owned = true;
+                Journal::instance().open();
+                StatusPublisher::instance().open();
+                apply_service_config(wake, config.get());
+                config.watch([&wake](const AppConfig& cfg) { apply_service_config(wake, cfg); });
+                latency.start();
+            });
+        g_unix_signal_add(SIGTERM, quit_service_loop, loop.get());
+        g_unix_signal_add(SIGINT, quit_service_loop, loop.get());
+        loop->run();
+
+        service.stop();
+        wake.stop();
+        latency.stop();
+        config.flush();
+    }
+    if (owned) {
+        StatusPublisher::instance().close();
+        Journal::instance().close();
+    }
+    return status;
+}
+
 int main(int argc, char** argv) {
+    if (argc > 1 && std::strcmp(argv[1], PRIV_HELPER_FLAG) == 0) return run_privileged_helper();
+    if (argc > 1 && std::strcmp(argv[1], "--journal") == 0) return run_journal_reader(argc > 2 ? argv[2] : "");
+    if (argc > 1 && std::strcmp(argv[1], "--status") == 0) return run_status_reader();
+    if (argc > 1 && std::strcmp(argv[1], "--self-test") == 0) return run_self_test();
+
+    AddressCache::set_ui_thread();
+    if (argc > 1 && std::strcmp(argv[1], "--service") == 0) return run_service();
+
     auto app = Gtk::Application::create(argc, argv, "org.hp.p1102w.printer_diagnostic");
-    PrinterDiagnostic window;
-    return app->run(window);
+    DiagnosticApp diag(app);
+
+    // Startup runs in the primary instance only; a remote launch just activates it.
+    app->signal_startup().connect([&diag]() { diag.startup(); });
+    // Also fires when the app is launched again while running in background.
+    app->signal_activate().connect([&diag]() { diag.show_window(); });
+    return app->run();
 }
@@ -0,0 +1,372 @@
+// ============================================================
+// hpwake - Wake-aware CUPS backend for the HP P1102w
+// - Wraps socket:// (JetDirect 9100) delivery
+// - Wakes the printer (PJL + EWS connect) when 9100 does not accept
+// - Polls 9100 with sub-second backoff instead of CUPS's slow retry loop
+// - Streams the job with large writes and reports progress to CUPS
+//
+// Device URI: hpwake://host[:port][?wake_timeout=SECONDS]
+//
+// Install (the file name is the URI scheme):
+//   sudo install -m 0755 hpwake /usr/lib/cups/backend/hpwake
+//   sudo lpadmin -p HP_LaserJet_Professional_P1102w -v hpwake://192.168.4.68:9100
+//
+// Test against a stand-in listener:
+//   nc -l 9100 > job.out &
+//   DEVICE_URI=hpwake://127.0.0.1:9100 ./hpwake 1 user title 1 "" file.pcl
+//
+// Requires: C++17, Linux. No external libraries.
+// ============================================================
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ============================================================
+// CUPS backend exit codes (cups/backend.h)
+// ============================================================
+enum {
+    CUPS_BACKEND_OK     = 0,
+    CUPS_BACKEND_FAILED = 1,
+    CUPS_BACKEND_RETRY  = 6,
+};
+
+// ============================================================
+// Tuning
+// ============================================================
+static const int    DEFAULT_PORT          = 9100;
+static const int    DEFAULT_WAKE_TIMEOUT  = 60;          // seconds
+static const int    CONNECT_ATTEMPT_MS    = 500;
+static const int    BACKOFF_START_MS      = 50;
+static const int    BACKOFF_MAX_MS        = 800;
+static const size_t IO_CHUNK              = 256 * 1024;
+static const int    SNDBUF_BYTES          = 1024 * 1024;
+static const int    DRAIN_TIMEOUT_MS      = 10000;
+
+using Clock = std::chrono::steady_clock;
+
+// ============================================================
+// Helpers
+// ============================================================
+struct DeviceUri {
+    std::string host;
+    int port = DEFAULT_PORT;
+    int wake_timeout_sec = DEFAULT_WAKE_TIMEOUT;
+};
+
+static bool parse_device_uri(const std::string& uri, DeviceUri& out) {
+    auto scheme_end = uri.find("://");
+    if (scheme_end == std::string::npos) return false;
+    std::string rest = uri.substr(scheme_end + 3);
+
+    std::string query;
+    auto q = rest.find('?');
+    if (q != std::string::npos) {
+        query = rest.substr(q + 1);
+        rest = rest.substr(0, q);
+    }
+    while (!rest.empty() && rest.back() == '/') rest.pop_back();
+
+    // [v6addr]:port, host:port or host
+    if (!rest.empty() && rest.front() == '[') {
+        auto close = rest.find(']');
+        if (close == std::string::npos) return false;
+        out.host = rest.substr(1, close - 1);
+        if (close + 1 < rest.size() && rest[close + 1] == ':') out.port = std::atoi(rest.c_str() + close + 2);
+    } else {
+        auto colon = rest.rfind(':');
+        if (colon != std::string::npos) {
+            out.host = rest.substr(0, colon);
+            out.port = std::atoi(rest.c_str() + colon + 1);
+        } else {
+            out.host = rest;
+        }
+    }
+
+    const std::string key = "wake_timeout=";
+    for (size_t pos = 0; pos < query.size();) {
+        size_t amp = query.find('&', pos);
+        std::string kv = query.substr(pos, amp == std::string::npos ? std::string::npos : amp - pos);
+        if (kv.compare(0, key.size(), key) == 0) out.wake_timeout_sec = std::atoi(kv.c_str() + key.size());
+        if (amp == std::string::npos) break;
+        pos = amp + 1;
+    }
+
+    return !out.host.empty() && out.port > 0 && out.port < 65536 && out.wake_timeout_sec > 0;
+}
+
+static long ms_since(Clock::time_point t) {
+    return (long)std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - t).count();
+}
+
+// Non-blocking connect with a deadline. Returns a connected blocking socket or -1 (errno set).
+static int connect_with_timeout(const std::string& host, int port, int timeout_ms) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    const std::string service = std::to_string(port);
+    if (getaddrinfo(host.c_str(), service.c_str(), &hints, &res) != 0 || !res) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    int fd = -1;
+    int last_err = ETIMEDOUT;
+    for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK, ai->ai_protocol);
+        if (fd < 0) {
+            last_err = errno;
+            continue;
+        }
+
+        int r = connect(fd, ai->ai_addr, ai->ai_addrlen);
+        if (r != 0 && errno == EINPROGRESS) {
+            pollfd pfd{fd, POLLOUT, 0};
+            do {
+                r = poll(&pfd, 1, timeout_ms);
+            } while (r < 0 && errno == EINTR);
+
+            if (r > 0) {
+                int so_error = 0;
+                socklen_t len = sizeof(so_error);
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+                r = so_error == 0 ? 0 : -1;
+                last_err = so_error;
+            } else {
+                last_err = (r == 0) ? ETIMEDOUT : errno;
+                r = -1;
+            }
+        } else if (r != 0) {
+            last_err = errno;
+        }
+
+        if (r == 0) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (fd < 0) errno = last_err;
+    return fd;
+}
+
+static bool write_all(int fd, const char* p, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// ============================================================
+// Wake
+// ============================================================
+
+// Best-effort nudges for a sleeping network stack: a PJL status request on
+// the print port, and a plain connect to the embedded web server.
+static void send_wake(const DeviceUri& dev) {
+    static const char pjl[] = "\x1B%-12345X@PJL\r\n@PJL INFO STATUS\r\n\x1B%-12345X\r\n";
+
+    int fd = connect_with_timeout(dev.host, dev.port, CONNECT_ATTEMPT_MS);
+    if (fd >= 0) {
+        write_all(fd, pjl, sizeof(pjl) - 1);
+        close(fd);
+    }
+    fd = connect_with_timeout(dev.host, 80, CONNECT_ATTEMPT_MS);
+    if (fd >= 0) close(fd);
+}
+
+// Returns a connected socket, or -1 when the printer did not wake in time.
+static int connect_waking(const DeviceUri& dev) {
+    const auto start = Clock::now();
+    const long deadline_ms = dev.wake_timeout_sec * 1000L;
+
+    int fd = connect_with_timeout(dev.host, dev.port, CONNECT_ATTEMPT_MS);
+    if (fd >= 0) return fd;
+
+    fprintf(stderr, "STATE: +connecting-to-device\n");
+    fprintf(stderr, "INFO: Printer not accepting connections (%s) - waking it\n", strerror(errno));
+    send_wake(dev);
+
+    int backoff_ms = BACKOFF_START_MS;
+    int attempts = 1;
+    long next_wake_ms = 5000;
+    while (ms_since(start) < deadline_ms) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+        backoff_ms = std::min(backoff_ms * 2, BACKOFF_MAX_MS);
+
+        fd = connect_with_timeout(dev.host, dev.port, CONNECT_ATTEMPT_MS);
+        ++attempts;
+        if (fd >= 0) {
+            fprintf(stderr, "STATE: -connecting-to-device\n");
+            fprintf(stderr, "INFO: Printer awake after %ld ms (%d attempts)\n", ms_since(start), attempts);
+            return fd;
+        }
+
+        // Re-nudge every few seconds in case the first wake was lost.
+        if (ms_since(start) >= next_wake_ms) {
+            fprintf(stderr, "DEBUG: Still waiting for port %d (%s), re-sending wake\n", dev.port, strerror(errno));
+            send_wake(dev);
+            next_wake_ms += 5000;
+        }
+    }
+
+    fprintf(stderr, "STATE: -connecting-to-device\n");
+    return -1;
+}
+
+// ============================================================
+// Job streaming
+// ============================================================
+static bool stream_job(int sock, int in_fd, long long& sent, Clock::time_point start) {
+    std::vector<char> buf(IO_CHUNK);
+    long long next_report = 1 << 20;
+
+    for (;;) {
+        ssize_t n = read(in_fd, buf.data(), buf.size());
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "ERROR: Unable to read print data: %s\n", strerror(errno));
+            return false;
+        }
+        if (n == 0) return true;
+
+        if (!write_all(sock, buf.data(), (size_t)n)) {
+            fprintf(stderr, "ERROR: Connection to printer lost: %s\n", strerror(errno));
+            return false;
+        }
+        sent += n;
+
+        if (sent >= next_report) {
+            long ms = std::max(1L, ms_since(start));
+            fprintf(stderr, "INFO: Sent %lld KB (%.1f KB/s)\n", sent / 1024, (double)sent / 1024.0 * 1000.0 / ms);
+            next_report = sent + (1 << 20);
+        }
+    }
+}
+
+// Reads (and logs) back-channel data until the printer closes the connection.
+static void drain_backchannel(int sock) {
+    char buf[4096];
+    const auto start = Clock::now();
+    while (ms_since(start) < DRAIN_TIMEOUT_MS) {
+        pollfd pfd{sock, POLLIN, 0};
+        int r = poll(&pfd, 1, 250);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) continue;
+        ssize_t n = recv(sock, buf, sizeof(buf), 0);
+        if (n <= 0) return;
+        fprintf(stderr, "DEBUG: Received %zd bytes of back-channel data\n", n);
+    }
+}
+
+// ============================================================
+// main
+// ============================================================
+int main(int argc, char** argv) {
+    setvbuf(stderr, nullptr, _IONBF, 0);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Device discovery (lpinfo -v)
+    if (argc == 1) {
+        printf("network hpwake \"Unknown\" \"HP wake-aware JetDirect (hpwake)\"\n");
+        return CUPS_BACKEND_OK;
+    }
+
+    if (argc < 6 || argc > 7) {
+        fprintf(stderr, "Usage: %s job-id user title copies options [file]\n", argv[0]);
+        return CUPS_BACKEND_FAILED;
+    }
+
+    const char* uri_env = getenv("DEVICE_URI");
+    std::string uri = uri_env ? uri_env : argv[0];
+    DeviceUri dev;
+    if (!parse_device_uri(uri, dev)) {
+        fprintf(stderr, "ERROR: Bad device URI \"%s\" (expected hpwake://host[:port])\n", uri.c_str());
+        return CUPS_BACKEND_FAILED;
+    }
+
+    int in_fd = STDIN_FILENO;
+    int copies = 1;
+    if (argc == 7) {
+        in_fd = open(argv[6], O_RDONLY | O_CLOEXEC);
+        if (in_fd < 0) {
+            fprintf(stderr, "ERROR: Unable to open print file \"%s\": %s\n", argv[6], strerror(errno));
+            return CUPS_BACKEND_FAILED;
+        }
+        // Copies are only replayed for files; stdin is already collated by the filters.
+        copies = std::max(1, std::atoi(argv[4]));
+    }
+
+    const auto job_start = Clock::now();
+    int sock = connect_waking(dev);
+    if (sock < 0) {
+        fprintf(stderr, "ERROR: Printer at %s:%d did not wake within %d s - will retry\n",
+                dev.host.c_str(), dev.port, dev.wake_timeout_sec);
+        // RETRY keeps the queue enabled instead of tripping the stop-printer error policy.
+        return CUPS_BACKEND_RETRY;
+    }
+
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &SNDBUF_BYTES, sizeof(SNDBUF_BYTES));
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+
+    fprintf(stderr, "STATE: +sending-data\n");
+    fprintf(stderr, "INFO: Connected to %s:%d after %ld ms\n", dev.host.c_str(), dev.port, ms_since(job_start));
+
+    const auto send_start = Clock::now();
+    long long sent = 0;
+    bool ok = true;
+    for (int copy = 0; copy < copies && ok; ++copy) {
+        if (copy > 0 && lseek(in_fd, 0, SEEK_SET) != 0) break;
+        if (copies > 1) fprintf(stderr, "INFO: Sending copy %d of %d\n", copy + 1, copies);
+        ok = stream_job(sock, in_fd, sent, send_start);
+    }
+
+    if (in_fd != STDIN_FILENO) close(in_fd);
+
+    if (ok) {
+        shutdown(sock, SHUT_WR);
+        drain_backchannel(sock);
+    }
+    close(sock);
+    fprintf(stderr, "STATE: -sending-data\n");
+
+    if (!ok) {
+        // Retrying resends the whole job, so only do it when the printer got nothing;
+        // after a partial send a retry would print the first pages twice.
+        if (sent == 0) return CUPS_BACKEND_RETRY;
+        fprintf(stderr, "ERROR: Job interrupted after %lld bytes - not retrying to avoid a duplicate printout\n", sent);
+        return CUPS_BACKEND_FAILED;
+    }
+
+    long ms = std::max(1L, ms_since(send_start));
+    fprintf(stderr, "INFO: Sent %lld bytes in %ld ms (%.1f KB/s), total %ld ms including wake\n",
+            sent, ms, (double)sent / 1024.0 * 1000.0 / ms, ms_since(job_start));
+    return CUPS_BACKEND_OK;
+}
@@ -4,6 +4,7 @@ set -euo pipefail
 REPO_URL="https://github.com/mjdeiter/printer_diagnostics.git"
 APP_NAME="HP_P1102w_Printer_Diagnostic_Tool"
 SRC_FILE="HP_P1102w_Printer_Diagnostic_Tool.cpp"
+BACKEND_SRC_FILE="hpwake_backend.cpp"
 
 echo "🔧 HP P1102w Printer Diagnostic Tool – Full Rebuild Script"
 echo
@@ -63,6 +64,11 @@ fi
 
 echo "✅ Source of truth found: $SRC_FILE"
 
+if [[ ! -f "$BACKEND_SRC_FILE" ]]; then
+  echo "❌ ERROR: $BACKEND_SRC_FILE not found."
+  exit 1
+fi
+
 # ------------------------------------------------------------
 # 4. Create CMake project (minimal, safe)
 # ------------------------------------------------------------
@@ -70,6 +76,7 @@ echo "🧱 Preparing CMake build..."
 
 mkdir -p src
 cp -u "$SRC_FILE" "src/$SRC_FILE"
+cp -u "$BACKEND_SRC_FILE" "src/$BACKEND_SRC_FILE"
 
 cat > CMakeLists.txt <<EOF
 cmake_minimum_required(VERSION 3.16)
@@ -87,9 +94,22 @@ add_executable(${APP_NAME}
 
 target_include_directories(${APP_NAME} PRIVATE \${GTKMM_INCLUDE_DIRS})
 target_compile_options(${APP_NAME} PRIVATE \${GTKMM_CFLAGS_OTHER})
-target_link_libraries(${APP_NAME} PRIVATE \${GTKMM_LIBRARIES})
+target_link_libraries(${APP_NAME} PRIVATE \${GTKMM_LIBRARIES} rt)  # rt: shm_open on glibc < 2.34
 
 install(TARGETS ${APP_NAME} RUNTIME DESTINATION bin)
+
+# Parser checks that need no display, printer or CUPS
+enable_testing()
+add_test(NAME self_test COMMAND ${APP_NAME} --self-test)
+
+# Wake-aware CUPS backend (no GTK); the file name is the URI scheme (hpwake://)
+add_executable(hpwake
+    src/${BACKEND_SRC_FILE}
+)
+
+set(CUPS_BACKEND_DIR "/usr/lib/cups/backend" CACHE PATH "CUPS backend directory")
+install(TARGETS hpwake RUNTIME DESTINATION \${CUPS_BACKEND_DIR}
+        PERMISSIONS OWNER_READ OWNER_WRITE OWNER_EXECUTE GROUP_READ GROUP_EXECUTE WORLD_READ WORLD_EXECUTE)
 EOF
 
 # ------------------------------------------------------------
@@ -102,6 +122,7 @@ mkdir build
 cd build
 cmake ..
 cmake --build .
+ctest --output-on-failure
 
 echo
 echo "✅ Build complete."
@@ -116,6 +137,7 @@ if [[ "$install_ans" =~ ^[Yy]$ ]]; then
   sudo cmake --install .
   echo "✅ Installed. Run with:"
   echo "  ${APP_NAME}"
+  echo "CUPS backend installed as hpwake (use device URI hpwake://<printer-ip>:9100)."
 else
   echo "ℹ️  Skipping install."
   echo "Run locally with:"